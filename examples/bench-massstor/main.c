@@ -0,0 +1,163 @@
+#include <fx2regs.h>
+#include <fx2lib.h>
+#include <fx2debug.h>
+#include <fx2usbmassstor.h>
+#include <fx2scsi.h>
+#include <stdio.h>
+
+// A benchmark of the per-sector overhead of the USB Mass Storage and SCSI code, which prints
+// the number of instruction cycles it takes to process a 512-byte sector of READ(10) and
+// WRITE(10) commands to a software UART on PA0. The block device does not access any data, so
+// only the time spent in the library and in passing the callback arguments is measured.
+//
+// The same code can be linked against either the fx2usbmassstor library, which calls
+// the callbacks through the function pointers, or the fx2usbmassstor_direct library, which
+// calls them directly; build it with `make` and `make DIRECT=1` to compare the two.
+
+DEFINE_DEBUG_PUTCHAR_FN(PA0, 38400)
+
+#define SECTORS 64
+
+static bool null_read(uint32_t lba, __xdata uint8_t *data, uint16_t count) __reentrant {
+  lba; data; count;
+  return true;
+}
+
+static bool null_write(uint32_t lba, __xdata const uint8_t *data, uint16_t count) __reentrant {
+  lba; data; count;
+  return true;
+}
+
+blockdev_t null_blockdev = {
+  .sector_count = 1024,
+  .read         = null_read,
+  .write        = null_write,
+};
+
+scsi_block_device_state_t scsi_state = {
+  .vendor_id    = "libfx2  ",
+  .product_id   = "Benchmark       ",
+  .revision     = "A0  ",
+  .device       = &null_blockdev,
+};
+
+bool scsi_command_lun(uint8_t lun, __xdata uint8_t *command, uint8_t length) __reentrant {
+  lun;
+  return scsi_command(&scsi_state, command, length);
+}
+
+bool scsi_data_out_lun(uint8_t lun, __xdata const uint8_t *data, uint16_t length) __reentrant {
+  lun;
+  return scsi_data_out(&scsi_state, data, length);
+}
+
+bool scsi_data_in_lun(uint8_t lun, __xdata uint8_t *data, uint16_t length) __reentrant {
+  lun;
+  return scsi_data_in(&scsi_state, data, length);
+}
+
+usb_mass_storage_bbb_state_t usb_mass_storage_state = {
+  .interface    = 0,
+  .max_in_size  = 512,
+
+  .command      = scsi_command_lun,
+  .data_out     = scsi_data_out_lun,
+  .data_in      = scsi_data_in_lun,
+};
+
+// The callbacks of the fx2usbmassstor_direct library; unused with fx2usbmassstor.
+bool usb_mass_storage_bbb_command(uint8_t lun, __xdata uint8_t *command, uint8_t length) {
+  lun;
+  return scsi_command(&scsi_state, command, length);
+}
+
+bool usb_mass_storage_bbb_data_out(uint8_t lun, __xdata const uint8_t *data, uint16_t length) {
+  lun;
+  return scsi_data_out(&scsi_state, data, length);
+}
+
+bool usb_mass_storage_bbb_data_in(uint8_t lun, __xdata uint8_t *data, uint16_t length) {
+  lun;
+  return scsi_data_in(&scsi_state, data, length);
+}
+
+bool scsi_blockdev_read(uint32_t lba, __xdata uint8_t *data, uint16_t count) {
+  lba; data; count;
+  return true;
+}
+
+bool scsi_blockdev_write(uint32_t lba, __xdata const uint8_t *data, uint16_t count) {
+  lba; data; count;
+  return true;
+}
+
+bool scsi_blockdev_flush(void) {
+  return true;
+}
+
+__xdata uint8_t buffer[512];
+__xdata uint16_t length;
+uint32_t cycles;
+
+static void timer_start(void) {
+  TL0 = 0;
+  TH0 = 0;
+  TR0 = 1;
+}
+
+static void timer_stop(void) {
+  TR0 = 0;
+  cycles += ((uint16_t)TH0 << 8) | TL0;
+}
+
+static void send_command(uint8_t op_code, bool data_in) {
+  usb_mass_storage_cbw_t *cbw = (usb_mass_storage_cbw_t *)buffer;
+
+  xmemclr(buffer, sizeof(struct usb_mass_storage_cbw));
+  cbw->dCBWSignature          = USB_MASS_STORAGE_CBW_SIGNATURE;
+  cbw->dCBWDataTransferLength = SECTORS * 512UL;
+  cbw->bmCBWFlags             = data_in ? USB_MASS_STORAGE_CBW_FLAG_DATA_IN : 0;
+  cbw->bCBWCBLength           = 10;
+  cbw->CBWCB[0]               = op_code;
+  // Transfer length, big endian.
+  cbw->CBWCB[8]               = SECTORS;
+  usb_mass_storage_bbb_bulk_out(&usb_mass_storage_state, buffer,
+                                sizeof(struct usb_mass_storage_cbw));
+}
+
+int main(void) {
+  uint8_t sector;
+
+  // Run core at 48 MHz fCLK.
+  CPUCS = _CLKSPD1;
+
+  OEA = (1U<<0);
+  PA0 = 1;
+
+  // Timer 0 is a 16-bit timer clocked at CLKOUT/4, i.e. incremented once per instruction cycle.
+  TMOD  = _M0_0;
+  CKCON |= _T0M;
+
+  send_command(SCSI_OPERATION_READ_10, /*data_in=*/true);
+  cycles = 0;
+  for(sector = 0; sector < SECTORS; sector++) {
+    timer_start();
+    usb_mass_storage_bbb_bulk_in(&usb_mass_storage_state, buffer, &length);
+    timer_stop();
+  }
+  // Consume the CSW.
+  usb_mass_storage_bbb_bulk_in(&usb_mass_storage_state, buffer, &length);
+  printf("READ(10):  %u cycles per sector\r\n", (uint16_t)(cycles / SECTORS));
+
+  send_command(SCSI_OPERATION_WRITE_10, /*data_in=*/false);
+  cycles = 0;
+  for(sector = 0; sector < SECTORS; sector++) {
+    timer_start();
+    usb_mass_storage_bbb_bulk_out(&usb_mass_storage_state, buffer, 512);
+    timer_stop();
+  }
+  usb_mass_storage_bbb_bulk_in(&usb_mass_storage_state, buffer, &length);
+  printf("WRITE(10): %u cycles per sector\r\n", (uint16_t)(cycles / SECTORS));
+
+  while(1);
+}
@@ -116,7 +116,7 @@ usb_dfu_desc_functional_c usb_dfu_functional = {
                           USB_DFU_ATTR_CAN_UPLOAD |
                           USB_DFU_ATTR_MANIFESTATION_TOLERANT |
                           USB_DFU_ATTR_WILL_DETACH,
-  .wTransferSize        = 64,
+  .wTransferSize        = 256,
   .bcdDFUVersion        = 0x0101,
 };
 
@@ -227,8 +227,8 @@ usb_dfu_status_t firmware_dnload_flash(uint32_t offset, __xdata uint8_t *data,
       return USB_DFU_STATUS_errERASE;
   }
 
-  // Our DFU block size is fixed at 64 (EP0 buffer size), which means that DFU download requests
-  // never cross page boundaries and are smaller than page size of any practical SPI flash.
+  // Our DFU block size is fixed at 256, the page size of practically any SPI flash, which means
+  // that DFU download requests never cross page boundaries and are no larger than a page.
   // Therefore, we can forward the download requests directly as flash page program requests.
   flash_wren();
   flash_pp(offset, data, length);
@@ -259,12 +259,23 @@ usb_dfu_status_t firmware_dnload(uint32_t offset, __xdata uint8_t *data,
   return USB_DFU_STATUS_errUNKNOWN;
 }
 
+// Receive the next block while the previous one is being programmed into the EEPROM or
+// the SPI flash. This takes another 512 bytes of XRAM.
+__xdata uint8_t dnload_buffer[512];
+
 usb_dfu_iface_state_t usb_dfu_iface_state = {
   .interface       = 0,
   .firmware_upload = firmware_upload,
   .firmware_dnload = firmware_dnload,
+  .dnload_buffer   = dnload_buffer,
 };
 
+void isr_EP0OUT(void) __interrupt {
+  usb_dfu_ep0out(&usb_dfu_iface_state);
+  CLEAR_USB_IRQ();
+  EPIRQ = _EPI_EP0OUT;
+}
+
 void handle_usb_get_interface(uint8_t interface) {
   if(interface == 0) {
     EP0BUF[0] = dfu_alt_setting;
@@ -297,6 +308,8 @@ int main(void) {
 
   flash_bus_deinit();
 
+  EPIE = _EPI_EP0OUT;
+
   usb_init(/*disconnect=*/true);
 
   while(1) {
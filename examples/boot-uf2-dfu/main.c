@@ -123,7 +123,7 @@ usb_dfu_desc_functional_c usb_dfu_functional = {
                           USB_DFU_ATTR_CAN_UPLOAD |
                           USB_DFU_ATTR_MANIFESTATION_TOLERANT |
                           USB_DFU_ATTR_WILL_DETACH,
-  .wTransferSize        = 64,
+  .wTransferSize        = 512,
   .bcdDFUVersion        = 0x0101,
 };
 
@@ -0,0 +1,225 @@
+// A USB mass storage device that exposes an SPI flash as a removable disk.
+
+#include <fx2lib.h>
+#include <fx2delay.h>
+#include <fx2spiflash.h>
+#include <fx2usbmassstor.h>
+#include <fx2scsi.h>
+
+// Memory parameters:
+#define FLASH_SIZE  1048576
+
+DEFINE_SPIFLASH_FNS(flash, /*cs=*/PA0, /*sck=*/PA1, /*si=*/PA2, /*so=*/PA3)
+
+// The flash can only be erased 4 KiB at a time, so sector writes are collected in this buffer,
+// and programmed into the flash once the host writes to another erase sector, synchronizes
+// the cache, or ejects the medium.
+__xdata uint8_t flash_cache[4096];
+
+DEFINE_SPIFLASH_BLOCKDEV(flash, FLASH_SIZE / BLOCKDEV_SECTOR_SIZE, flash_cache)
+
+usb_desc_device_c usb_device = {
+  .bLength              = sizeof(struct usb_desc_device),
+  .bDescriptorType      = USB_DESC_DEVICE,
+  .bcdUSB               = 0x0200,
+  .bDeviceClass         = USB_DEV_CLASS_PER_INTERFACE,
+  .bDeviceSubClass      = USB_DEV_SUBCLASS_PER_INTERFACE,
+  .bDeviceProtocol      = USB_DEV_PROTOCOL_PER_INTERFACE,
+  .bMaxPacketSize0      = 64,
+  .idVendor             = 0x04b4,
+  .idProduct            = 0x8613,
+  .bcdDevice            = 0x0000,
+  .iManufacturer        = 1,
+  .iProduct             = 2,
+  .iSerialNumber        = 3,
+  .bNumConfigurations   = 1,
+};
+
+usb_desc_interface_c usb_interface_mass_storage = {
+  .bLength              = sizeof(struct usb_desc_interface),
+  .bDescriptorType      = USB_DESC_INTERFACE,
+  .bInterfaceNumber     = 0,
+  .bAlternateSetting    = 0,
+  .bNumEndpoints        = 2,
+  .bInterfaceClass      = USB_IFACE_CLASS_MASS_STORAGE,
+  .bInterfaceSubClass   = USB_IFACE_SUBCLASS_MASS_STORAGE_SCSI,
+  .bInterfaceProtocol   = USB_IFACE_PROTOCOL_MASS_STORAGE_BBB,
+  .iInterface           = 0,
+};
+
+usb_desc_endpoint_c usb_endpoint_ep2_out = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 2,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 512,
+  .bInterval            = 0,
+};
+
+usb_desc_endpoint_c usb_endpoint_ep6_in = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 6|USB_DIR_IN,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 512,
+  .bInterval            = 0,
+};
+
+usb_configuration_c usb_config = {
+  {
+    .bLength              = sizeof(struct usb_desc_configuration),
+    .bDescriptorType      = USB_DESC_CONFIGURATION,
+    .bNumInterfaces       = 1,
+    .bConfigurationValue  = 1,
+    .iConfiguration       = 0,
+    .bmAttributes         = USB_ATTR_RESERVED_1,
+    .bMaxPower            = 50,
+  },
+  {
+    { .interface  = &usb_interface_mass_storage },
+    { .endpoint   = &usb_endpoint_ep2_out },
+    { .endpoint   = &usb_endpoint_ep6_in  },
+    { 0 }
+  }
+};
+
+usb_configuration_set_c usb_configs[] = {
+  &usb_config,
+};
+
+usb_ascii_string_c usb_strings[] = {
+  [0] = "whitequark@whitequark.org",
+  [1] = "FX2 series SPI flash disk",
+  [2] = "000000000000",
+};
+
+usb_descriptor_set_c usb_descriptor_set = {
+  .device          = &usb_device,
+  .config_count    = ARRAYSIZE(usb_configs),
+  .configs         = usb_configs,
+  .string_count    = ARRAYSIZE(usb_strings),
+  .strings         = usb_strings,
+};
+
+scsi_block_device_state_t scsi_state = {
+  .vendor_id        = "Qi-Hardw",
+  .product_id       = "SPI flash disk  ",
+  .revision         = "A0  ",
+  .removable        = true,
+  .device           = &flash_blockdev,
+};
+
+bool scsi_command_lun(uint8_t lun, __xdata uint8_t *command, uint8_t length) __reentrant {
+  lun;
+
+  return scsi_command(&scsi_state, command, length);
+}
+
+bool scsi_data_out_lun(uint8_t lun, __xdata const uint8_t *data, uint16_t length) __reentrant {
+  lun;
+
+  return scsi_data_out(&scsi_state, data, length);
+}
+
+bool scsi_data_in_lun(uint8_t lun, __xdata uint8_t *data, uint16_t length) __reentrant {
+  lun;
+
+  return scsi_data_in(&scsi_state, data, length);
+}
+
+usb_mass_storage_bbb_state_t usb_mass_storage_state = {
+  .interface    = 0,
+  .max_in_size  = 512,
+
+  .command      = scsi_command_lun,
+  .data_out     = scsi_data_out_lun,
+  .data_in      = scsi_data_in_lun,
+};
+
+volatile bool pending_bomsr;
+
+void handle_usb_setup(__xdata struct usb_req_setup *req) {
+  if(usb_mass_storage_bbb_setup(&usb_mass_storage_state, req)) {
+    if(req->bRequest == USB_REQ_MASS_STORAGE_BOMSR)
+      pending_bomsr = true;
+    return;
+  }
+
+  STALL_EP0();
+}
+
+int main(void) {
+  // Run core at 48 MHz fCLK.
+  CPUCS = _CLKSPD1;
+
+  OEA |= 0b0111;
+  flash_init();
+  flash_rdp();
+
+  // Use newest chip features.
+  REVCTL = _ENH_PKT|_DYN_OUT;
+
+  // NAK all transfers.
+  SYNCDELAY;
+  FIFORESET = _NAKALL;
+
+  // EP2 is configured as 512-byte double buffed BULK OUT.
+  EP2CFG  =  _VALID|_TYPE1|_BUF1;
+  EP2CS   = 0;
+  // EP6 is configured as 512-byte double buffed BULK IN.
+  EP6CFG  =  _VALID|_DIR|_TYPE1|_BUF1;
+  EP6CS   = 0;
+  // EP4/8 are not used.
+  EP4CFG &= ~_VALID;
+  EP8CFG &= ~_VALID;
+
+  // Reset and prime EP2, and reset EP6.
+  SYNCDELAY;
+  FIFORESET = _NAKALL|2;
+  SYNCDELAY;
+  OUTPKTEND = _SKIP|2;
+  SYNCDELAY;
+  OUTPKTEND = _SKIP|2;
+  SYNCDELAY;
+  FIFORESET = _NAKALL|6;
+  SYNCDELAY;
+  FIFORESET = 0;
+
+  // Re-enumerate, to make sure our descriptors are picked up correctly.
+  usb_init(/*disconnect=*/true);
+
+  while(1) {
+    // See firmware/boot-uf2 for a description of the mass storage main loop.
+    if(pending_bomsr) {
+      pending_bomsr = false;
+      FIFORESET = _NAKALL;
+      SYNCDELAY;
+      FIFORESET = _NAKALL|6;
+      SYNCDELAY;
+      FIFORESET = 0;
+    }
+
+    if(!(EP2CS & _EMPTY)) {
+      uint16_t length = (EP2BCH << 8) | EP2BCL;
+      if(usb_mass_storage_bbb_bulk_out(&usb_mass_storage_state, EP2FIFOBUF, length)) {
+        EP2BCL = 0;
+      } else {
+        EP2CS  = _STALL;
+        EP6CS  = _STALL;
+      }
+    }
+
+    if(!(EP6CS & _FULL) && usb_mass_storage_bbb_bulk_in_ready(&usb_mass_storage_state)) {
+      __xdata uint16_t length;
+      if(usb_mass_storage_bbb_bulk_in(&usb_mass_storage_state, EP6FIFOBUF, &length)) {
+        if(length > 0 && !pending_bomsr) {
+          EP6BCH = length >> 8;
+          SYNCDELAY;
+          EP6BCL = length;
+        }
+      } else {
+        EP6CS  = _STALL;
+      }
+    }
+  }
+}
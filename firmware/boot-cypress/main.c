@@ -32,6 +32,38 @@ usb_desc_interface_c usb_interface = {
   .iInterface           = 0,
 };
 
+// The bulk endpoints are in alternate setting 1, same as in the descriptors of the boot ROM,
+// so that the host can select it whether or not the device has re-enumerated.
+usb_desc_interface_c usb_interface_bulk = {
+  .bLength              = sizeof(struct usb_desc_interface),
+  .bDescriptorType      = USB_DESC_INTERFACE,
+  .bInterfaceNumber     = 0,
+  .bAlternateSetting    = 1,
+  .bNumEndpoints        = 2,
+  .bInterfaceClass      = USB_IFACE_CLASS_VENDOR,
+  .bInterfaceSubClass   = USB_IFACE_SUBCLASS_VENDOR,
+  .bInterfaceProtocol   = USB_IFACE_PROTOCOL_VENDOR,
+  .iInterface           = 0,
+};
+
+usb_desc_endpoint_c usb_endpoint_ep2_out = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 2,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 512,
+  .bInterval            = 0,
+};
+
+usb_desc_endpoint_c usb_endpoint_ep6_in = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 6|USB_DIR_IN,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 512,
+  .bInterval            = 0,
+};
+
 usb_configuration_c usb_config = {
   {
     .bLength              = sizeof(struct usb_desc_configuration),
@@ -44,6 +76,9 @@ usb_configuration_c usb_config = {
   },
   {
     { .interface = &usb_interface },
+    { .interface = &usb_interface_bulk },
+    { .endpoint  = &usb_endpoint_ep2_out },
+    { .endpoint  = &usb_endpoint_ep6_in },
     { 0 }
   }
 };
@@ -57,6 +92,55 @@ usb_configuration_set_c usb_configs[] = {
   &usb_config,
 };
 
+// At full speed, bulk endpoints have packets of at most 64 bytes, so the configuration is
+// described with these endpoints instead; see handle_usb_get_descriptor() below. The host only
+// reads these descriptors if the device re-enumerates; otherwise, it keeps using those of
+// the boot ROM, which describe the same endpoints in alternate setting 1 at either speed.
+usb_desc_endpoint_c usb_endpoint_ep2_out_fs = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 2,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 64,
+  .bInterval            = 0,
+};
+
+usb_desc_endpoint_c usb_endpoint_ep6_in_fs = {
+  .bLength              = sizeof(struct usb_desc_endpoint),
+  .bDescriptorType      = USB_DESC_ENDPOINT,
+  .bEndpointAddress     = 6|USB_DIR_IN,
+  .bmAttributes         = USB_XFER_BULK,
+  .wMaxPacketSize       = 64,
+  .bInterval            = 0,
+};
+
+usb_configuration_c usb_config_fs = {
+  {
+    .bLength              = sizeof(struct usb_desc_configuration),
+    .bDescriptorType      = USB_DESC_CONFIGURATION,
+    .bNumInterfaces       = 1,
+    .bConfigurationValue  = 1,
+    .iConfiguration       = 0,
+    .bmAttributes         = USB_ATTR_RESERVED_1,
+    .bMaxPower            = 50,
+  },
+  {
+    { .interface = &usb_interface },
+    { .interface = &usb_interface_bulk },
+    { .endpoint  = &usb_endpoint_ep2_out_fs },
+    { .endpoint  = &usb_endpoint_ep6_in_fs },
+    { 0 }
+  }
+};
+
+#if !defined(__SDCC_VERSION_MAJOR)
+__code const struct usb_configuration *__code const usb_configs_fs[] = {
+#else
+usb_configuration_set_c usb_configs_fs[] = {
+#endif
+  &usb_config_fs,
+};
+
 usb_ascii_string_c usb_strings[] = {
   [0] = "whitequark@whitequark.org",
   [1] = "FX2 series Cypress-class bootloader",
@@ -70,12 +154,28 @@ usb_descriptor_set_c usb_descriptor_set = {
   .strings          = usb_strings,
 };
 
+usb_descriptor_set_c usb_descriptor_set_fs = {
+  .device           = &usb_device,
+  .config_count     = ARRAYSIZE(usb_configs_fs),
+  .configs          = usb_configs_fs,
+  .string_count     = ARRAYSIZE(usb_strings),
+  .strings          = usb_strings,
+};
+
+void handle_usb_get_descriptor(enum usb_descriptor type, uint8_t index) {
+  if(USBCS & _HSM)
+    usb_serve_descriptor(&usb_descriptor_set, type, index);
+  else
+    usb_serve_descriptor(&usb_descriptor_set_fs, type, index);
+}
+
 enum {
   USB_REQ_CYPRESS_EEPROM_SB  = 0xA2,
   USB_REQ_CYPRESS_EXT_RAM    = 0xA3,
   USB_REQ_CYPRESS_RENUMERATE = 0xA8,
   USB_REQ_CYPRESS_EEPROM_DB  = 0xA9,
   USB_REQ_LIBFX2_PAGE_SIZE   = 0xB0,
+  USB_REQ_LIBFX2_BULK_CMD    = 0xB1,
 };
 
 // We perform lengthy operations in the main loop to avoid hogging the interrupt.
@@ -125,6 +225,17 @@ void handle_pending_usb_setup(void) {
     return;
   }
 
+  if(req->bmRequestType == (USB_RECIP_DEVICE|USB_TYPE_VENDOR|USB_DIR_IN) &&
+     req->bRequest == USB_REQ_LIBFX2_BULK_CMD) {
+    pending_setup = false;
+
+    while(EP0CS & _BUSY);
+    EP0BUF[0] = 2;
+    EP0BUF[1] = 6|USB_DIR_IN;
+    SETUP_EP0_IN_BUF(2);
+    return;
+  }
+
   if((req->bmRequestType == (USB_RECIP_DEVICE|USB_TYPE_VENDOR|USB_DIR_IN) ||
       req->bmRequestType == (USB_RECIP_DEVICE|USB_TYPE_VENDOR|USB_DIR_OUT)) &&
      (req->bRequest == USB_REQ_CYPRESS_EEPROM_SB ||
@@ -197,16 +308,161 @@ void handle_pending_usb_setup(void) {
   STALL_EP0();
 }
 
+// Requests A2, A3 and A9 move data through EP0 one 64-byte packet at a time, with a handshake
+// for every packet. The same requests are also accepted on a bulk command channel, which moves
+// data in 512-byte packets, double buffered: the host sends a command header on EP2 OUT, laid
+// out the same as a SETUP packet (with the address in wValue and the length in wLength), then
+// sends or receives the data on EP2 OUT or EP6 IN, then receives a one-byte status packet
+// on EP6 IN, which is 0 on success. If a read fails, the data is cut short by a short or
+// zero-length packet before the status. A command is abandoned if a SETUP request arrives.
+// The host discovers the channel with the libfx2-specific request B1, which returns
+// the addresses of the endpoints.
+
+static bool bulk_wait_out(void) {
+  while(EP2CS & _EMPTY) {
+    if(pending_setup)
+      return false;
+  }
+  return true;
+}
+
+static bool bulk_wait_in(void) {
+  while(EP6CS & _FULL) {
+    if(pending_setup)
+      return false;
+  }
+  return true;
+}
+
+static void bulk_commit_in(uint16_t length) {
+  EP6BCH = length >> 8;
+  SYNCDELAY;
+  EP6BCL = length;
+}
+
+void handle_bulk_command(void) {
+  __xdata struct usb_req_setup *cmd = (__xdata struct usb_req_setup *)EP2FIFOBUF;
+  uint16_t packet_size = (USBCS & _HSM) ? 512 : 64;
+  bool     arg_read, arg_eeprom, arg_dbyte;
+  uint8_t  arg_chip;
+  uint16_t arg_addr, arg_len;
+  bool     ok = true;
+
+  if(((EP2BCH << 8) | EP2BCL) != sizeof(struct usb_req_setup)) {
+    EP2BCL = 0;
+    return;
+  }
+  arg_read   = (cmd->bmRequestType & USB_DIR_IN);
+  arg_eeprom = (cmd->bRequest == USB_REQ_CYPRESS_EEPROM_SB ||
+                cmd->bRequest == USB_REQ_CYPRESS_EEPROM_DB);
+  arg_dbyte  = (cmd->bRequest == USB_REQ_CYPRESS_EEPROM_DB);
+  arg_chip   = arg_dbyte ? 0x51 : 0x50;
+  arg_addr   = cmd->wValue;
+  arg_len    = cmd->wLength;
+  if(!arg_eeprom && cmd->bRequest != USB_REQ_CYPRESS_EXT_RAM)
+    ok = false;
+  EP2BCL = 0;
+
+  if(arg_read) {
+    while(ok && arg_len > 0) {
+      uint16_t len = arg_len < packet_size ? arg_len : packet_size;
+
+      if(!bulk_wait_in())
+        return;
+      if(arg_eeprom) {
+        ok = eeprom_read(arg_chip, arg_addr, EP6FIFOBUF, len, arg_dbyte);
+      } else {
+        xmemcpy(EP6FIFOBUF, (__xdata void *)arg_addr, len);
+      }
+      if(ok)
+        bulk_commit_in(len);
+
+      arg_len  -= len;
+      arg_addr += len;
+    }
+
+    if(!ok) {
+      if(!bulk_wait_in())
+        return;
+      bulk_commit_in(0);
+    }
+  } else {
+    while(arg_len > 0) {
+      uint16_t len;
+
+      if(!bulk_wait_out())
+        return;
+      len = (EP2BCH << 8) | EP2BCL;
+      if(len > arg_len)
+        len = arg_len;
+      // Keep receiving the data after a failure, so that the host does not time out.
+      if(ok && arg_eeprom) {
+        ok = eeprom_write(arg_chip, arg_addr, EP2FIFOBUF, len, arg_dbyte, page_size,
+                          /*timeout=*/166);
+      } else if(ok) {
+        xmemcpy((__xdata void *)arg_addr, EP2FIFOBUF, len);
+      }
+      EP2BCL = 0;
+
+      arg_len  -= len;
+      arg_addr += len;
+    }
+  }
+
+  if(!bulk_wait_in())
+    return;
+  EP6FIFOBUF[0] = ok ? 0 : 1;
+  bulk_commit_in(1);
+}
+
 int main(void) {
   CPUCS = _CLKOE|_CLKSPD1;
 
+  // Use newest chip features.
+  REVCTL = _ENH_PKT|_DYN_OUT;
+
+  // NAK all transfers.
+  SYNCDELAY;
+  FIFORESET = _NAKALL;
+
+  // EP2 is configured as 512-byte double buffed BULK OUT.
+  EP2CFG  =  _VALID|_TYPE1|_BUF1;
+  EP2CS   = 0;
+  // EP6 is configured as 512-byte double buffed BULK IN.
+  EP6CFG  =  _VALID|_DIR|_TYPE1|_BUF1;
+  EP6CS   = 0;
+  // EP4/8 are not used.
+  EP4CFG &= ~_VALID;
+  EP8CFG &= ~_VALID;
+
+  // Reset and prime EP2, and reset EP6.
+  SYNCDELAY;
+  FIFORESET = _NAKALL|2;
+  SYNCDELAY;
+  OUTPKTEND = _SKIP|2;
+  SYNCDELAY;
+  OUTPKTEND = _SKIP|2;
+  SYNCDELAY;
+  FIFORESET = _NAKALL|6;
+  SYNCDELAY;
+  FIFORESET = 0;
+
   // Don't re-enumerate. `fx2tool -B` will load this firmware to access EEPROM, and it
   // expects to be able to keep accessing the device. If you are using this firmware
   // in your own code, set /*diconnect=*/true.
   usb_init(/*disconnect=*/false);
+  // Until usb_init() sets RENUM, the boot ROM answers the standard requests, including
+  // Set Configuration, on behalf of the default USB device, which has only configuration 1
+  // (see "Enumeration and ReNumeration" in the TRM). usb_init() forgets that selection, and
+  // the ROM does not expose it, so select the same configuration again; otherwise,
+  // the default Set Interface callback would stall the host selecting alternate setting 1,
+  // since the host (which has not seen the device re-enumerate) does not configure it again.
+  handle_usb_set_configuration(1);
 
   while(1) {
     if(pending_setup)
       handle_pending_usb_setup();
+    if(!(EP2CS & _EMPTY))
+      handle_bulk_command();
   }
 }
@@ -0,0 +1,125 @@
+#include <fx2lib.h>
+#include <fx2regs.h>
+#include <fx2eeprom.h>
+
+// This stage is loaded by the boot ROM from a C2 EEPROM image, and loads the actual firmware,
+// which is stored compressed in the EEPROM right after the C2 image. Since the boot ROM reads
+// the EEPROM at a fixed speed, the boot time is roughly proportional to the amount of data
+// read from it, and compressing the firmware makes it shorter.
+//
+// The compressed payload has the following format, where all words are big-endian:
+//  * the signature "LZ";
+//  * any number of segments, each consisting of a word with the length of the segment in
+//    the RAM, a word with the address of the segment in the RAM, and the compressed data;
+//  * a word with the high bit set, and a word with the address of the firmware entry point.
+//
+// The compressed data of each segment is a sequence of groups, each consisting of a flag byte
+// followed by up to 8 items, one for each bit of the flag byte, starting with the LSB.
+// If the bit is 0, the item is a literal byte. If the bit is 1, the item is a word where
+// the upper 4 bits are the length of a match minus 3, and the lower 12 bits are the distance
+// to its start (backwards from the current position) minus 1. Matches never extend outside
+// of the segment. The data ends as soon as the entire segment is written; the remaining bits
+// of the last flag byte are ignored.
+//
+// The EEPROM is always at address 0x51 with two address bytes, as required for a C2 load.
+
+#define EEPROM_CHIP 0x51
+
+__xdata uint8_t buffer[256];
+uint16_t buffer_addr;
+uint8_t  buffer_pos;
+
+static void halt(void) {
+  while(1);
+}
+
+// Read the EEPROM sequentially in large chunks, since every read involves a start condition,
+// two address bytes and a repeated start condition.
+static void seek(uint16_t addr) {
+  buffer_addr = addr;
+  buffer_pos  = 0;
+}
+
+static uint8_t next_byte(void) {
+  if(buffer_pos == 0) {
+    if(!eeprom_read(EEPROM_CHIP, buffer_addr, buffer, sizeof(buffer), /*double_byte=*/true))
+      halt();
+    buffer_addr += sizeof(buffer);
+  }
+  return buffer[buffer_pos++];
+}
+
+static uint16_t next_word(void) {
+  uint16_t value = next_byte() << 8;
+  return value | next_byte();
+}
+
+// Skip over the records of the C2 image (which include this stage) without reading
+// their data, and return the address right after the final record.
+static uint16_t find_payload(void) {
+  __xdata uint8_t *header = buffer;
+  uint16_t addr = 8;
+
+  while(1) {
+    uint16_t length;
+    if(!eeprom_read(EEPROM_CHIP, addr, header, 4, /*double_byte=*/true))
+      halt();
+    length = (header[0] << 8) | header[1];
+    if(length & 0x8000)
+      return addr + 5;
+    addr += 4 + length;
+  }
+}
+
+static void inflate(__xdata uint8_t *data, uint16_t length) {
+  uint8_t flags = 0, count = 0;
+
+  while(length > 0) {
+    if(count == 0) {
+      flags = next_byte();
+      count = 8;
+    }
+
+    if(flags & 1) {
+      uint16_t match = next_word();
+      uint8_t  match_length = (match >> 12) + 3;
+      __xdata uint8_t *source = data - (match & 0x0fff) - 1;
+
+      if(match_length > length)
+        halt();
+      length -= match_length;
+      while(match_length--)
+        *data++ = *source++;
+    } else {
+      *data++ = next_byte();
+      length--;
+    }
+
+    flags >>= 1;
+    count--;
+  }
+}
+
+int main(void) {
+  uint16_t length, addr;
+
+  // Run core at 48 MHz fCLK; the boot ROM leaves it at 12 MHz.
+  CPUCS = _CLKSPD1;
+
+  seek(find_payload());
+  if(next_byte() != 'L' || next_byte() != 'Z')
+    halt();
+
+  while(1) {
+    length = next_word();
+    addr   = next_word();
+    if(length & 0x8000)
+      break;
+    inflate((__xdata uint8_t *)addr, length);
+  }
+
+  // The firmware sets up the stack and everything else it uses on startup, so jumping
+  // to its entry point is as good as a reset.
+  ((void (*)(void))addr)();
+  return 0;
+}
@@ -90,13 +90,11 @@ usb_descriptor_set_c usb_descriptor_set = {
   .strings         = usb_strings,
 };
 
+// The fx2usbmassstor_direct and fx2uf2_direct libraries call the UF2 mass storage callbacks
+// directly, which saves passing the arguments on the stack for every packet.
 usb_mass_storage_bbb_state_t usb_mass_storage_state = {
   .interface    = 0,
   .max_in_size  = 512,
-
-  .command      = uf2_scsi_command,
-  .data_out     = uf2_scsi_data_out,
-  .data_in      = uf2_scsi_data_in,
 };
 
 static bool firmware_read(uint32_t address, __xdata uint8_t *data, uint16_t length) __reentrant {
@@ -143,24 +141,25 @@ uf2_configuration_c uf2_config = {
 
   .firmware_read  = firmware_read,
   .firmware_write = firmware_write,
+  // Only write the 8-byte pages that actually change, which makes reflashing a mostly
+  // unchanged image much faster.
+  .firmware_page_size = 8,
 };
 
+// Set when the host resets the mass storage interface. The packets prefetched for the command
+// that is being aborted are discarded in the main loop, since it may be filling one right now.
+volatile bool pending_bomsr;
+
 void handle_usb_setup(__xdata struct usb_req_setup *req) {
-  if(usb_mass_storage_bbb_setup(&usb_mass_storage_state, req))
+  if(usb_mass_storage_bbb_setup(&usb_mass_storage_state, req)) {
+    if(req->bRequest == USB_REQ_MASS_STORAGE_BOMSR)
+      pending_bomsr = true;
     return;
+  }
 
   STALL_EP0();
 }
 
-volatile bool pending_ep6_in;
-
-void isr_IBN(void) __interrupt {
-  pending_ep6_in = true;
-  CLEAR_USB_IRQ();
-  NAKIRQ = _IBN;
-  IBNIRQ = _IBNI_EP6;
-}
-
 int main(void) {
   // Run core at 48 MHz fCLK.
   CPUCS = _CLKSPD1;
@@ -182,10 +181,6 @@ int main(void) {
   EP4CFG &= ~_VALID;
   EP8CFG &= ~_VALID;
 
-  // Enable IN-BULK-NAK interrupt for EP6.
-  IBNIE = _IBNI_EP6;
-  NAKIE = _IBN;
-
   // Reset and prime EP2, and reset EP6.
   SYNCDELAY;
   FIFORESET = _NAKALL|2;
@@ -202,6 +197,15 @@ int main(void) {
   usb_init(/*disconnect=*/true);
 
   while(1) {
+    if(pending_bomsr) {
+      pending_bomsr = false;
+      FIFORESET = _NAKALL;
+      SYNCDELAY;
+      FIFORESET = _NAKALL|6;
+      SYNCDELAY;
+      FIFORESET = 0;
+    }
+
     if(!(EP2CS & _EMPTY)) {
       uint16_t length = (EP2BCH << 8) | EP2BCL;
       if(usb_mass_storage_bbb_bulk_out(&usb_mass_storage_state, EP2FIFOBUF, length)) {
@@ -212,10 +216,13 @@ int main(void) {
       }
     }
 
-    if(pending_ep6_in) {
+    // Rather than waiting for the host to NAK, fill the next EP6 buffer as soon as it is free,
+    // so that reading the next packet from EEPROM overlaps with the host draining the current one.
+    if(!(EP6CS & _FULL) && usb_mass_storage_bbb_bulk_in_ready(&usb_mass_storage_state)) {
       __xdata uint16_t length;
       if(usb_mass_storage_bbb_bulk_in(&usb_mass_storage_state, EP6FIFOBUF, &length)) {
-        if(length > 0) {
+        // Don't commit a packet of a command that was aborted while it was being filled.
+        if(length > 0 && !pending_bomsr) {
           EP6BCH = length >> 8;
           SYNCDELAY;
           EP6BCL = length;
@@ -223,8 +230,6 @@ int main(void) {
       } else {
         EP6CS  = _STALL;
       }
-
-      pending_ep6_in = false;
     }
   }
 }
@@ -0,0 +1,70 @@
+#include <fx2lib.h>
+#include <fx2blockdev.h>
+
+bool blockdev_cache_read(blockdev_cache_t *cache, uint32_t lba, __xdata uint8_t *data,
+                         uint16_t count) {
+  uint32_t addr = lba * BLOCKDEV_SECTOR_SIZE;
+
+  while(count--) {
+    if(cache->_valid && addr - cache->_block_addr < cache->block_size) {
+      xmemcpy(data, &cache->buffer[(uint16_t)(addr - cache->_block_addr)],
+              BLOCKDEV_SECTOR_SIZE);
+    } else {
+      if(!cache->read(addr, data, BLOCKDEV_SECTOR_SIZE))
+        return false;
+    }
+
+    addr += BLOCKDEV_SECTOR_SIZE;
+    data += BLOCKDEV_SECTOR_SIZE;
+  }
+
+  return true;
+}
+
+bool blockdev_cache_write(blockdev_cache_t *cache, uint32_t lba, __xdata const uint8_t *data,
+                          uint16_t count) {
+  uint32_t addr = lba * BLOCKDEV_SECTOR_SIZE;
+
+  while(count--) {
+    __xdata uint8_t *cached;
+    uint16_t index;
+
+    if(!cache->_valid || addr - cache->_block_addr >= cache->block_size) {
+      if(!blockdev_cache_flush(cache))
+        return false;
+
+      cache->_valid = false;
+      cache->_block_addr = addr & ~(uint32_t)(cache->block_size - 1);
+      if(!cache->read(cache->_block_addr, cache->buffer, cache->block_size))
+        return false;
+      cache->_valid = true;
+    }
+
+    // Only mark the block as dirty if the sector actually changes, so that rewriting
+    // identical data never erases the medium.
+    cached = &cache->buffer[(uint16_t)(addr - cache->_block_addr)];
+    for(index = 0; index < BLOCKDEV_SECTOR_SIZE; index++) {
+      if(cached[index] != data[index]) {
+        xmemcpy(cached, (__xdata void *)data, BLOCKDEV_SECTOR_SIZE);
+        cache->_dirty = true;
+        break;
+      }
+    }
+
+    addr += BLOCKDEV_SECTOR_SIZE;
+    data += BLOCKDEV_SECTOR_SIZE;
+  }
+
+  return true;
+}
+
+bool blockdev_cache_flush(blockdev_cache_t *cache) {
+  if(!cache->_dirty)
+    return true;
+
+  if(!cache->program(cache->_block_addr, cache->buffer, cache->block_size))
+    return false;
+
+  cache->_dirty = false;
+  return true;
+}
@@ -0,0 +1,6 @@
+#include <fx2usb.h>
+
+void handle_usb_configure_endpoints(uint8_t interface, uint8_t alt_setting) {
+  interface;
+  alt_setting;
+}
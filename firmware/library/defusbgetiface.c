@@ -1,7 +1,13 @@
 #include <fx2usb.h>
 
+extern usb_descriptor_set_c usb_descriptor_set;
+
 void handle_usb_get_interface(uint8_t interface) {
-  interface;
-  EP0BUF[0] = 0;
-  SETUP_EP0_IN_BUF(1);
+  if(interface < USB_MAX_INTERFACES &&
+     usb_find_interface(&usb_descriptor_set, interface, /*alt_setting=*/0xff)) {
+    EP0BUF[0] = usb_alt_settings[interface];
+    SETUP_EP0_IN_BUF(1);
+  } else {
+    STALL_EP0();
+  }
 }
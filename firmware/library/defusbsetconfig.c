@@ -3,9 +3,14 @@
 extern usb_descriptor_set_c usb_descriptor_set;
 
 bool handle_usb_set_configuration(uint8_t config_value) {
-  if(config_value == 0 || config_value == 1) {
+  uint8_t interface;
+
+  if(usb_find_configuration(&usb_descriptor_set, config_value)) {
     usb_config_value = config_value;
+    for(interface = 0; interface < USB_MAX_INTERFACES; interface++)
+      usb_alt_settings[interface] = 0;
 
+    handle_usb_configure_endpoints(/*interface=*/0xff, /*alt_setting=*/0xff);
     usb_reset_data_toggles(&usb_descriptor_set, /*inteface=*/0xff, /*alt_setting=*/0xff);
     return true;
   }
@@ -3,8 +3,11 @@
 extern usb_descriptor_set_c usb_descriptor_set;
 
 bool handle_usb_set_interface(uint8_t interface, uint8_t alt_setting) {
-  interface;
-  if(alt_setting == 0) {
+  if(interface < USB_MAX_INTERFACES &&
+     usb_find_interface(&usb_descriptor_set, interface, alt_setting)) {
+    usb_alt_settings[interface] = alt_setting;
+
+    handle_usb_configure_endpoints(interface, alt_setting);
     usb_reset_data_toggles(&usb_descriptor_set, interface, alt_setting);
     return true;
   }
@@ -7,7 +7,9 @@ VID       ?= 04B4
 PID       ?= 8613
 
 MODEL     ?= small
+CODE_LOC  ?= 0x0000
 CODE_SIZE ?= 0x3e00
+XRAM_LOC  ?= $(CODE_SIZE)
 XRAM_SIZE ?= 0x0200
 CFLAGS    ?=
 
@@ -19,8 +21,9 @@ export PYTHONPATH
 
 SDCCFLAGS  = \
 	--iram-size 0x100 \
+	--code-loc  $(CODE_LOC) \
 	--code-size $(CODE_SIZE) \
-	--xram-loc  $(CODE_SIZE) \
+	--xram-loc  $(XRAM_LOC) \
 	--xram-size $(XRAM_SIZE) \
 	--std-sdcc99 \
 	--model-$(MODEL) \
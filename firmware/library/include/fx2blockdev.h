@@ -0,0 +1,195 @@
+#ifndef FX2BLOCKDEV_H
+#define FX2BLOCKDEV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Size of a block device sector, in bytes. This matches the size of a high speed bulk packet.
+#define BLOCKDEV_SECTOR_SIZE 512
+
+/**
+ * A block device with ``BLOCKDEV_SECTOR_SIZE``-byte sectors.
+ */
+struct blockdev {
+  /// Total number of sectors.
+  uint32_t sector_count;
+
+  /// Sector read function. This function should read ``count`` sectors starting at ``lba``
+  /// into ``data``, and return ``true`` if the sectors could be read, and ``false`` otherwise.
+  bool (*read)(uint32_t lba, __xdata uint8_t *data, uint16_t count) __reentrant;
+
+  /// Sector write function. This function should write ``count`` sectors starting at ``lba``
+  /// from ``data``, and return ``true`` if the sectors could be written, and ``false`` otherwise.
+  /// The data may be cached until ``flush`` is called.
+  ///
+  /// If this callback is set to ``NULL``, the block device is read-only.
+  bool (*write)(uint32_t lba, __xdata const uint8_t *data, uint16_t count) __reentrant;
+
+  /// Flush function. This function should commit all cached sectors to the medium, and return
+  /// ``true`` if that succeeded, and ``false`` otherwise.
+  ///
+  /// If this callback is set to ``NULL``, the block device has no cache.
+  bool (*flush)(void) __reentrant;
+};
+
+typedef __xdata struct blockdev
+  blockdev_t;
+
+/**
+ * State of a write-back cache for a medium that can only be written a whole erase block at
+ * a time, e.g. SPI flash. The cache holds a single erase block, so that a sequence of sector
+ * writes within the same erase block results in only one erase and program cycle, and sector
+ * writes that do not change the contents of the medium result in none.
+ */
+struct blockdev_cache {
+  /// Size of the erase block, in bytes; a multiple of ``BLOCKDEV_SECTOR_SIZE``.
+  uint16_t block_size;
+
+  /// Buffer of ``block_size`` bytes holding the cached erase block.
+  __xdata uint8_t *buffer;
+
+  /// Medium read function. This function should read ``length`` bytes at byte address ``addr``
+  /// into ``data``, and return ``true`` if the data could be read, and ``false`` otherwise.
+  bool (*read)(uint32_t addr, __xdata uint8_t *data, uint16_t length) __reentrant;
+
+  /// Medium program function. This function should erase the erase block at byte address
+  /// ``addr`` and program it with ``length`` (always ``block_size``) bytes from ``data``,
+  /// and return ``true`` if that succeeded, and ``false`` otherwise.
+  bool (*program)(uint32_t addr, __xdata const uint8_t *data, uint16_t length) __reentrant;
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+  uint32_t _block_addr;
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  bool     _valid;
+  bool     _dirty;
+#else
+  uint8_t  _valid;
+  uint8_t  _dirty;
+#endif
+#endif
+};
+
+typedef __xdata struct blockdev_cache
+  blockdev_cache_t;
+
+/**
+ * Read ``count`` sectors starting at ``lba`` through the cache. Sectors in the cached erase block
+ * are returned from the cache; other sectors are read from the medium directly.
+ */
+bool blockdev_cache_read(blockdev_cache_t *cache, uint32_t lba, __xdata uint8_t *data,
+                         uint16_t count);
+
+/**
+ * Write ``count`` sectors starting at ``lba`` through the cache. If a sector is outside
+ * the cached erase block, the cache is flushed first, and the erase block containing the sector
+ * is read into the cache.
+ */
+bool blockdev_cache_write(blockdev_cache_t *cache, uint32_t lba, __xdata const uint8_t *data,
+                          uint16_t count);
+
+/**
+ * Program the cached erase block into the medium, if it has been changed.
+ */
+bool blockdev_cache_flush(blockdev_cache_t *cache);
+
+/**
+ * This macro defines a block device ``blockdev_t name_blockdev`` of ``sectors`` sectors backed
+ * by an I2C EEPROM with 2-byte addressing at bus address ``chip``, with ``2 ** page_size`` byte
+ * write pages and a polling ``timeout`` (see ``eeprom_write``). Since the EEPROM is addressed
+ * with 16 bits, at most 128 sectors can be used. The ``fx2eeprom.h`` header must be included.
+ */
+#define DEFINE_EEPROM_BLOCKDEV(name, sectors, chip, page_size, timeout)           \
+  static bool _##name##_blockdev_read(uint32_t lba, __xdata uint8_t *data,        \
+                                      uint16_t count) __reentrant {               \
+    return eeprom_read(chip, (uint16_t)lba * BLOCKDEV_SECTOR_SIZE, data,          \
+                       count * BLOCKDEV_SECTOR_SIZE, /*double_byte=*/true);       \
+  }                                                                               \
+  static bool _##name##_blockdev_write(uint32_t lba, __xdata const uint8_t *data, \
+                                       uint16_t count) __reentrant {              \
+    return eeprom_write(chip, (uint16_t)lba * BLOCKDEV_SECTOR_SIZE,               \
+                        (__xdata uint8_t *)data, count * BLOCKDEV_SECTOR_SIZE,    \
+                        /*double_byte=*/true, page_size, timeout);                \
+  }                                                                               \
+  blockdev_t name##_blockdev = {                                                  \
+    .sector_count = sectors,                                                      \
+    .read         = _##name##_blockdev_read,                                      \
+    .write        = _##name##_blockdev_write,                                     \
+  };
+
+/**
+ * This macro defines a block device ``blockdev_t name_blockdev`` of ``sectors`` sectors backed
+ * by a 25C-compatible SPI flash with 4 KiB erase sectors and 256-byte program pages, whose
+ * functions were defined with ``DEFINE_SPIFLASH_FNS(name, ...)``. Writes are cached in
+ * ``cache_buffer``, which must be at least 4096 bytes long, and are committed to the flash when
+ * another erase sector is written or when ``flush`` is called (e.g. by the SCSI layer when
+ * the host synchronizes the cache or ejects the medium). The ``fx2spiflash.h`` header must be included.
+ */
+#define DEFINE_SPIFLASH_BLOCKDEV(name, sectors, cache_buffer)                     \
+  static bool _##name##_blockdev_raw_read(uint32_t addr, __xdata uint8_t *data,   \
+                                          uint16_t length) __reentrant {          \
+    name##_read(addr, data, length);                                              \
+    return true;                                                                  \
+  }                                                                               \
+  static bool _##name##_blockdev_raw_program(uint32_t addr,                       \
+                                             __xdata const uint8_t *data,         \
+                                             uint16_t length) __reentrant {       \
+    uint16_t offset;                                                              \
+    name##_wren();                                                                \
+    name##_se(addr);                                                              \
+    while(name##_rdsr() & SPIFLASH_WIP);                                          \
+    for(offset = 0; offset < length; offset += 256) {                             \
+      name##_wren();                                                              \
+      name##_pp(addr + offset, data + offset, 256);                               \
+      while(name##_rdsr() & SPIFLASH_WIP);                                        \
+    }                                                                             \
+    return true;                                                                  \
+  }                                                                               \
+  blockdev_cache_t _##name##_blockdev_cache = {                                   \
+    .block_size   = 4096,                                                         \
+    .buffer       = (cache_buffer),                                               \
+    .read         = _##name##_blockdev_raw_read,                                  \
+    .program      = _##name##_blockdev_raw_program,                               \
+  };                                                                              \
+  static bool _##name##_blockdev_read(uint32_t lba, __xdata uint8_t *data,        \
+                                      uint16_t count) __reentrant {               \
+    return blockdev_cache_read(&_##name##_blockdev_cache, lba, data, count);      \
+  }                                                                               \
+  static bool _##name##_blockdev_write(uint32_t lba, __xdata const uint8_t *data, \
+                                       uint16_t count) __reentrant {              \
+    return blockdev_cache_write(&_##name##_blockdev_cache, lba, data, count);     \
+  }                                                                               \
+  static bool _##name##_blockdev_flush(void) __reentrant {                        \
+    return blockdev_cache_flush(&_##name##_blockdev_cache);                       \
+  }                                                                               \
+  blockdev_t name##_blockdev = {                                                  \
+    .sector_count = sectors,                                                      \
+    .read         = _##name##_blockdev_read,                                      \
+    .write        = _##name##_blockdev_write,                                     \
+    .flush        = _##name##_blockdev_flush,                                     \
+  };
+
+/**
+ * This macro defines a block device ``blockdev_t name_blockdev`` of ``sectors`` sectors backed
+ * by ``buffer`` in XRAM, which must be at least ``sectors * BLOCKDEV_SECTOR_SIZE`` bytes long.
+ */
+#define DEFINE_RAM_BLOCKDEV(name, sectors, buffer)                                \
+  static bool _##name##_blockdev_read(uint32_t lba, __xdata uint8_t *data,        \
+                                      uint16_t count) __reentrant {               \
+    xmemcpy(data, &(buffer)[(uint16_t)lba * BLOCKDEV_SECTOR_SIZE],                \
+            count * BLOCKDEV_SECTOR_SIZE);                                        \
+    return true;                                                                  \
+  }                                                                               \
+  static bool _##name##_blockdev_write(uint32_t lba, __xdata const uint8_t *data, \
+                                       uint16_t count) __reentrant {              \
+    xmemcpy(&(buffer)[(uint16_t)lba * BLOCKDEV_SECTOR_SIZE],                      \
+            (__xdata void *)data, count * BLOCKDEV_SECTOR_SIZE);                  \
+    return true;                                                                  \
+  }                                                                               \
+  blockdev_t name##_blockdev = {                                                  \
+    .sector_count = sectors,                                                      \
+    .read         = _##name##_blockdev_read,                                      \
+    .write        = _##name##_blockdev_write,                                     \
+  };
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef FX2SCSI_H
+#define FX2SCSI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <scsi.h>
+#include <fx2blockdev.h>
+
+/**
+ * State of a SCSI direct access block device, backed by a ``struct blockdev``.
+ *
+ * This implements the subset of SPC and SBC commands that Linux, Windows and macOS issue when
+ * probing and mounting a USB Mass Storage device, such that none of them fail and cause
+ * the host to retry after a REQUEST SENSE round trip. The functions ``scsi_command``,
+ * ``scsi_data_out`` and ``scsi_data_in`` are intended to be called from the corresponding
+ * callbacks of ``struct usb_mass_storage_bbb_state``, which must have ``max_in_size`` of
+ * ``BLOCKDEV_SECTOR_SIZE``.
+ *
+ * If the block device has a ``flush`` function, its write cache is reported in the Caching
+ * mode page, and it is flushed on SYNCHRONIZE CACHE, on START STOP UNIT (e.g. when the medium
+ * is ejected), and on PREVENT ALLOW MEDIUM REMOVAL that allows the removal.
+ */
+struct scsi_block_device_state {
+  /// T10 vendor identification (8 characters), product identification (16 characters),
+  /// and product revision level (4 characters) returned by INQUIRY, space padded.
+  __code const char *vendor_id;
+  /// See ``vendor_id``.
+  __code const char *product_id;
+  /// See ``vendor_id``.
+  __code const char *revision;
+
+  /// The block device that holds the data. Its sectors are used as SCSI logical blocks.
+  blockdev_t *device;
+
+  /// Whether the medium is reported as removable. Windows refuses to mount a non-removable
+  /// device with a filesystem that is not partitioned.
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  bool removable;
+#else
+  uint8_t removable;
+#endif
+
+  /// Whether the medium is reported as write protected; if so, WRITE commands are rejected.
+  /// A block device without a ``write`` function is always reported as write protected.
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  bool write_protected;
+#else
+  uint8_t write_protected;
+#endif
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+  uint8_t  _op_code;
+  uint8_t  _page_code;
+  uint8_t  _page_control;
+  uint8_t  _sense_key;
+  uint16_t _additional_sense;
+  uint32_t _block_index;
+  uint32_t _blocks_left;
+#endif
+};
+
+typedef __xdata struct scsi_block_device_state
+  scsi_block_device_state_t;
+
+/**
+ * Process a SCSI command. Returns ``true`` if the command is recognized and well-formed,
+ * or ``false`` otherwise, in which case the sense data is updated accordingly.
+ */
+bool scsi_command(scsi_block_device_state_t *state, __xdata uint8_t *command, uint8_t length);
+
+/**
+ * Process a chunk of data following a SCSI command that transfers data to the device.
+ * Returns ``true`` if the data was processed, or ``false`` otherwise, in which case the sense
+ * data is updated accordingly.
+ */
+bool scsi_data_out(scsi_block_device_state_t *state, __xdata const uint8_t *data,
+                   uint16_t length);
+
+/**
+ * Produce a chunk of data following a SCSI command that transfers data from the device.
+ * Returns ``true`` if the data was produced, or ``false`` otherwise, in which case the sense
+ * data is updated accordingly.
+ */
+bool scsi_data_in(scsi_block_device_state_t *state, __xdata uint8_t *data, uint16_t length);
+
+/**
+ * Sector read function of the ``fx2usbmassstor_direct`` library, defined by the application.
+ *
+ * When the SCSI functions are used from the ``fx2usbmassstor_direct`` library, the ``read``,
+ * ``write`` and ``flush`` fields of the block device (only ``sector_count`` is used) are
+ * replaced with the functions ``scsi_blockdev_read``, ``scsi_blockdev_write`` and
+ * ``scsi_blockdev_flush``, which are called directly and do not need to be reentrant.
+ * They have the same semantics as the corresponding fields of ``struct blockdev``, except that
+ * the medium is only reported as write protected if ``write_protected`` is set, and a write
+ * cache is always reported; ``scsi_blockdev_flush`` should return ``true`` if there is none.
+ */
+bool scsi_blockdev_read(uint32_t lba, __xdata uint8_t *data, uint16_t count);
+
+/// Sector write function of the ``fx2usbmassstor_direct`` library.
+/// See ``scsi_blockdev_read``.
+bool scsi_blockdev_write(uint32_t lba, __xdata const uint8_t *data, uint16_t count);
+
+/// Flush function of the ``fx2usbmassstor_direct`` library.
+/// See ``scsi_blockdev_read``.
+bool scsi_blockdev_flush(void);
+
+#endif
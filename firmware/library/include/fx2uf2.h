@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <fx2blockdev.h>
 
 /// Configuration of USB UF2 interface.
 struct uf2_configuration {
@@ -31,6 +32,15 @@ struct uf2_configuration {
   /// further verification of ``address`` and ``length`` against ``firmware_size``.
   /// It should return ``true`` if the firmware could be written, and ``false`` otherwise.
   bool (*firmware_write)(uint32_t address, __xdata uint8_t *data, uint16_t length) __reentrant;
+
+  /// Page size of the firmware storage, in bytes; a power of two between 8 and 256, or 0.
+  ///
+  /// If nonzero, each UF2 block is first compared with the contents of the storage (using
+  /// ``firmware_read``), and only the pages that differ are passed to ``firmware_write``,
+  /// with adjacent changed pages combined into a single call. This makes reflashing a mostly
+  /// unchanged image much faster, and avoids wearing out the storage. UF2 blocks that are not
+  /// aligned to the page size are written as is.
+  uint16_t firmware_page_size;
 };
 
 typedef __code const struct uf2_configuration
@@ -43,6 +53,8 @@ bool uf2_scsi_data_in (uint8_t lun, __xdata uint8_t *data, uint16_t length) __re
 
 bool uf2_fat_read (uint32_t lba, __xdata uint8_t *data);
 bool uf2_fat_write(uint32_t lba, __xdata const uint8_t *data);
+
+extern blockdev_t uf2_blockdev;
 #endif
 
 /**
@@ -9,6 +9,7 @@
 /**
  * Initialize the firmware USB stack. This performs the following:
  *
+ *   * resets `usb_config_value` and `usb_alt_settings`,
  *   * enables USB interrupts handled by the support code,
  *   * takes EP0 under software control,
  *   * disconnects (if requested) and connects (if necessary).
@@ -131,16 +132,23 @@ typedef __code const char *__code const
 
 /**
  * An USB configuration descriptor.
- * The USB configuration descriptor is followed by the interface, endpoint, and functional
- * descriptors; these are laid out in the way they should be returned in response to
- * the Get Configuration request.
+ * The USB configuration descriptor is followed by the interface association, interface, endpoint,
+ * and functional descriptors; these are laid out in the way they should be returned in response
+ * to the Get Configuration request.
+ *
+ * A composite device that groups several interfaces into a single function (e.g. the control
+ * and data interfaces of a CDC ACM function) should place an interface association descriptor
+ * before the first interface of the group, and use `USB_DEV_CLASS_MISCELLANEOUS`,
+ * `USB_DEV_SUBCLASS_COMMON` and `USB_DEV_PROTOCOL_INTERFACE_ASSOCIATION` in the device
+ * descriptor.
  */
 struct usb_configuration {
   struct usb_desc_configuration desc;
   union usb_config_item {
-    usb_desc_generic_c     *generic;
-    usb_desc_interface_c   *interface;
-    usb_desc_endpoint_c    *endpoint;
+    usb_desc_generic_c                *generic;
+    usb_desc_interface_association_c  *association;
+    usb_desc_interface_c              *interface;
+    usb_desc_endpoint_c               *endpoint;
   } items[];
 };
 
@@ -214,13 +222,44 @@ void handle_usb_get_descriptor(enum usb_descriptor type, uint8_t index);
  */
 extern uint8_t usb_config_value;
 
+/**
+ * The maximum number of interfaces for which the default Set Interface and Get Interface
+ * callbacks track the selected alternate setting.
+ */
+#define USB_MAX_INTERFACES 8
+
+/**
+ * Status variable indicating the alternate setting selected for each interface (indexed by
+ * `bInterfaceNumber`) of the selected configuration. It is reset by `usb_init`, and updated
+ * by the default Set Configuration and Set Interface callbacks.
+ */
+extern __xdata uint8_t usb_alt_settings[USB_MAX_INTERFACES];
+
+/**
+ * Helper function for validating the standard Set Configuration request. Returns `true` if
+ * `config_value` is 0, or if it corresponds to the `bConfigurationValue` field of one of
+ * the configurations in `set`, and `false` otherwise.
+ */
+bool usb_find_configuration(usb_descriptor_set_c *set, uint8_t config_value);
+
+/**
+ * Helper function for validating the standard Set Interface and Get Interface requests.
+ * Returns `true` if the configuration selected by `usb_config_value` includes an interface
+ * descriptor with fields `bInterfaceNumber == interface && bAlternateSetting == alt_setting`,
+ * and `false` otherwise. If `alt_setting == 0xff`, any alternate setting matches.
+ */
+bool usb_find_interface(usb_descriptor_set_c *set, uint8_t interface, uint8_t alt_setting);
+
 /**
  * Callback for the standard Set Configuration request.
- * This callback has a default implementation that sets `usb_config_value` to `config_value`
- * and returns `true` if `config_value` is 0 or 1, and returns `false` otherwise.
+ * This callback has a default implementation that, if `config_value` is 0 or the value of
+ * the `bConfigurationValue` field of one of the configurations in the global descriptor set
+ * (see `handle_usb_get_descriptor`), sets `usb_config_value` to `config_value`, resets
+ * `usb_alt_settings` to 0, calls `handle_usb_configure_endpoints(0xff, 0xff)`, and returns `true`;
+ * and returns `false` otherwise.
  *
  * The default implementation resets the data toggles using `usb_reset_data_toggles` and
- * the global descriptor set; see `handle_usb_get_descriptor`.
+ * the global descriptor set.
  */
 bool handle_usb_set_configuration(uint8_t config_value);
 
@@ -233,21 +272,36 @@ void handle_usb_get_configuration(void);
 
 /**
  * Callback for the standard Set Interface request.
- * This callback has a default implementation that returns `true` if `alt_setting == 0`,
- * and returns `false` otherwise.
+ * This callback has a default implementation that, if the selected configuration in the global
+ * descriptor set includes alternate setting `alt_setting` of interface `interface`, updates
+ * `usb_alt_settings`, calls `handle_usb_configure_endpoints(interface, alt_setting)`, and
+ * returns `true`; and returns `false` otherwise.
  *
  * The default implementation resets the data toggles using `usb_reset_data_toggles` and
- * the global descriptor set; see `handle_usb_get_descriptor`.
+ * the global descriptor set.
  */
 bool handle_usb_set_interface(uint8_t interface, uint8_t alt_setting);
 
 /**
  * Callback for the standard Get Interface request.
- * This callback has a default implementation that sets up an EP0 IN transfer
- * with alternate setting number `0`.
+ * This callback has a default implementation that sets up an EP0 IN transfer with the alternate
+ * setting number from `usb_alt_settings`, or stalls EP0 if the selected configuration does not
+ * include interface `interface`.
  */
 void handle_usb_get_interface(uint8_t interface);
 
+/**
+ * Callback for reallocating endpoint buffers, invoked by the default Set Configuration and
+ * Set Interface callbacks after the selection changes but before the data toggles are reset.
+ * It is called with `interface == 0xff && alt_setting == 0xff` after the configuration
+ * `usb_config_value` is selected (which may be 0, in which case the endpoints should be
+ * deconfigured), and with the interface number and alternate setting after an alternate
+ * setting is selected. Typically, it would update the `EPnCFG` registers and reset the FIFOs.
+ *
+ * This callback has a default implementation that does nothing.
+ */
+void handle_usb_configure_endpoints(uint8_t interface, uint8_t alt_setting);
+
 /**
  * Callback for the standard Clear Feature - Endpoint - Endpoint Halt request.
  * This callback has a default implementation that acknowledges the transfer
@@ -264,4 +318,45 @@ bool handle_usb_clear_endpoint_halt(uint8_t endpoint);
  */
 void handle_usb_setup(__xdata struct usb_req_setup *request);
 
+/**
+ * A handler for SETUP packets addressed to a single interface or endpoint.
+ * The handler should return `true` if it has processed the request (i.e. acknowledged it,
+ * stalled it, or set up a data stage), and `false` otherwise.
+ *
+ * Handlers are called from the SUDAV interrupt, and should be compiled with
+ * `#pragma nooverlay`.
+ */
+typedef bool (*usb_setup_handler_t)(__xdata struct usb_req_setup *request);
+
+typedef __code const usb_setup_handler_t
+  usb_setup_handler_c;
+
+/**
+ * A table of SETUP packet handlers for a composite device.
+ * The `interfaces` array is indexed by `bInterfaceNumber`, and the `endpoints` array is
+ * indexed by the endpoint number (without the direction bit). Either array may contain null
+ * entries for interfaces or endpoints that do not handle any requests.
+ */
+struct usb_setup_handler_set {
+  uint8_t              interface_count;
+  usb_setup_handler_c *interfaces;
+  uint8_t              endpoint_count;
+  usb_setup_handler_c *endpoints;
+};
+
+typedef __code const struct usb_setup_handler_set
+  usb_setup_handler_set_c;
+
+/**
+ * Helper function for dispatching non-standard SETUP packets in a composite device.
+ * This function looks up the handler for the interface or endpoint that is the recipient
+ * of the request in `set` and calls it, without examining the request any further.
+ * Returns the value returned by the handler, or `false` if the request is addressed
+ * to the device or if there is no handler for its recipient.
+ *
+ * A composite device would typically implement `handle_usb_setup` by calling this function,
+ * and stalling EP0 if it returns `false`.
+ */
+bool usb_route_setup(usb_setup_handler_set_c *set, __xdata struct usb_req_setup *request);
+
 #endif
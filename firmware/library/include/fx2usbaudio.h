@@ -0,0 +1,132 @@
+#ifndef FX2USBAUDIO_H
+#define FX2USBAUDIO_H
+
+#include <fx2usb.h>
+#include <usbaudio.h>
+
+/**
+ * State of an USB Audio Class function.
+ *
+ * The sample data is not handled by this library at all; it flows directly from the slave FIFO
+ * into the isochronous endpoint (see ``usb_audio_configure_fifo``), and the firmware is only
+ * involved in handling control requests and, optionally, computing the explicit feedback value.
+ */
+struct usb_audio_state {
+  /**
+   * The version of the USB Audio Class implemented by this function;
+   * ``USB_IFACE_PROTOCOL_AUDIO_1_0`` or ``USB_IFACE_PROTOCOL_AUDIO_2_0``.
+   */
+  uint8_t version;
+
+  /**
+   * For USB Audio Class 1.0, the address of the isochronous data endpoint whose sampling
+   * frequency control is handled by this library. For USB Audio Class 2.0, ignored.
+   */
+  uint8_t data_endpoint;
+
+  /**
+   * For USB Audio Class 2.0, the bInterfaceNumber field of the Audio Control interface, and
+   * the bClockID field of the clock source whose sampling frequency control is handled by
+   * this library. For USB Audio Class 1.0, ignored.
+   */
+  uint8_t control_interface;
+  /// See ``control_interface``.
+  uint8_t clock_id;
+
+  /**
+   * The address of the explicit feedback isochronous IN endpoint (one of ``0x82``, ``0x84``,
+   * ``0x86`` or ``0x88``), or ``0`` if there is none. This endpoint must be configured as
+   * an isochronous IN endpoint with ``_AUTOIN`` cleared. If the function uses implicit feedback,
+   * i.e. an isochronous IN data endpoint whose descriptor includes
+   * ``USB_USAGE_IMPLICIT_FEEDBACK_DATA``, no feedback endpoint is necessary, since the host
+   * derives the rate from the amount of data in each packet.
+   */
+  uint8_t feedback_endpoint;
+
+  /// The number of entries in ``sample_rates``.
+  uint8_t sample_rate_count;
+
+  /**
+   * The sampling frequencies, in Hz, supported by this function, in ascending order.
+   * These must match the frequencies listed in the format descriptors.
+   */
+  __code const uint32_t *sample_rates;
+
+  /**
+   * Sample rate change function. This function is called from ``usb_audio_setup_deferred``
+   * with one of the ``sample_rates`` when the host selects it, and should reconfigure
+   * the clock of the converters. It should return ``true`` if the sampling frequency was
+   * changed, and ``false`` otherwise.
+   *
+   * If this callback is set to ``NULL``, the sampling frequency is changed unconditionally.
+   */
+  bool (*set_sample_rate)(uint32_t rate) __reentrant;
+
+  /**
+   * The current sampling frequency, in Hz. Should be initialized to one of the ``sample_rates``.
+   */
+  volatile uint32_t sample_rate;
+
+  /**
+   * The most recent feedback value, in the format used on the bus: samples per frame in 10.14
+   * format at full speed, or samples per microframe in 16.16 format at high speed.
+   * Should be initialized to the nominal value, or to 0 if there is no feedback endpoint.
+   */
+  volatile uint32_t feedback;
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  volatile bool pending;
+#else
+  volatile uint8_t pending;
+#endif
+  uint16_t last_stamp;
+  uint16_t last_count;
+#endif
+};
+
+typedef __xdata struct usb_audio_state
+  usb_audio_state_t;
+
+/**
+ * Handle USB Audio Class SETUP packets addressed to the sampling frequency control.
+ * This function makes the appropriate changes to the state and returns ``true`` if a SETUP
+ * packet addressed this function, or returns ``false`` otherwise.
+ */
+bool usb_audio_setup(usb_audio_state_t *state, __xdata struct usb_req_setup *request);
+
+/**
+ * Handle USB Audio Class SETUP packets that call back into the application (i.e. changing
+ * the sampling frequency). This function should be called from the main loop; it never waits
+ * for the host.
+ */
+void usb_audio_setup_deferred(usb_audio_state_t *state);
+
+/**
+ * Update the explicit feedback value and queue it on the feedback endpoint, if it is not
+ * already full. This function should be called from the SOF interrupt handler (the SOF
+ * interrupt must be enabled with ``USBIE |= _SOF``).
+ *
+ * The ``sample_count`` argument is the current value of a free-running 16-bit counter
+ * incremented once per sample, e.g. by the word clock of the converters fed to the ``T0`` pin
+ * while timer 0 is in counter mode. The feedback value is updated every 64 frames at full
+ * speed, or every 64 microframes at high speed, using the USB frame number as the timestamp;
+ * if a SOF interrupt at the end of such a period is missed, the period is discarded.
+ */
+void usb_audio_sof(usb_audio_state_t *state, uint16_t sample_count);
+
+/**
+ * Configure endpoint ``endpoint`` (one of ``0x82``, ``0x84``, ``0x86`` or ``0x88``) as a double
+ * buffered isochronous IN endpoint committed automatically from the slave FIFO, with
+ * ``packet_size`` bytes per packet (at most 512 for EP4 and EP8, and at most 1024 for EP2 and
+ * EP6) and, at high speed, ``packets`` packets per microframe (1 to 3). The FIFO is reset and
+ * the interface clock must already be configured via ``IFCONFIG``. This function also enables
+ * the enhanced packet handling in ``REVCTL``.
+ *
+ * If ``word_wide`` is ``true``, the FIFO data bus is 16 bits wide.
+ */
+void usb_audio_configure_fifo(uint8_t endpoint, uint16_t packet_size, uint8_t packets,
+                              bool word_wide);
+
+#endif
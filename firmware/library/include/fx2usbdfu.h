@@ -4,7 +4,13 @@
 #include <fx2usb.h>
 #include <usbdfu.h>
 
-/// State of an USB Device Firmware Upgrade interface.
+/**
+ * State of an USB Device Firmware Upgrade interface.
+ *
+ * Blocks are transferred in as many EP0 packets as necessary, so the ``wTransferSize`` field
+ * in the DFU functional descriptor may be up to 512 bytes. Larger blocks require fewer DFU
+ * requests per image, and are transferred significantly faster.
+ */
 struct usb_dfu_iface_state {
   /**
    * The bInterfaceNumber field corresponding to this interface in runtime mode.
@@ -43,6 +49,12 @@ struct usb_dfu_iface_state {
    * This function should return ``USB_DFU_STATUS_OK`` if the firmware could be written
    * (or, in case of ``length == 0``, if the complete firmware was downloaded), and one
    * of the other ``enum usb_dfu_status`` values otherwise.
+   *
+   * This function is called from ``usb_dfu_setup_deferred`` after the block was received.
+   * While it runs, the interface is in the ``dfuDNBUSY`` state, and the time it took for
+   * the previous block is reported to the host in the ``bwPollTimeout`` field, so that the host
+   * does not poll the device much more often than it can write blocks. If ``dnload_buffer`` is
+   * set, the next block is received while this function runs.
    */
   usb_dfu_status_t (*firmware_dnload)(uint32_t offset, __xdata uint8_t *data,
                                       uint16_t length) __reentrant;
@@ -59,6 +71,18 @@ struct usb_dfu_iface_state {
    */
   usb_dfu_status_t (*firmware_manifest)(void) __reentrant;
 
+  /**
+   * Second block buffer of 512 bytes, or ``NULL``.
+   *
+   * If this field is set, the interface reports ``dfuDNLOAD-IDLE`` as soon as a block is
+   * received, and the host sends the next block into one buffer while the previous one is being
+   * written from the other one, so that the time it takes to transfer a block is hidden behind
+   * the time it takes to write it. In this case, the application must call ``usb_dfu_ep0out``
+   * from ``isr_EP0OUT``, and enable that interrupt with ``EPIE |= _EPI_EP0OUT``. Without
+   * the second buffer, the host only sends the next block after the previous one is written.
+   */
+  __xdata uint8_t *dnload_buffer;
+
   /// State of the DFU interface, as per DFU specification.
   volatile enum usb_dfu_state state;
 
@@ -66,11 +90,17 @@ struct usb_dfu_iface_state {
   // Private fields, subject to change at any time.
   volatile enum usb_dfu_status status;
 #if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
-  volatile bool pending, sync;
+  volatile bool pending, sync, stashed, busy;
 #else
-  volatile uint8_t pending, sync;
+  volatile uint8_t pending, sync, stashed, busy;
 #endif
+  __xdata uint8_t *receive_buffer;
+  __xdata uint8_t *busy_buffer;
   uint16_t length;
+  uint16_t requested;
+  uint16_t transferred;
+  uint16_t busy_length;
+  uint16_t poll_timeout;
   uint32_t offset;
 #endif
 };
@@ -87,10 +117,18 @@ bool usb_dfu_setup(usb_dfu_iface_state_t *state, __xdata struct usb_req_setup *r
 
 /**
  * Handle USB Device Firmware Update interface SETUP packets that perform lengthy operations
- * (i.e. actual firmware upload/download).
+ * (i.e. actual firmware upload/download). This function should be called from the main loop;
+ * it never waits for the host, so the rest of the main loop keeps running during a DFU session.
  */
 void usb_dfu_setup_deferred(usb_dfu_iface_state_t *state);
 
+/**
+ * Receive USB Device Firmware Update DNLOAD packets while the previous block is being written.
+ * This function should be called from ``isr_EP0OUT`` if ``dnload_buffer`` is set, and ignores
+ * any packets that are not a part of a DNLOAD request.
+ */
+void usb_dfu_ep0out(usb_dfu_iface_state_t *state);
+
 /**
  * The global DFU configuration, defined in the application code.
  * It only makes sense for a single device to expose a single DFU interface at a time.
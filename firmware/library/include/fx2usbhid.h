@@ -0,0 +1,110 @@
+#ifndef FX2USBHID_H
+#define FX2USBHID_H
+
+#include <fx2usb.h>
+#include <usbhid.h>
+
+/**
+ * State of an USB Human Interface Device interface.
+ *
+ * For the lowest input latency on a high speed bus, the interrupt IN endpoint should be declared
+ * with ``bInterval = 1``, in which case it is polled by the host every microframe (125 µs);
+ * a report committed with ``usb_hid_in_commit`` is then received by the host at most one
+ * microframe later. On a full speed bus, the same descriptor results in polling every frame (1 ms).
+ */
+struct usb_hid_iface_state {
+  /// The bInterfaceNumber field corresponding to this interface.
+  uint8_t interface;
+
+  /// The HID descriptor of this interface. It should also be included in the configuration
+  /// descriptor, following the interface descriptor.
+  usb_hid_desc_c *hid_descriptor;
+
+  /// The report descriptor of this interface. Its length is specified by the
+  /// ``wReportDescriptorLength`` field of ``hid_descriptor``, and may be at most 512 bytes.
+  __code const uint8_t *report_descriptor;
+
+  /// The address of the interrupt IN endpoint of this interface; one of ``0x81``
+  /// (EP1 IN), ``0x82``, ``0x84``, ``0x86`` or ``0x88``.
+  uint8_t in_endpoint;
+
+  /// The address of the interrupt OUT endpoint of this interface; one of ``0x01`` (EP1 OUT),
+  /// ``0x02``, ``0x04``, ``0x06``, ``0x08``, or ``0`` if there is no interrupt OUT endpoint.
+  uint8_t out_endpoint;
+
+  /// The Get Report callback. This function is called for each GET_REPORT request. It should
+  /// fill at most ``*length`` (and no more than 64) bytes of the report of type ``type`` with
+  /// ID ``id`` into the ``data`` buffer, update ``*length``, and return ``true``; or return
+  /// ``false`` if there is no such report.
+  bool (*get_report)(uint8_t type, uint8_t id, __xdata uint8_t *data,
+                     __xdata uint16_t *length) __reentrant;
+
+  /// The Set Report callback. This function is called for each SET_REPORT request, as well as for
+  /// each packet received on the interrupt OUT endpoint (with ``type`` set to
+  /// ``USB_HID_REPORT_OUTPUT`` and ``id`` set to 0). It should return ``true`` if the report
+  /// is accepted, and ``false`` otherwise. If this callback is set to ``NULL``, all reports
+  /// are rejected.
+  bool (*set_report)(uint8_t type, uint8_t id, __xdata const uint8_t *data,
+                     uint16_t length) __reentrant;
+
+  /// The idle rate, in units of 4 ms, as last set by the host via SET_IDLE. A value of 0 means
+  /// that an input report should only be sent when it changes.
+  volatile uint8_t idle_rate;
+
+  /// The protocol, ``USB_HID_PROTOCOL_BOOT`` or ``USB_HID_PROTOCOL_REPORT``, as last set by
+  /// the host via SET_PROTOCOL. Should be initialized to ``USB_HID_PROTOCOL_REPORT``.
+  volatile uint8_t protocol;
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  volatile bool pending;
+#else
+  volatile uint8_t pending;
+#endif
+  uint8_t  request;
+  uint8_t  type;
+  uint8_t  id;
+  uint16_t length;
+#endif
+};
+
+typedef __xdata struct usb_hid_iface_state
+  usb_hid_iface_state_t;
+
+/**
+ * Handle USB Human Interface Device interface SETUP packets, including requests for the HID
+ * and report descriptors. This function makes the appropriate changes to the state and returns
+ * ``true`` if a SETUP packet addressed this interface, or returns ``false`` otherwise.
+ */
+bool usb_hid_setup(usb_hid_iface_state_t *state, __xdata struct usb_req_setup *request);
+
+/**
+ * Handle USB Human Interface Device interface SETUP packets that call back into the application
+ * (i.e. GET_REPORT and SET_REPORT). This function should be called from the main loop;
+ * it never waits for the host.
+ */
+void usb_hid_setup_deferred(usb_hid_iface_state_t *state);
+
+/**
+ * Return a pointer to the buffer of the interrupt IN endpoint where the next input report
+ * should be placed, or ``0`` if every buffer of the endpoint is still waiting for the host.
+ * The report is written directly into the endpoint buffer, and is sent once committed with
+ * ``usb_hid_in_commit``.
+ */
+__xdata uint8_t *usb_hid_in_buffer(usb_hid_iface_state_t *state);
+
+/**
+ * Commit an input report of ``length`` bytes placed into the buffer returned by
+ * ``usb_hid_in_buffer``.
+ */
+void usb_hid_in_commit(usb_hid_iface_state_t *state, uint16_t length);
+
+/**
+ * Process a packet received on the interrupt OUT endpoint, if any, by passing it to
+ * the Set Report callback and rearming the endpoint. This function should be called from
+ * the main loop. It returns ``false`` if the report was rejected, and ``true`` otherwise.
+ */
+bool usb_hid_out_deferred(usb_hid_iface_state_t *state);
+
+#endif
@@ -86,7 +86,9 @@ bool usb_mass_storage_bbb_bulk_out(usb_mass_storage_bbb_state_t *state,
 /**
  * Emit USB Mass Storage Bulk-Only Transport interface BULK IN packets.
  *
- * This function should be called each time an IN BULK NAK interrupt occurs.
+ * This function should be called each time an IN BULK NAK interrupt occurs, or, to prefetch
+ * data, each time the BULK IN endpoint has a free buffer and
+ * ``usb_mass_storage_bbb_bulk_in_ready`` returns ``true``.
  *
  * It returns a result flag. If the result is ``true``, a packet should be committed if
  * ``length`` is nonzero. If the result is ``false``, the BULK IN endpoint should be stalled.
@@ -94,4 +96,43 @@ bool usb_mass_storage_bbb_bulk_out(usb_mass_storage_bbb_state_t *state,
 bool usb_mass_storage_bbb_bulk_in(usb_mass_storage_bbb_state_t *state,
                                   __xdata uint8_t *data, __xdata uint16_t *length);
 
+/**
+ * Check whether USB Mass Storage Bulk-Only Transport interface has BULK IN packets to emit,
+ * i.e. whether the next call to ``usb_mass_storage_bbb_bulk_in`` would produce a data packet
+ * or a CSW.
+ *
+ * This makes it possible to produce the next packet into one buffer of a double buffered
+ * BULK IN endpoint while the host is still reading the previous packet from the other buffer,
+ * instead of waiting for the host to NAK, so that the Data-In callback runs concurrently
+ * with the USB transfer. In this case, the application must discard the prefetched packets
+ * (e.g. by resetting the FIFO) when it receives a Bulk-Only Mass Storage Reset request.
+ */
+bool usb_mass_storage_bbb_bulk_in_ready(usb_mass_storage_bbb_state_t *state);
+
+/**
+ * Command callback of the ``fx2usbmassstor_direct`` library.
+ *
+ * The ``fx2usbmassstor_direct`` library is built from the same sources as ``fx2usbmassstor``,
+ * but instead of the ``command``, ``data_out`` and ``data_in`` fields of
+ * ``struct usb_mass_storage_bbb_state``, which are ignored, it calls the functions
+ * ``usb_mass_storage_bbb_command``, ``usb_mass_storage_bbb_data_out`` and
+ * ``usb_mass_storage_bbb_data_in`` defined by the application. These are called directly
+ * and do not need to be reentrant, which avoids passing the arguments on the stack and
+ * the indirect call for every packet. Likewise, SCSI block devices are accessed through
+ * the ``scsi_blockdev_*`` functions; see ``fx2scsi.h``.
+ *
+ * Only a single mass storage interface can be implemented with this library, unless
+ * the callbacks dispatch on the state themselves. The callbacks have the same semantics as
+ * the corresponding fields of ``struct usb_mass_storage_bbb_state``.
+ */
+bool usb_mass_storage_bbb_command(uint8_t lun, __xdata uint8_t *command, uint8_t length);
+
+/// Data-Out callback of the ``fx2usbmassstor_direct`` library.
+/// See ``usb_mass_storage_bbb_command``.
+bool usb_mass_storage_bbb_data_out(uint8_t lun, __xdata const uint8_t *data, uint16_t length);
+
+/// Data-In callback of the ``fx2usbmassstor_direct`` library.
+/// See ``usb_mass_storage_bbb_command``.
+bool usb_mass_storage_bbb_data_in(uint8_t lun, __xdata uint8_t *data, uint16_t length);
+
 #endif
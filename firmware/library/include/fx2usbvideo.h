@@ -0,0 +1,129 @@
+#ifndef FX2USBVIDEO_H
+#define FX2USBVIDEO_H
+
+#include <fx2usb.h>
+#include <usbvideo.h>
+
+/// Length of the payload header inserted by this library at the beginning of each packet.
+#define USB_VIDEO_PAYLOAD_HEADER_LENGTH 2
+
+/**
+ * State of an USB Video Class streaming interface.
+ *
+ * The frame data is not handled by this library; it flows directly from GPIF or the slave FIFO
+ * into the streaming endpoint, and the firmware only inserts the payload header into each
+ * packet and commits it. For this to work, the external logic (or the GPIF waveform) must leave
+ * the first ``USB_VIDEO_PAYLOAD_HEADER_LENGTH`` bytes of every packet unused, i.e. write these
+ * many padding bytes before the pixel data of every packet.
+ */
+struct usb_video_state {
+  /// The bInterfaceNumber field corresponding to the Video Streaming interface.
+  uint8_t interface;
+
+  /// The address of the streaming endpoint; one of ``0x82``, ``0x84``, ``0x86`` or ``0x88``.
+  uint8_t endpoint;
+
+  /**
+   * The default video probe and commit controls, returned for the GET_DEF, GET_MIN and GET_MAX
+   * requests, and used to reset the current probe control if negotiation fails.
+   */
+  usb_video_probe_commit_c *defaults;
+
+  /**
+   * Negotiation function. This function is called from ``usb_video_setup_deferred`` whenever
+   * the host sets the probe control, and may change any fields of ``probe`` to values supported
+   * by the device, in particular ``dwMaxVideoFrameSize`` and ``dwMaxPayloadTransferSize``.
+   * It should return ``true`` if the requested format and frame are supported,
+   * and ``false`` otherwise.
+   *
+   * If this callback is set to ``NULL``, any probe control is accepted as is.
+   */
+  bool (*negotiate)(__xdata struct usb_video_probe_commit *probe) __reentrant;
+
+  /**
+   * Commit function. This function is called from ``usb_video_setup_deferred`` whenever
+   * the host sets the commit control, and should configure the sensor for the committed
+   * format and frame. For bulk streaming, the stream starts immediately after this function
+   * returns.
+   *
+   * If this callback is set to ``NULL``, it is ignored.
+   */
+  void (*commit)(__xdata struct usb_video_probe_commit *commit) __reentrant;
+
+  /// The current value of the probe control.
+  struct usb_video_probe_commit probe;
+
+  /// The current value of the commit control.
+  struct usb_video_probe_commit committed;
+
+  /**
+   * Whether the stream is running. This field is set after the commit control is set, and
+   * should be cleared (e.g. from ``handle_usb_set_interface``) when the host selects
+   * the zero-bandwidth alternate setting or the stream should stop for another reason.
+   * While this field is cleared, packets are discarded.
+   */
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  volatile bool streaming;
+#else
+  volatile uint8_t streaming;
+#endif
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+  volatile bool pending;
+#else
+  volatile uint8_t pending;
+#endif
+  uint8_t selector;
+  uint8_t header_info;
+#endif
+};
+
+typedef __xdata struct usb_video_state
+  usb_video_state_t;
+
+/**
+ * Handle USB Video Class SETUP packets addressed to the probe and commit controls.
+ * This function makes the appropriate changes to the state and returns ``true`` if a SETUP
+ * packet addressed this interface, or returns ``false`` otherwise.
+ */
+bool usb_video_setup(usb_video_state_t *state, __xdata struct usb_req_setup *request);
+
+/**
+ * Handle USB Video Class SETUP packets that call back into the application (i.e. setting
+ * the probe and commit controls). This function should be called from the main loop;
+ * it never waits for the host.
+ */
+void usb_video_setup_deferred(usb_video_state_t *state);
+
+/**
+ * Insert the payload header into the packet of ``length`` bytes (including the header) that
+ * has been placed into the streaming endpoint buffer by GPIF or the slave FIFO, and commit it.
+ * If ``end_of_frame`` is ``true``, the EOF bit is set in the header and the frame ID is toggled
+ * for the next packet. If the stream is not running, the packet is discarded.
+ *
+ * This function is intended to be called from the FIFO flag interrupt handler of the streaming
+ * endpoint, e.g. ``isr_EP6FF`` for full packets, and from the interrupt handler signalling
+ * the end of a frame (e.g. an external interrupt driven by VSYNC) for the final short packet
+ * of a frame. The endpoint is in manual IN mode, so every packet, including the final short
+ * one, is committed by this function; ``length`` is the number of bytes the external logic
+ * has written into the buffer, including the space reserved for the header.
+ */
+void usb_video_packet(usb_video_state_t *state, uint16_t length, bool end_of_frame);
+
+/**
+ * Configure endpoint ``endpoint`` (one of ``0x82``, ``0x84``, ``0x86`` or ``0x88``) as a double
+ * buffered bulk or (if ``isochronous`` is ``true``) isochronous IN endpoint filled from
+ * GPIF or the slave FIFO, with ``packet_size`` bytes per packet (at most 512 for EP4 and EP8,
+ * and at most 1024 for EP2 and EP6). Packets are not committed automatically, so that
+ * ``usb_video_packet`` can insert the payload header. The FIFO is reset and the interface clock
+ * must already be configured via ``IFCONFIG``. This function also enables the enhanced packet
+ * handling in ``REVCTL``.
+ *
+ * If ``word_wide`` is ``true``, the FIFO data bus is 16 bits wide.
+ */
+void usb_video_configure_fifo(uint8_t endpoint, uint16_t packet_size, bool isochronous,
+                              bool word_wide);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef FX2VFAT_H
+#define FX2VFAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <fx2blockdev.h>
+
+/// Maximum number of files on a virtual FAT volume; the root directory occupies one sector,
+/// and one of its entries is the volume label.
+#define VFAT_MAX_FILES 15
+
+/**
+ * A file on a virtual FAT volume.
+ *
+ * The contents of the file are never stored anywhere; each sector is produced on demand
+ * by the ``read`` function when the host reads it.
+ */
+struct vfat_file {
+  /// Name and extension of the file in the 8.3 format, space padded and without the dot,
+  /// e.g. ``"CAPTURE BIN"``. Must be exactly 11 characters long and consist of uppercase
+  /// letters, digits and spaces.
+  __code const char *filename_ext;
+
+  /// Size of the file, in bytes. The clusters of the file are allocated by ``vfat_init``
+  /// according to this size; afterwards, it may be decreased (e.g. to report the amount of
+  /// data actually captured) or increased back up to the allocated size, but not beyond it.
+  /// Most hosts cache the directory until the medium is remounted.
+  uint32_t size;
+
+  /// File read function. This function should read ``length`` (at most
+  /// ``BLOCKDEV_SECTOR_SIZE``) bytes at ``offset`` into ``data``, and return ``true``
+  /// if the data could be read, and ``false`` otherwise. It is only called for the bytes
+  /// between ``0`` and ``size``.
+  bool (*read)(uint32_t offset, __xdata uint8_t *data, uint16_t length) __reentrant;
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+  uint16_t _first_cluster;
+  uint16_t _last_cluster;
+#endif
+};
+
+typedef __xdata struct vfat_file
+  vfat_file_t;
+
+/**
+ * State of a read-only virtual FAT16 volume.
+ *
+ * The boot sector, the file allocation table and the root directory are generated on the fly
+ * from the list of files. Each file is allocated a contiguous range of clusters, so any sector
+ * of the file allocation table is computed in time proportional only to the number of files,
+ * and any data sector is mapped to a file offset without walking a cluster chain.
+ */
+struct vfat_volume {
+  /// Total number of sectors on the volume. For the hosts to recognize the volume as FAT16,
+  /// it must have between 4085 and 65524 clusters.
+  uint32_t total_sectors;
+
+  /// Number of sectors per cluster; a power of two between 1 and 64. With one sector per
+  /// cluster, the volume can be at most 32 MiB in size.
+  uint8_t sectors_per_cluster;
+
+  /// Volume label, space padded; must be exactly 11 characters long.
+  __code const char *volume_label;
+
+  /// Number of files; at most ``VFAT_MAX_FILES``.
+  uint8_t file_count;
+
+  /// The files on the volume, in directory order.
+  vfat_file_t *files;
+
+#ifndef DOXYGEN
+  // Private fields, subject to change at any time.
+  uint16_t _fat_sectors;
+  uint16_t _root_offset;
+  uint16_t _data_offset;
+  uint8_t  _cluster_shift;
+#endif
+};
+
+typedef __xdata struct vfat_volume
+  vfat_volume_t;
+
+/**
+ * Lay out the files on the volume. Returns ``true`` if the volume parameters are valid
+ * and all files fit, and ``false`` otherwise.
+ *
+ * This function must be called before the volume is accessed, and again if ``files``,
+ * ``file_count``, or the size of any file beyond its allocated size changes, in which case
+ * the medium must be ejected and reinserted (e.g. by resetting the USB Mass Storage interface)
+ * for the host to notice the change.
+ */
+bool vfat_init(vfat_volume_t *volume);
+
+/**
+ * Read ``count`` sectors starting at ``lba`` from the volume into ``data``.
+ * Returns ``true`` if the sectors could be read, and ``false`` otherwise.
+ */
+bool vfat_read(vfat_volume_t *volume, uint32_t lba, __xdata uint8_t *data, uint16_t count);
+
+/**
+ * This macro defines a read-only block device ``blockdev_t name_blockdev`` backed by
+ * the virtual FAT volume ``volume`` (a ``vfat_volume_t`` variable), and a routine
+ * ``bool name_vfat_init(void)`` that must be called instead of ``vfat_init`` to lay out
+ * the volume and set ``sector_count`` of the block device.
+ *
+ * For example, invoking the macro as ``DEFINE_VFAT_BLOCKDEV(capture, capture_volume)``
+ * defines ``capture_blockdev``, which can be used as the ``device`` of
+ * a ``scsi_block_device_state``, and ``capture_vfat_init()``.
+ */
+#define DEFINE_VFAT_BLOCKDEV(name, volume)                                        \
+  static bool _##name##_blockdev_read(uint32_t lba, __xdata uint8_t *data,        \
+                                      uint16_t count) __reentrant {               \
+    return vfat_read(&(volume), lba, data, count);                                \
+  }                                                                               \
+  blockdev_t name##_blockdev = {                                                  \
+    .read         = _##name##_blockdev_read,                                      \
+  };                                                                              \
+  bool name##_vfat_init(void) {                                                   \
+    name##_blockdev.sector_count = (volume).total_sectors;                        \
+    return vfat_init(&(volume));                                                  \
+  }
+
+#endif
@@ -86,6 +86,157 @@ struct scsi_read_capacity_data {
   uint32_t block_length_in_bytes;
 };
 
+// Command READ CAPACITY (16)
+
+struct scsi_read_capacity_16 {
+  uint8_t  service_action:5;
+  uint8_t  __reserved0:3;
+  uint8_t  __obsolete1[8];
+  uint32_t allocation_length;
+  uint8_t  __reserved2;
+  uint8_t  control;
+};
+
+struct scsi_read_capacity_16_data {
+  uint32_t returned_logical_block_address_hi;
+  uint32_t returned_logical_block_address;
+  uint32_t logical_block_length_in_bytes;
+  uint8_t  __reserved0[20];
+};
+
+// Command READ FORMAT CAPACITIES
+
+struct scsi_read_format_capacities {
+  uint8_t  __reserved0[6];
+  uint16_t allocation_length;
+  uint8_t  control;
+};
+
+struct scsi_read_format_capacities_data {
+  uint8_t  __reserved0[3];
+  uint8_t  capacity_list_length;
+  uint32_t number_of_blocks;
+  uint8_t  descriptor_code;
+  uint8_t  block_length_hi;
+  uint16_t block_length;
+};
+
+// Command MODE SENSE (6)
+
+struct scsi_mode_sense_6 {
+  uint8_t  __reserved0:3;
+  uint8_t  dbd:1;
+  uint8_t  __reserved1:4;
+  uint8_t  page_code:6;
+  uint8_t  pc:2;
+  uint8_t  subpage_code;
+  uint8_t  allocation_length;
+  uint8_t  control;
+};
+
+struct scsi_mode_parameter_header_6 {
+  uint8_t  mode_data_length;
+  uint8_t  medium_type;
+  uint8_t  device_specific_parameter;
+  uint8_t  block_descriptor_length;
+};
+
+// Command MODE SENSE (10)
+
+struct scsi_mode_sense_10 {
+  uint8_t  __reserved0:3;
+  uint8_t  dbd:1;
+  uint8_t  llbaa:1;
+  uint8_t  __reserved1:3;
+  uint8_t  page_code:6;
+  uint8_t  pc:2;
+  uint8_t  subpage_code;
+  uint8_t  __reserved2[3];
+  uint16_t allocation_length;
+  uint8_t  control;
+};
+
+struct scsi_mode_parameter_header_10 {
+  uint16_t mode_data_length;
+  uint8_t  medium_type;
+  uint8_t  device_specific_parameter;
+  uint8_t  __reserved0[2];
+  uint16_t block_descriptor_length;
+};
+
+enum {
+  /// Write Protect bit of the device-specific parameter in a mode parameter header.
+  SCSI_MODE_PARAMETER_WP = 0x80,
+};
+
+enum {
+  SCSI_MODE_PAGE_CONTROL_CURRENT    = 0,
+  SCSI_MODE_PAGE_CONTROL_CHANGEABLE = 1,
+  SCSI_MODE_PAGE_CONTROL_DEFAULT    = 2,
+  SCSI_MODE_PAGE_CONTROL_SAVED      = 3,
+};
+
+enum {
+  SCSI_MODE_PAGE_CACHING = 0x08,
+  SCSI_MODE_PAGE_ALL     = 0x3F,
+};
+
+// Mode page Caching
+
+struct scsi_caching_mode_page {
+  uint8_t  page_code:6;
+  uint8_t  spf:1;
+  uint8_t  ps:1;
+  uint8_t  page_length;
+  uint8_t  rcd:1;
+  uint8_t  mf:1;
+  uint8_t  wce:1;
+  uint8_t  size:1;
+  uint8_t  disc:1;
+  uint8_t  cap:1;
+  uint8_t  abpf:1;
+  uint8_t  ic:1;
+  uint8_t  __other[17];
+};
+
+// Command START STOP UNIT
+
+struct scsi_start_stop_unit {
+  uint8_t  immed:1;
+  uint8_t  __reserved0:7;
+  uint8_t  __reserved1;
+  uint8_t  power_condition_modifier:4;
+  uint8_t  __reserved2:4;
+  uint8_t  start:1;
+  uint8_t  loej:1;
+  uint8_t  no_flush:1;
+  uint8_t  __reserved3:1;
+  uint8_t  power_condition:4;
+  uint8_t  control;
+};
+
+// Command SYNCHRONIZE CACHE (10)
+
+struct scsi_synchronize_cache_10 {
+  uint8_t  __reserved0;
+  uint32_t logical_block_address;
+  uint8_t  __reserved1;
+  uint16_t number_of_blocks;
+  uint8_t  control;
+};
+
+// Command VERIFY (10)
+
+struct scsi_verify_10 {
+  uint8_t  __reserved0:1;
+  uint8_t  bytchk:1;
+  uint8_t  __reserved1:6;
+  uint32_t logical_block_address;
+  uint8_t  __reserved2;
+  uint16_t verification_length;
+  uint8_t  control;
+};
+
 // Command READ (10)
 
 struct scsi_read_10 {
@@ -115,11 +266,24 @@ enum scsi_operation_code {
   SCSI_OPERATION_REQUEST_SENSE    = 0x03,
   SCSI_OPERATION_INQUIRY          = 0x12,
   SCSI_OPERATION_MODE_SENSE_6     = 0x1A,
+  SCSI_OPERATION_START_STOP_UNIT  = 0x1B,
   SCSI_OPERATION_PREVENT_ALLOW_MEDIUM_REMOVAL
                                   = 0x1E,
+  SCSI_OPERATION_READ_FORMAT_CAPACITIES
+                                  = 0x23,
   SCSI_OPERATION_READ_CAPACITY    = 0x25,
   SCSI_OPERATION_READ_10          = 0x28,
   SCSI_OPERATION_WRITE_10         = 0x2A,
+  SCSI_OPERATION_VERIFY_10        = 0x2F,
+  SCSI_OPERATION_SYNCHRONIZE_CACHE_10
+                                  = 0x35,
+  SCSI_OPERATION_MODE_SENSE_10    = 0x5A,
+  SCSI_OPERATION_SERVICE_ACTION_IN_16
+                                  = 0x9E,
+};
+
+enum scsi_service_action {
+  SCSI_SERVICE_ACTION_READ_CAPACITY_16 = 0x10,
 };
 
 struct scsi_command {
@@ -129,6 +293,15 @@ struct scsi_command {
     struct scsi_request_sense     request_sense;
     struct scsi_inquiry           inquiry;
     struct scsi_read_capacity     read_capacity;
+    struct scsi_read_capacity_16  read_capacity_16;
+    struct scsi_read_format_capacities
+                                  read_format_capacities;
+    struct scsi_mode_sense_6      mode_sense_6;
+    struct scsi_mode_sense_10     mode_sense_10;
+    struct scsi_start_stop_unit   start_stop_unit;
+    struct scsi_synchronize_cache_10
+                                  synchronize_cache_10;
+    struct scsi_verify_10         verify_10;
     struct scsi_read_10           read_10;
     struct scsi_write_10          write_10;
     struct scsi_prevent_allow_medium_removal
@@ -160,6 +333,18 @@ enum scsi_sense_key {
   SCSI_SENSE_ABORTED_COMMAND  = 0xB,
 };
 
+/// Additional sense code and additional sense code qualifier, as a single 16-bit value.
+enum scsi_additional_sense {
+  SCSI_ASC_NO_ADDITIONAL_SENSE_INFORMATION      = 0x0000,
+  SCSI_ASC_WRITE_ERROR                          = 0x0C00,
+  SCSI_ASC_UNRECOVERED_READ_ERROR               = 0x1100,
+  SCSI_ASC_INVALID_COMMAND_OPERATION_CODE       = 0x2000,
+  SCSI_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE   = 0x2100,
+  SCSI_ASC_INVALID_FIELD_IN_CDB                 = 0x2400,
+  SCSI_ASC_WRITE_PROTECTED                      = 0x2700,
+  SCSI_ASC_MEDIUM_NOT_PRESENT                   = 0x3A00,
+};
+
 struct scsi_sense_data_descriptor {
   uint8_t  response_code:7;
   uint8_t  __reserved0:1;
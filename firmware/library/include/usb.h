@@ -55,8 +55,11 @@ enum usb_descriptor {
   USB_DESC_DEVICE_QUALIFIER = 6,
   USB_DESC_OTHER_SPEED_CONFIGURATION = 7,
   USB_DESC_INTERFACE_POWER  = 8,
+  USB_DESC_INTERFACE_ASSOCIATION = 11,
   USB_DESC_BINARY_OBJECT_STORE = 15,
   USB_DESC_DEVICE_CAPABILITY = 16,
+  USB_DESC_CS_INTERFACE     = 0x24,
+  USB_DESC_CS_ENDPOINT      = 0x25,
 };
 
 enum usb_device_capability {
@@ -129,6 +132,11 @@ enum {
   USB_DEV_SUBCLASS_PER_INTERFACE  = 0x00,
   USB_DEV_PROTOCOL_PER_INTERFACE  = 0x00,
 
+  USB_DEV_CLASS_MISCELLANEOUS     = 0xef,
+  USB_DEV_SUBCLASS_COMMON         = 0x02,
+  USB_DEV_PROTOCOL_INTERFACE_ASSOCIATION
+                                  = 0x01,
+
   USB_DEV_CLASS_VENDOR            = 0xff,
   USB_DEV_SUBCLASS_VENDOR         = 0xff,
   USB_DEV_PROTOCOL_VENDOR         = 0xff,
@@ -209,6 +217,20 @@ struct usb_desc_interface {
 typedef __code const struct usb_desc_interface
   usb_desc_interface_c;
 
+struct usb_desc_interface_association {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bFirstInterface;
+  uint8_t bInterfaceCount;
+  uint8_t bFunctionClass;
+  uint8_t bFunctionSubClass;
+  uint8_t bFunctionProtocol;
+  uint8_t iFunction;
+};
+
+typedef __code const struct usb_desc_interface_association
+  usb_desc_interface_association_c;
+
 struct usb_desc_endpoint {
   uint8_t bLength;
   uint8_t bDescriptorType;
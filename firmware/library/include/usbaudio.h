@@ -0,0 +1,339 @@
+#ifndef USBAUDIO_H
+#define USBAUDIO_H
+
+#include <stdint.h>
+
+enum {
+  /// Audio Interface Class
+  USB_IFACE_CLASS_AUDIO                   = 0x01,
+
+  /// Audio Control Interface Subclass
+  USB_IFACE_SUBCLASS_AUDIO_CONTROL        = 0x01,
+  /// Audio Streaming Interface Subclass
+  USB_IFACE_SUBCLASS_AUDIO_STREAMING      = 0x02,
+  /// MIDI Streaming Interface Subclass
+  USB_IFACE_SUBCLASS_AUDIO_MIDI_STREAMING = 0x03,
+
+  /// Audio Interface Protocol: USB Audio Class 1.0
+  USB_IFACE_PROTOCOL_AUDIO_1_0            = 0x00,
+  /// Audio Interface Protocol: USB Audio Class 2.0
+  USB_IFACE_PROTOCOL_AUDIO_2_0            = 0x20,
+
+  /// Audio Function Class (USB Audio Class 2.0 interface association)
+  USB_FUNC_CLASS_AUDIO                    = 0x01,
+  /// Audio Function Subclass: undefined
+  USB_FUNC_SUBCLASS_AUDIO_UNDEFINED       = 0x00,
+  /// Audio Function Protocol: USB Audio Class 2.0
+  USB_FUNC_PROTOCOL_AUDIO_2_0             = 0x20,
+};
+
+enum usb_audio_desc_ac_subtype {
+  USB_DESC_AUDIO_AC_HEADER          = 0x01,
+  USB_DESC_AUDIO_AC_INPUT_TERMINAL  = 0x02,
+  USB_DESC_AUDIO_AC_OUTPUT_TERMINAL = 0x03,
+  USB_DESC_AUDIO_AC_MIXER_UNIT      = 0x04,
+  USB_DESC_AUDIO_AC_SELECTOR_UNIT   = 0x05,
+  USB_DESC_AUDIO_AC_FEATURE_UNIT    = 0x06,
+  /// USB Audio Class 2.0 only.
+  USB_DESC_AUDIO_AC_CLOCK_SOURCE    = 0x0a,
+  /// USB Audio Class 2.0 only.
+  USB_DESC_AUDIO_AC_CLOCK_SELECTOR  = 0x0b,
+};
+
+enum usb_audio_desc_as_subtype {
+  USB_DESC_AUDIO_AS_GENERAL         = 0x01,
+  USB_DESC_AUDIO_AS_FORMAT_TYPE     = 0x02,
+};
+
+enum usb_audio_desc_ep_subtype {
+  USB_DESC_AUDIO_EP_GENERAL         = 0x01,
+};
+
+enum usb_audio_terminal_type {
+  USB_AUDIO_TERMINAL_USB_STREAMING  = 0x0101,
+  USB_AUDIO_TERMINAL_MICROPHONE     = 0x0201,
+  USB_AUDIO_TERMINAL_MIC_ARRAY      = 0x0205,
+  USB_AUDIO_TERMINAL_SPEAKER        = 0x0301,
+  USB_AUDIO_TERMINAL_LINE_CONNECTOR = 0x0603,
+  USB_AUDIO_TERMINAL_DIGITAL        = 0x0602,
+};
+
+enum {
+  USB_AUDIO_FORMAT_TYPE_I           = 0x01,
+  USB_AUDIO_FORMAT_TAG_PCM          = 0x0001,
+  /// USB Audio Class 2.0 ``bmFormats`` bit for PCM.
+  USB_AUDIO_FORMATS_PCM             = 0x00000001,
+};
+
+enum usb_audio_request {
+  /// USB Audio Class 1.0 requests.
+  USB_AUDIO_REQ_SET_CUR             = 0x01,
+  USB_AUDIO_REQ_GET_CUR             = 0x81,
+  USB_AUDIO_REQ_SET_MIN             = 0x02,
+  USB_AUDIO_REQ_GET_MIN             = 0x82,
+  USB_AUDIO_REQ_SET_MAX             = 0x03,
+  USB_AUDIO_REQ_GET_MAX             = 0x83,
+  USB_AUDIO_REQ_SET_RES             = 0x04,
+  USB_AUDIO_REQ_GET_RES             = 0x84,
+
+  /// USB Audio Class 2.0 requests; the direction is taken from ``bmRequestType``.
+  USB_AUDIO2_REQ_CUR                = 0x01,
+  USB_AUDIO2_REQ_RANGE              = 0x02,
+};
+
+enum usb_audio_control_selector {
+  /// USB Audio Class 1.0 endpoint control.
+  USB_AUDIO_EP_SAMPLING_FREQ_CONTROL = 0x01,
+  USB_AUDIO_EP_PITCH_CONTROL         = 0x02,
+
+  /// USB Audio Class 2.0 clock source controls.
+  USB_AUDIO2_CS_SAM_FREQ_CONTROL     = 0x01,
+  USB_AUDIO2_CS_CLOCK_VALID_CONTROL  = 0x02,
+};
+
+enum {
+  /// USB Audio Class 1.0 class-specific endpoint ``bmAttributes`` bits.
+  USB_AUDIO_EP_ATTR_SAMPLING_FREQ   = 0b00000001,
+  USB_AUDIO_EP_ATTR_PITCH           = 0b00000010,
+  USB_AUDIO_EP_ATTR_MAX_PACKETS_ONLY = 0b10000000,
+
+  /// USB Audio Class 2.0 clock source ``bmAttributes`` values.
+  USB_AUDIO2_CLOCK_EXTERNAL         = 0b00000000,
+  USB_AUDIO2_CLOCK_INTERNAL_FIXED   = 0b00000001,
+  USB_AUDIO2_CLOCK_INTERNAL_VARIABLE = 0b00000010,
+  USB_AUDIO2_CLOCK_INTERNAL_PROGRAMMABLE = 0b00000011,
+  USB_AUDIO2_CLOCK_SYNCED_TO_SOF    = 0b00000100,
+
+  /// USB Audio Class 2.0 ``bmControls`` values for a single control.
+  USB_AUDIO2_CONTROL_NONE           = 0b00,
+  USB_AUDIO2_CONTROL_READ_ONLY      = 0b01,
+  USB_AUDIO2_CONTROL_READ_WRITE     = 0b11,
+};
+
+/**
+ * USB Audio Class 1.0 class-specific Audio Control interface header descriptor, for a function
+ * with a single Audio Streaming interface. For more streaming interfaces, a similar structure
+ * with a longer ``baInterfaceNr`` array can be declared.
+ */
+struct usb_audio_desc_ac_header {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint16_t bcdADC;
+  uint16_t wTotalLength;
+  uint8_t bInCollection;
+  uint8_t baInterfaceNr[1];
+};
+
+typedef __code const struct usb_audio_desc_ac_header
+  usb_audio_desc_ac_header_c;
+
+/// USB Audio Class 1.0 input terminal descriptor.
+struct usb_audio_desc_input_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t bNrChannels;
+  uint16_t wChannelConfig;
+  uint8_t iChannelNames;
+  uint8_t iTerminal;
+};
+
+typedef __code const struct usb_audio_desc_input_terminal
+  usb_audio_desc_input_terminal_c;
+
+/// USB Audio Class 1.0 output terminal descriptor.
+struct usb_audio_desc_output_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t bSourceID;
+  uint8_t iTerminal;
+};
+
+typedef __code const struct usb_audio_desc_output_terminal
+  usb_audio_desc_output_terminal_c;
+
+/// USB Audio Class 1.0 class-specific Audio Streaming interface descriptor.
+struct usb_audio_desc_as_general {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalLink;
+  uint8_t bDelay;
+  uint16_t wFormatTag;
+};
+
+typedef __code const struct usb_audio_desc_as_general
+  usb_audio_desc_as_general_c;
+
+/**
+ * USB Audio Class 1.0 Type I format descriptor. Each sampling frequency is a 24-bit little endian
+ * value. For a continuous range, set ``bSamFreqType`` to 0 and ``tSamFreq`` to the lower and upper
+ * bound; for a single discrete frequency, set ``bSamFreqType`` to 1 and ``bLength`` to 11.
+ * For more discrete frequencies, a similar structure with a longer ``tSamFreq`` array
+ * can be declared.
+ */
+struct usb_audio_desc_format_type_1 {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bFormatType;
+  uint8_t bNrChannels;
+  uint8_t bSubframeSize;
+  uint8_t bBitResolution;
+  uint8_t bSamFreqType;
+  uint8_t tSamFreq[2][3];
+};
+
+typedef __code const struct usb_audio_desc_format_type_1
+  usb_audio_desc_format_type_1_c;
+
+/**
+ * USB Audio Class 1.0 standard isochronous endpoint descriptor. This descriptor has the same
+ * layout as ``struct usb_desc_endpoint``, extended with two fields, and can be used in
+ * a configuration through the ``generic`` member of ``union usb_config_item``.
+ */
+struct usb_audio_desc_endpoint {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bEndpointAddress;
+  uint8_t bmAttributes;
+  uint16_t wMaxPacketSize;
+  uint8_t bInterval;
+  uint8_t bRefresh;
+  uint8_t bSynchAddress;
+};
+
+typedef __code const struct usb_audio_desc_endpoint
+  usb_audio_desc_endpoint_c;
+
+/// USB Audio Class 1.0 class-specific isochronous audio data endpoint descriptor.
+struct usb_audio_desc_cs_endpoint {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bmAttributes;
+  uint8_t bLockDelayUnits;
+  uint16_t wLockDelay;
+};
+
+typedef __code const struct usb_audio_desc_cs_endpoint
+  usb_audio_desc_cs_endpoint_c;
+
+/// USB Audio Class 2.0 class-specific Audio Control interface header descriptor.
+struct usb_audio2_desc_ac_header {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint16_t bcdADC;
+  uint8_t bCategory;
+  uint16_t wTotalLength;
+  uint8_t bmControls;
+};
+
+typedef __code const struct usb_audio2_desc_ac_header
+  usb_audio2_desc_ac_header_c;
+
+/// USB Audio Class 2.0 clock source descriptor.
+struct usb_audio2_desc_clock_source {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bClockID;
+  uint8_t bmAttributes;
+  uint8_t bmControls;
+  uint8_t bAssocTerminal;
+  uint8_t iClockSource;
+};
+
+typedef __code const struct usb_audio2_desc_clock_source
+  usb_audio2_desc_clock_source_c;
+
+/// USB Audio Class 2.0 input terminal descriptor.
+struct usb_audio2_desc_input_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t bCSourceID;
+  uint8_t bNrChannels;
+  uint32_t bmChannelConfig;
+  uint8_t iChannelNames;
+  uint16_t bmControls;
+  uint8_t iTerminal;
+};
+
+typedef __code const struct usb_audio2_desc_input_terminal
+  usb_audio2_desc_input_terminal_c;
+
+/// USB Audio Class 2.0 output terminal descriptor.
+struct usb_audio2_desc_output_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t bSourceID;
+  uint8_t bCSourceID;
+  uint16_t bmControls;
+  uint8_t iTerminal;
+};
+
+typedef __code const struct usb_audio2_desc_output_terminal
+  usb_audio2_desc_output_terminal_c;
+
+/// USB Audio Class 2.0 class-specific Audio Streaming interface descriptor.
+struct usb_audio2_desc_as_general {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalLink;
+  uint8_t bmControls;
+  uint8_t bFormatType;
+  uint32_t bmFormats;
+  uint8_t bNrChannels;
+  uint32_t bmChannelConfig;
+  uint8_t iChannelNames;
+};
+
+typedef __code const struct usb_audio2_desc_as_general
+  usb_audio2_desc_as_general_c;
+
+/// USB Audio Class 2.0 Type I format descriptor.
+struct usb_audio2_desc_format_type_1 {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bFormatType;
+  uint8_t bSubslotSize;
+  uint8_t bBitResolution;
+};
+
+typedef __code const struct usb_audio2_desc_format_type_1
+  usb_audio2_desc_format_type_1_c;
+
+/// USB Audio Class 2.0 class-specific isochronous audio data endpoint descriptor.
+struct usb_audio2_desc_cs_endpoint {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bmAttributes;
+  uint8_t bmControls;
+  uint8_t bLockDelayUnits;
+  uint16_t wLockDelay;
+};
+
+typedef __code const struct usb_audio2_desc_cs_endpoint
+  usb_audio2_desc_cs_endpoint_c;
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef USBCDC_H
 #define USBCDC_H
 
+#include <usb.h>
+
 enum {
   /// Communications Device Class
   USB_DEV_CLASS_CDC   = 0x02,
@@ -90,11 +92,6 @@ enum {
   USB_IFACE_PROTOCOL_CDC_DIC_EXTERNAL = 0xFE,
 };
 
-enum /*usb_descriptor*/ {
-  USB_DESC_CS_INTERFACE = 0x24,
-  USB_DESC_CS_ENDPOINT  = 0x25,
-};
-
 enum usb_cdc_desc_functional_subtype {
   /// Header Functional Descriptor
   USB_DESC_CDC_FUNCTIONAL_SUBTYPE_HEADER = 0x00,
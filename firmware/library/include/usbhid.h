@@ -0,0 +1,56 @@
+#ifndef USBHID_H
+#define USBHID_H
+
+#include <stdint.h>
+
+enum {
+  USB_IFACE_CLASS_HID                 = 0x03,
+
+  USB_IFACE_SUBCLASS_HID_NONE         = 0x00,
+  USB_IFACE_SUBCLASS_HID_BOOT         = 0x01,
+
+  USB_IFACE_PROTOCOL_HID_NONE         = 0x00,
+  USB_IFACE_PROTOCOL_HID_KEYBOARD     = 0x01,
+  USB_IFACE_PROTOCOL_HID_MOUSE        = 0x02,
+};
+
+enum /*usb_descriptor*/ {
+  USB_DESC_HID                        = 0x21,
+  USB_DESC_HID_REPORT                 = 0x22,
+  USB_DESC_HID_PHYSICAL               = 0x23,
+};
+
+enum usb_hid_request {
+  USB_HID_REQ_GET_REPORT              = 0x01,
+  USB_HID_REQ_GET_IDLE                = 0x02,
+  USB_HID_REQ_GET_PROTOCOL            = 0x03,
+  USB_HID_REQ_SET_REPORT              = 0x09,
+  USB_HID_REQ_SET_IDLE                = 0x0a,
+  USB_HID_REQ_SET_PROTOCOL            = 0x0b,
+};
+
+enum usb_hid_report_type {
+  USB_HID_REPORT_INPUT                = 0x01,
+  USB_HID_REPORT_OUTPUT               = 0x02,
+  USB_HID_REPORT_FEATURE              = 0x03,
+};
+
+enum usb_hid_protocol {
+  USB_HID_PROTOCOL_BOOT               = 0x00,
+  USB_HID_PROTOCOL_REPORT             = 0x01,
+};
+
+struct usb_hid_desc {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdHID;
+  uint8_t bCountryCode;
+  uint8_t bNumDescriptors;
+  uint8_t bReportDescriptorType;
+  uint16_t wReportDescriptorLength;
+};
+
+typedef __code const struct usb_hid_desc
+  usb_hid_desc_c;
+
+#endif
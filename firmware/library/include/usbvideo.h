@@ -0,0 +1,217 @@
+#ifndef USBVIDEO_H
+#define USBVIDEO_H
+
+#include <stdint.h>
+
+enum {
+  /// Video Interface Class
+  USB_IFACE_CLASS_VIDEO                     = 0x0e,
+
+  /// Video Control Interface Subclass
+  USB_IFACE_SUBCLASS_VIDEO_CONTROL          = 0x01,
+  /// Video Streaming Interface Subclass
+  USB_IFACE_SUBCLASS_VIDEO_STREAMING        = 0x02,
+  /// Video Interface Collection Subclass (for the interface association descriptor)
+  USB_IFACE_SUBCLASS_VIDEO_INTERFACE_COLLECTION = 0x03,
+
+  /// Video Interface Protocol: undefined
+  USB_IFACE_PROTOCOL_VIDEO_UNDEFINED        = 0x00,
+};
+
+enum usb_video_desc_vc_subtype {
+  USB_DESC_VIDEO_VC_HEADER                  = 0x01,
+  USB_DESC_VIDEO_VC_INPUT_TERMINAL          = 0x02,
+  USB_DESC_VIDEO_VC_OUTPUT_TERMINAL         = 0x03,
+  USB_DESC_VIDEO_VC_SELECTOR_UNIT           = 0x04,
+  USB_DESC_VIDEO_VC_PROCESSING_UNIT         = 0x05,
+  USB_DESC_VIDEO_VC_EXTENSION_UNIT          = 0x06,
+};
+
+enum usb_video_desc_vs_subtype {
+  USB_DESC_VIDEO_VS_INPUT_HEADER            = 0x01,
+  USB_DESC_VIDEO_VS_OUTPUT_HEADER           = 0x02,
+  USB_DESC_VIDEO_VS_STILL_IMAGE_FRAME       = 0x03,
+  USB_DESC_VIDEO_VS_FORMAT_UNCOMPRESSED     = 0x04,
+  USB_DESC_VIDEO_VS_FRAME_UNCOMPRESSED      = 0x05,
+  USB_DESC_VIDEO_VS_FORMAT_MJPEG            = 0x06,
+  USB_DESC_VIDEO_VS_FRAME_MJPEG             = 0x07,
+  USB_DESC_VIDEO_VS_COLORFORMAT             = 0x0d,
+};
+
+enum usb_video_terminal_type {
+  USB_VIDEO_TERMINAL_USB_STREAMING          = 0x0101,
+  USB_VIDEO_TERMINAL_CAMERA                 = 0x0201,
+  USB_VIDEO_TERMINAL_MEDIA_TRANSPORT_INPUT  = 0x0202,
+};
+
+enum usb_video_request {
+  USB_VIDEO_REQ_SET_CUR                     = 0x01,
+  USB_VIDEO_REQ_GET_CUR                     = 0x81,
+  USB_VIDEO_REQ_GET_MIN                     = 0x82,
+  USB_VIDEO_REQ_GET_MAX                     = 0x83,
+  USB_VIDEO_REQ_GET_RES                     = 0x84,
+  USB_VIDEO_REQ_GET_LEN                     = 0x85,
+  USB_VIDEO_REQ_GET_INFO                    = 0x86,
+  USB_VIDEO_REQ_GET_DEF                     = 0x87,
+};
+
+enum usb_video_vs_control_selector {
+  USB_VIDEO_VS_PROBE_CONTROL                = 0x01,
+  USB_VIDEO_VS_COMMIT_CONTROL               = 0x02,
+};
+
+enum {
+  /// ``GET_INFO`` response bits.
+  USB_VIDEO_INFO_SUPPORTS_GET               = 0b00000001,
+  USB_VIDEO_INFO_SUPPORTS_SET               = 0b00000010,
+};
+
+/// Payload header ``bmHeaderInfo`` bits.
+enum usb_video_header_info {
+  USB_VIDEO_HEADER_FID                      = 0b00000001,
+  USB_VIDEO_HEADER_EOF                      = 0b00000010,
+  USB_VIDEO_HEADER_PTS                      = 0b00000100,
+  USB_VIDEO_HEADER_SCR                      = 0b00001000,
+  USB_VIDEO_HEADER_RES                      = 0b00010000,
+  USB_VIDEO_HEADER_STI                      = 0b00100000,
+  USB_VIDEO_HEADER_ERR                      = 0b01000000,
+  USB_VIDEO_HEADER_EOH                      = 0b10000000,
+};
+
+/**
+ * Video Control interface header descriptor, for a function with a single Video Streaming
+ * interface. For more streaming interfaces, a similar structure with a longer
+ * ``baInterfaceNr`` array can be declared.
+ */
+struct usb_video_desc_vc_header {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint16_t bcdUVC;
+  uint16_t wTotalLength;
+  uint32_t dwClockFrequency;
+  uint8_t bInCollection;
+  uint8_t baInterfaceNr[1];
+};
+
+typedef __code const struct usb_video_desc_vc_header
+  usb_video_desc_vc_header_c;
+
+/// Camera terminal descriptor.
+struct usb_video_desc_camera_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t iTerminal;
+  uint16_t wObjectiveFocalLengthMin;
+  uint16_t wObjectiveFocalLengthMax;
+  uint16_t wOcularFocalLength;
+  uint8_t bControlSize;
+  uint8_t bmControls[3];
+};
+
+typedef __code const struct usb_video_desc_camera_terminal
+  usb_video_desc_camera_terminal_c;
+
+/// Output terminal descriptor.
+struct usb_video_desc_output_terminal {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bTerminalID;
+  uint16_t wTerminalType;
+  uint8_t bAssocTerminal;
+  uint8_t bSourceID;
+  uint8_t iTerminal;
+};
+
+typedef __code const struct usb_video_desc_output_terminal
+  usb_video_desc_output_terminal_c;
+
+/**
+ * Video Streaming interface input header descriptor, for an interface with a single format.
+ * For more formats, a similar structure with a longer ``bmaControls`` array can be declared.
+ */
+struct usb_video_desc_vs_input_header {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bNumFormats;
+  uint16_t wTotalLength;
+  uint8_t bEndpointAddress;
+  uint8_t bmInfo;
+  uint8_t bTerminalLink;
+  uint8_t bStillCaptureMethod;
+  uint8_t bTriggerSupport;
+  uint8_t bTriggerUsage;
+  uint8_t bControlSize;
+  uint8_t bmaControls[1];
+};
+
+typedef __code const struct usb_video_desc_vs_input_header
+  usb_video_desc_vs_input_header_c;
+
+/// Uncompressed video format descriptor.
+struct usb_video_desc_format_uncompressed {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bFormatIndex;
+  uint8_t bNumFrameDescriptors;
+  uint8_t guidFormat[16];
+  uint8_t bBitsPerPixel;
+  uint8_t bDefaultFrameIndex;
+  uint8_t bAspectRatioX;
+  uint8_t bAspectRatioY;
+  uint8_t bmInterlaceFlags;
+  uint8_t bCopyProtect;
+};
+
+typedef __code const struct usb_video_desc_format_uncompressed
+  usb_video_desc_format_uncompressed_c;
+
+/**
+ * Uncompressed video frame descriptor, with a single discrete frame interval. For more frame
+ * intervals, a similar structure with a longer ``dwFrameInterval`` array can be declared.
+ */
+struct usb_video_desc_frame_uncompressed {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint8_t bDescriptorSubtype;
+  uint8_t bFrameIndex;
+  uint8_t bmCapabilities;
+  uint16_t wWidth;
+  uint16_t wHeight;
+  uint32_t dwMinBitRate;
+  uint32_t dwMaxBitRate;
+  uint32_t dwMaxVideoFrameBufferSize;
+  uint32_t dwDefaultFrameInterval;
+  uint8_t bFrameIntervalType;
+  uint32_t dwFrameInterval[1];
+};
+
+typedef __code const struct usb_video_desc_frame_uncompressed
+  usb_video_desc_frame_uncompressed_c;
+
+/// Video probe and commit controls, as defined in USB Video Class 1.0.
+struct usb_video_probe_commit {
+  uint16_t bmHint;
+  uint8_t bFormatIndex;
+  uint8_t bFrameIndex;
+  uint32_t dwFrameInterval;
+  uint16_t wKeyFrameRate;
+  uint16_t wPFrameRate;
+  uint16_t wCompQuality;
+  uint16_t wCompWindowSize;
+  uint16_t wDelay;
+  uint32_t dwMaxVideoFrameSize;
+  uint32_t dwMaxPayloadTransferSize;
+};
+
+typedef __code const struct usb_video_probe_commit
+  usb_video_probe_commit_c;
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <fx2lib.h>
+#include <fx2scsi.h>
+
+#define BLOCK_SIZE BLOCKDEV_SECTOR_SIZE
+
+// When built as the fx2usbmassstor_direct library, the block device is accessed through
+// the scsi_blockdev_* functions, which are called directly rather than through the function
+// pointers in ``struct blockdev``.
+#ifdef FX2_DIRECT_CALLS
+#define DEVICE_READ(state)  scsi_blockdev_read
+#define DEVICE_WRITE(state) scsi_blockdev_write
+#else
+#define DEVICE_READ(state)  (state)->device->read
+#define DEVICE_WRITE(state) (state)->device->write
+#endif
+
+#define COMMAND_FITS(field) \
+  (length >= sizeof(command->op_code) + sizeof(command->field))
+
+static bool fail(scsi_block_device_state_t *state, uint8_t sense_key,
+                 uint16_t additional_sense) {
+  state->_op_code          = 0;
+  state->_sense_key        = sense_key;
+  state->_additional_sense = additional_sense;
+  return false;
+}
+
+static bool check_range(scsi_block_device_state_t *state, uint32_t lba, uint32_t count) {
+  uint32_t sector_count = state->device->sector_count;
+  return lba <= sector_count && count <= sector_count - lba;
+}
+
+static bool is_write_protected(scsi_block_device_state_t *state) {
+#ifdef FX2_DIRECT_CALLS
+  return state->write_protected;
+#else
+  return state->write_protected || !state->device->write;
+#endif
+}
+
+static bool has_cache(scsi_block_device_state_t *state) {
+#ifdef FX2_DIRECT_CALLS
+  state;
+  return true;
+#else
+  return state->device->flush != NULL;
+#endif
+}
+
+static bool flush(scsi_block_device_state_t *state) {
+#ifdef FX2_DIRECT_CALLS
+  state;
+  return scsi_blockdev_flush();
+#else
+  return !state->device->flush || state->device->flush();
+#endif
+}
+
+bool scsi_command(scsi_block_device_state_t *state, __xdata uint8_t *buffer, uint8_t length) {
+  __xdata struct scsi_command *command = (__xdata struct scsi_command *)buffer;
+
+  // Here, we generally ignore the Allocation length field when validating the commands,
+  // since this is already handled on the USB MSC BBB level.
+
+  switch(command->op_code) {
+    case SCSI_OPERATION_TEST_UNIT_READY:
+      if(!COMMAND_FITS(test_unit_ready))
+        break;
+      goto success;
+
+    case SCSI_OPERATION_REQUEST_SENSE:
+      if(!COMMAND_FITS(request_sense))
+        break;
+      if(command->request_sense.desc != 0)
+        goto invalid_field;
+      // Don't clobber the sense data we're about to return.
+      state->_op_code = command->op_code;
+      return true;
+
+    case SCSI_OPERATION_INQUIRY:
+      if(!COMMAND_FITS(inquiry))
+        break;
+      if(command->inquiry.evpd != 0 || command->inquiry.page_code != 0)
+        goto invalid_field;
+      goto success;
+
+    case SCSI_OPERATION_MODE_SENSE_6:
+      if(!COMMAND_FITS(mode_sense_6))
+        break;
+      state->_page_code    = command->mode_sense_6.page_code;
+      state->_page_control = command->mode_sense_6.pc;
+      goto success;
+
+    case SCSI_OPERATION_MODE_SENSE_10:
+      if(!COMMAND_FITS(mode_sense_10))
+        break;
+      state->_page_code    = command->mode_sense_10.page_code;
+      state->_page_control = command->mode_sense_10.pc;
+      goto success;
+
+    // The hosts send these commands when the medium is ejected or about to be unplugged,
+    // which is the last chance to commit the cached sectors.
+    case SCSI_OPERATION_START_STOP_UNIT:
+      if(!COMMAND_FITS(start_stop_unit))
+        break;
+      if(!command->start_stop_unit.no_flush && !flush(state))
+        return fail(state, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+      goto success;
+
+    case SCSI_OPERATION_PREVENT_ALLOW_MEDIUM_REMOVAL:
+      if(!COMMAND_FITS(prevent_allow_medium_removal))
+        break;
+      if(!command->prevent_allow_medium_removal.prevent && !flush(state))
+        return fail(state, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+      goto success;
+
+    case SCSI_OPERATION_READ_FORMAT_CAPACITIES:
+      if(!COMMAND_FITS(read_format_capacities))
+        break;
+      goto success;
+
+    case SCSI_OPERATION_READ_CAPACITY:
+      if(!COMMAND_FITS(read_capacity))
+        break;
+      goto success;
+
+    case SCSI_OPERATION_SERVICE_ACTION_IN_16:
+      if(!COMMAND_FITS(read_capacity_16))
+        break;
+      if(command->read_capacity_16.service_action != SCSI_SERVICE_ACTION_READ_CAPACITY_16)
+        goto invalid_field;
+      goto success;
+
+    case SCSI_OPERATION_SYNCHRONIZE_CACHE_10:
+      if(!COMMAND_FITS(synchronize_cache_10))
+        break;
+      if(!flush(state))
+        return fail(state, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+      goto success;
+
+    case SCSI_OPERATION_VERIFY_10:
+      if(!COMMAND_FITS(verify_10))
+        break;
+      // Comparing the data is not supported; a medium verification always succeeds.
+      if(command->verify_10.bytchk)
+        goto invalid_field;
+      goto success;
+
+    case SCSI_OPERATION_READ_10:
+      if(!COMMAND_FITS(read_10))
+        break;
+      state->_block_index = bswap32(command->read_10.logical_block_address);
+      state->_blocks_left = bswap16(command->read_10.transfer_length);
+      if(!check_range(state, state->_block_index, state->_blocks_left))
+        goto out_of_range;
+      goto success;
+
+    case SCSI_OPERATION_WRITE_10:
+      if(!COMMAND_FITS(write_10))
+        break;
+      if(is_write_protected(state))
+        return fail(state, SCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED);
+      state->_block_index = bswap32(command->write_10.logical_block_address);
+      state->_blocks_left = bswap16(command->write_10.transfer_length);
+      if(!check_range(state, state->_block_index, state->_blocks_left))
+        goto out_of_range;
+      goto success;
+  }
+
+  return fail(state, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND_OPERATION_CODE);
+
+invalid_field:
+  return fail(state, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+
+out_of_range:
+  return fail(state, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+
+success:
+  state->_op_code          = command->op_code;
+  state->_sense_key        = SCSI_SENSE_NO_SENSE;
+  state->_additional_sense = SCSI_ASC_NO_ADDITIONAL_SENSE_INFORMATION;
+  return true;
+}
+
+bool scsi_data_out(scsi_block_device_state_t *state, __xdata const uint8_t *data,
+                   uint16_t length) {
+  if(state->_op_code == SCSI_OPERATION_WRITE_10) {
+    if(state->_blocks_left == 0 || length != BLOCK_SIZE)
+      return fail(state, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+    if(!DEVICE_WRITE(state)(state->_block_index, data, 1))
+      return fail(state, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+
+    state->_block_index++;
+    state->_blocks_left--;
+    if(state->_blocks_left > 0)
+      return true;
+
+    goto done;
+  }
+
+  return false;
+
+done:
+  state->_op_code = 0;
+  return true;
+}
+
+// Only the Caching mode page is returned, with WCE set if the block device has a cache, so that
+// the hosts issue SYNCHRONIZE CACHE. Since MODE SELECT is not supported, none of its fields are
+// changeable. Any other page is returned as an empty list of pages.
+static uint8_t mode_pages(scsi_block_device_state_t *state, __xdata uint8_t *data) {
+  __xdata struct scsi_caching_mode_page *caching =
+    (__xdata struct scsi_caching_mode_page *)data;
+
+  if(state->_page_code != SCSI_MODE_PAGE_CACHING && state->_page_code != SCSI_MODE_PAGE_ALL)
+    return 0;
+
+  caching->page_code   = SCSI_MODE_PAGE_CACHING;
+  caching->page_length = sizeof(struct scsi_caching_mode_page) -
+    (offsetof(struct scsi_caching_mode_page, page_length) + sizeof(caching->page_length));
+  if(state->_page_control != SCSI_MODE_PAGE_CONTROL_CHANGEABLE)
+    caching->wce = has_cache(state);
+  return sizeof(struct scsi_caching_mode_page);
+}
+
+bool scsi_data_in(scsi_block_device_state_t *state, __xdata uint8_t *data, uint16_t length) {
+  // All responses other than READ are much shorter than the buffer (which is always at least
+  // one packet long); any bytes beyond the response are zeroes.
+  if(state->_op_code != SCSI_OPERATION_READ_10)
+    xmemclr(data, length);
+
+  switch(state->_op_code) {
+    case SCSI_OPERATION_REQUEST_SENSE: {
+      __xdata struct scsi_sense_data_fixed *sense =
+        (__xdata struct scsi_sense_data_fixed *)data;
+
+      sense->response_code   = SCSI_SENSE_CURRENT_ERROR_FIXED_FORMAT;
+      sense->sense_key       = state->_sense_key;
+      sense->additional_sense_length = sizeof(struct scsi_sense_data_fixed) -
+        (offsetof(struct scsi_sense_data_fixed, additional_sense_length) +
+         sizeof(sense->additional_sense_length));
+      sense->additional_sense_code           = state->_additional_sense >> 8;
+      sense->additional_sense_code_qualifier = state->_additional_sense & 0xff;
+
+      state->_sense_key        = SCSI_SENSE_NO_SENSE;
+      state->_additional_sense = SCSI_ASC_NO_ADDITIONAL_SENSE_INFORMATION;
+      goto done;
+    }
+
+    case SCSI_OPERATION_INQUIRY: {
+      __xdata struct scsi_inquiry_data *inquiry =
+        (__xdata struct scsi_inquiry_data *)data;
+
+      inquiry->additional_length = sizeof(struct scsi_inquiry_data) -
+        (offsetof(struct scsi_inquiry_data, additional_length) +
+         sizeof(inquiry->additional_length));
+
+      // SBC-2 (Direct access block device).
+      // It would be more fitting to use RBC here, but Windows does not understand
+      // how to talk to that (even though RBC is basically boneless SBC...)
+      inquiry->peripheral_device_type = 0x00;
+      inquiry->rmb = state->removable;
+
+      xmemcpy(inquiry->t10_vendor_identification, (__xdata void *)state->vendor_id,   8);
+      xmemcpy(inquiry->product_identification,    (__xdata void *)state->product_id, 16);
+      xmemcpy(inquiry->product_revision_level,    (__xdata void *)state->revision,    4);
+      goto done;
+    }
+
+    // The mode parameter header is returned with no block descriptors. The hosts use it
+    // to find out whether the medium is write protected.
+    case SCSI_OPERATION_MODE_SENSE_6: {
+      __xdata struct scsi_mode_parameter_header_6 *header =
+        (__xdata struct scsi_mode_parameter_header_6 *)data;
+
+      header->mode_data_length = sizeof(struct scsi_mode_parameter_header_6) -
+        sizeof(header->mode_data_length) +
+        mode_pages(state, data + sizeof(struct scsi_mode_parameter_header_6));
+      if(is_write_protected(state))
+        header->device_specific_parameter = SCSI_MODE_PARAMETER_WP;
+      goto done;
+    }
+
+    case SCSI_OPERATION_MODE_SENSE_10: {
+      __xdata struct scsi_mode_parameter_header_10 *header =
+        (__xdata struct scsi_mode_parameter_header_10 *)data;
+
+      header->mode_data_length = bswap16(sizeof(struct scsi_mode_parameter_header_10) -
+        sizeof(header->mode_data_length) +
+        mode_pages(state, data + sizeof(struct scsi_mode_parameter_header_10)));
+      if(is_write_protected(state))
+        header->device_specific_parameter = SCSI_MODE_PARAMETER_WP;
+      goto done;
+    }
+
+    case SCSI_OPERATION_READ_FORMAT_CAPACITIES: {
+      __xdata struct scsi_read_format_capacities_data *capacities =
+        (__xdata struct scsi_read_format_capacities_data *)data;
+
+      capacities->capacity_list_length = sizeof(struct scsi_read_format_capacities_data) -
+        (offsetof(struct scsi_read_format_capacities_data, capacity_list_length) +
+         sizeof(capacities->capacity_list_length));
+      capacities->number_of_blocks = bswap32(state->device->sector_count);
+      capacities->descriptor_code  = 0x02; // Formatted media
+      capacities->block_length     = bswap16(BLOCK_SIZE);
+      goto done;
+    }
+
+    case SCSI_OPERATION_READ_CAPACITY: {
+      __xdata struct scsi_read_capacity_data *capacity =
+        (__xdata struct scsi_read_capacity_data *)data;
+
+      capacity->returned_logical_block_address = bswap32(state->device->sector_count - 1);
+      capacity->block_length_in_bytes          = bswap32(BLOCK_SIZE);
+      goto done;
+    }
+
+    case SCSI_OPERATION_SERVICE_ACTION_IN_16: {
+      __xdata struct scsi_read_capacity_16_data *capacity =
+        (__xdata struct scsi_read_capacity_16_data *)data;
+
+      capacity->returned_logical_block_address = bswap32(state->device->sector_count - 1);
+      capacity->logical_block_length_in_bytes  = bswap32(BLOCK_SIZE);
+      goto done;
+    }
+
+    case SCSI_OPERATION_READ_10:
+      if(state->_blocks_left == 0 || length != BLOCK_SIZE)
+        return fail(state, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+      if(!DEVICE_READ(state)(state->_block_index, data, 1))
+        return fail(state, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR);
+
+      state->_block_index++;
+      state->_blocks_left--;
+      if(state->_blocks_left > 0)
+        return true;
+
+      goto done;
+  }
+
+  return false;
+
+done:
+  state->_op_code = 0;
+  return true;
+}
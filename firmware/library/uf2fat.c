@@ -1,6 +1,8 @@
+#include <stddef.h>
 #include <string.h>
 #include <fx2lib.h>
 #include <fx2uf2.h>
+#include <fx2scsi.h>
 #include <fat.h>
 
 #define UF2_MAGIC_START_0           0x0A324655
@@ -72,13 +74,17 @@ static __code const char *status_txt =
   "        ignored: 0x????\r\n"
   "        flashed: 0x????\r\n"
   "         failed: 0x????\r\n"
+  "  Pages written: 0x????\r\n"
+  "        skipped: 0x????\r\n"
   "\r\n"
   "Key:\r\n"
   "- accepted: valid magic and parameters\r\n"
   "- rejected: valid magic but not parameters\r\n"
   "-  ignored: invalid magic (usually filesystem metadata)\r\n"
   "-  flashed: successfully written to NVM\r\n"
-  "-   failed: timeout writing to NVM\r\n";
+  "-   failed: timeout writing to NVM\r\n"
+  "-  written: NVM pages that differed and were written\r\n"
+  "-  skipped: NVM pages that were already up to date\r\n";
 
 static __code const char *hex =
   "0123456789ABCDEF";
@@ -88,6 +94,8 @@ static uint16_t stat_rejected;
 static uint16_t stat_ignored;
 static uint16_t stat_flashed;
 static uint16_t stat_failed;
+static uint16_t stat_written;
+static uint16_t stat_skipped;
 
 static void fill_hex(__xdata uint8_t *buffer, uint16_t stat) {
   buffer[0] = hex[(stat >> 12) & 0xf];
@@ -96,51 +104,132 @@ static void fill_hex(__xdata uint8_t *buffer, uint16_t stat) {
   buffer[3] = hex[(stat >>  0) & 0xf];
 }
 
+// Metadata that does not change while the device is running is rendered once, on the first
+// request, since the host rereads it on every mount. Lengths of the text files are cached too,
+// since strlen() on code memory is slow.
+#define BOOT_HEADER_SIZE  offsetof(struct fat16_boot_sector, bootstrap)
+#define ROOT_USED_ENTRIES 4
+
+#if __SDCC_VERSION_MAJOR > 3 || __SDCC_VERSION_MINOR >= 7
+static bool     cache_valid;
+#else
+static uint8_t  cache_valid;
+#endif
+static uint16_t fat_sectors;
+static uint16_t firmware_sectors;
+static uint16_t info_uf2_txt_size;
+static uint16_t index_htm_size;
+static uint16_t status_txt_size;
+static __xdata uint8_t boot_header_cache[BOOT_HEADER_SIZE];
+static __xdata struct fat_directory_entry root_cache[ROOT_USED_ENTRIES];
+
+static void fill_cache(void) {
+  __xdata struct fat16_boot_sector *boot =
+    (__xdata struct fat16_boot_sector *)boot_header_cache;
+
+  fat_sectors       = FAT_SECTORS;
+  firmware_sectors  = FIRMWARE_SECTORS;
+  info_uf2_txt_size = strlen(uf2_config.info_uf2_txt);
+  index_htm_size    = strlen(uf2_config.index_htm);
+  status_txt_size   = strlen(status_txt);
+
+  // Boot sector, excluding the bootstrap code and the signature.
+  xmemclr(boot_header_cache, BOOT_HEADER_SIZE);
+  xmemcpy(boot->oem_name_version, (__xdata void *)"MSWIN4.1",     8);
+  boot->jump_to_bootstrap[0]  = 0xeb;
+  boot->jump_to_bootstrap[1]  = 0x3c;
+  boot->jump_to_bootstrap[2]  = 0x90;
+  boot->bytes_per_sector      = BYTES_PER_SECTOR;
+  boot->sectors_per_cluster   = 1;
+  boot->reserved_sectors      = FAT_OFFSET;
+  boot->fat_copies            = 1;
+  boot->root_entries          = ROOT_ENTRIES;
+  boot->media_descriptor      = 0xf8;
+  boot->sectors_per_fat       = fat_sectors;
+  boot->total_sectors         = uf2_config.total_sectors;
+  boot->extended_signature    = 0x29;
+  xmemcpy(boot->volume_label,     (__xdata void *)"CYPRESS UF2",  11);
+  xmemcpy(boot->filesystem_type,  (__xdata void *)"FAT16   ",     8);
+
+  // Used root directory entries.
+  xmemclr((__xdata void *)root_cache, sizeof(root_cache));
+  fill_entry(&root_cache[0], "INFO_UF2TXT",
+             /*read_only=*/true,
+             /*first_cluster=*/CLUSTER_INFO_UF2_TXT,
+             /*size=*/info_uf2_txt_size);
+  fill_entry(&root_cache[1], "INDEX   HTM",
+             /*read_only=*/true,
+             /*first_cluster=*/CLUSTER_INDEX_HTM,
+             /*size=*/index_htm_size);
+  fill_entry(&root_cache[2], "STATUS  TXT",
+             /*read_only=*/true,
+             /*first_cluster=*/CLUSTER_STATUS_TXT,
+             /*size=*/status_txt_size);
+  fill_entry(&root_cache[3], "CURRENT UF2",
+             /*read_only=*/false,
+             /*first_cluster=*/CLUSTER_CURRENT_UF2,
+             /*size=*/FIRMWARE_SIZE * 2);
+
+  cache_valid = true;
+}
+
 static void fill_status(__xdata uint8_t *buffer) {
-  xmemcpy(buffer, (__xdata void *)status_txt, strlen(status_txt));
+  xmemcpy(buffer, (__xdata void *)status_txt, status_txt_size);
   fill_hex(&buffer[25 * 0 + 19], stat_accepted);
   fill_hex(&buffer[25 * 1 + 19], stat_rejected);
   fill_hex(&buffer[25 * 2 + 19], stat_ignored);
   fill_hex(&buffer[25 * 3 + 19], stat_flashed);
   fill_hex(&buffer[25 * 4 + 19], stat_failed);
+  fill_hex(&buffer[25 * 5 + 19], stat_written);
+  fill_hex(&buffer[25 * 6 + 19], stat_skipped);
 }
 
 bool uf2_fat_read(uint32_t lba, __xdata uint8_t *data) {
+  if(!cache_valid)
+    fill_cache();
+
   if(lba == 0) {
     // Boot sector.
     __xdata struct fat16_boot_sector *boot =
       (__xdata struct fat16_boot_sector *)data;
-    xmemclr(data, BYTES_PER_SECTOR);
-
-    xmemcpy(boot->oem_name_version, (__xdata void *)"MSWIN4.1",     8);
-    boot->jump_to_bootstrap[0]  = 0xeb;
-    boot->jump_to_bootstrap[1]  = 0x3c;
-    boot->jump_to_bootstrap[2]  = 0x90;
-    boot->bytes_per_sector      = BYTES_PER_SECTOR;
-    boot->sectors_per_cluster   = 1;
-    boot->reserved_sectors      = FAT_OFFSET;
-    boot->fat_copies            = 1;
-    boot->root_entries          = ROOT_ENTRIES;
-    boot->media_descriptor      = 0xf8;
-    boot->sectors_per_fat       = FAT_SECTORS;
-    boot->total_sectors         = uf2_config.total_sectors;
-    boot->extended_signature    = 0x29;
-    xmemcpy(boot->volume_label,     (__xdata void *)"CYPRESS UF2",  11);
-    xmemcpy(boot->filesystem_type,  (__xdata void *)"FAT16   ",     8);
+    xmemcpy(data, boot_header_cache, BOOT_HEADER_SIZE);
+    xmemclr(boot->bootstrap, sizeof(boot->bootstrap));
     boot->signature[0]          = 0x55;
     boot->signature[1]          = 0xaa;
 
     return true;
   }
 
-  if(lba >= FAT_OFFSET && lba < FAT_OFFSET + FAT_SECTORS) {
-    // File allocation table.
-    uint16_t offset = (lba - FAT_OFFSET) << 8;
+  if(lba >= FAT_OFFSET && lba < FAT_OFFSET + fat_sectors) {
+    // File allocation table. Each sector holds 256 entries; the only allocated clusters are
+    // the fixed ones in the first sector, and the CURRENT.UF2 chain, which is contiguous.
+    // Whether a sector intersects the chain is determined without looking at the entries.
+    uint16_t first = (uint16_t)(lba - FAT_OFFSET) << 8;
+    uint16_t last  = first + 255;
+    uint16_t chain_first = CLUSTER_CURRENT_UF2;
+    uint16_t chain_last  = CLUSTER_CURRENT_UF2 + firmware_sectors - 1;
     __xdata uint16_t *next_cluster = (__xdata uint16_t *)data;
-    uint16_t index;
-    xmemclr(data, BYTES_PER_SECTOR);
 
-    if(offset == 0) {
+    if(firmware_sectors == 0 || last < chain_first || first > chain_last) {
+      xmemclr(data, BYTES_PER_SECTOR);
+    } else {
+      uint16_t begin = (first > chain_first) ? first : chain_first;
+      uint16_t end   = (last  < chain_last)  ? last  : chain_last;
+      uint16_t count = end - begin + 1;
+      uint16_t value = begin + 1;
+      __xdata uint16_t *entry = &next_cluster[begin - first];
+
+      // Sectors completely covered by the chain are overwritten anyway.
+      if(begin != first || end != last)
+        xmemclr(data, BYTES_PER_SECTOR);
+
+      while(count--)
+        *entry++ = value++;
+      if(end == chain_last)
+        next_cluster[end - first] = CLUSTER_LAST;
+    }
+
+    if(first == 0) {
       next_cluster[CLUSTER_MEDIA_DESCRIPTOR]  = 0xfff8;
       next_cluster[CLUSTER_EOF_MARKER]        = CLUSTER_LAST;
       next_cluster[CLUSTER_INFO_UF2_TXT]      = CLUSTER_LAST;
@@ -148,44 +237,13 @@ bool uf2_fat_read(uint32_t lba, __xdata uint8_t *data) {
       next_cluster[CLUSTER_STATUS_TXT]        = CLUSTER_LAST;
     }
 
-    if(offset >= CLUSTER_CURRENT_UF2 &&
-       offset <= CLUSTER_CURRENT_UF2 + FIRMWARE_SECTORS + 256) {
-      for(index = offset; index < CLUSTER_CURRENT_UF2 + FIRMWARE_SECTORS; index++) {
-        if(index == CLUSTER_CURRENT_UF2 + FIRMWARE_SECTORS - 1) {
-          next_cluster[index - offset] = CLUSTER_LAST;
-        } else {
-          next_cluster[index - offset] = index + 1;
-        }
-      }
-    }
-
     return true;
   }
 
-  if(lba >= ROOT_OFFSET && lba < ROOT_OFFSET + ROOT_SECTORS) {
+  if(lba >= FAT_OFFSET + fat_sectors && lba < FAT_OFFSET + fat_sectors + ROOT_SECTORS) {
     // Root directory.
-    uint16_t offset = (lba - ROOT_OFFSET) >> 4;
-    __xdata struct fat_directory_entry *root_entry = (__xdata struct fat_directory_entry *)data;
-    xmemclr(data, BYTES_PER_SECTOR);
-
-    if(offset == 0) {
-      fill_entry(&root_entry[0], "INFO_UF2TXT",
-                 /*read_only=*/true,
-                 /*first_cluster=*/CLUSTER_INFO_UF2_TXT,
-                 /*size=*/strlen(uf2_config.info_uf2_txt));
-      fill_entry(&root_entry[1], "INDEX   HTM",
-                 /*read_only=*/true,
-                 /*first_cluster=*/CLUSTER_INDEX_HTM,
-                 /*size=*/strlen(uf2_config.index_htm));
-      fill_entry(&root_entry[2], "STATUS  TXT",
-                 /*read_only=*/true,
-                 /*first_cluster=*/CLUSTER_STATUS_TXT,
-                 /*size=*/strlen(status_txt));
-      fill_entry(&root_entry[3], "CURRENT UF2",
-                 /*read_only=*/false,
-                 /*first_cluster=*/CLUSTER_CURRENT_UF2,
-                 /*size=*/FIRMWARE_SIZE * 2);
-    }
+    xmemcpy(data, (__xdata void *)root_cache, sizeof(root_cache));
+    xmemclr(data + sizeof(root_cache), BYTES_PER_SECTOR - sizeof(root_cache));
 
     return true;
   }
@@ -198,15 +256,13 @@ bool uf2_fat_read(uint32_t lba, __xdata uint8_t *data) {
     // Compiler bug?
 
     if(cluster == CLUSTER_INFO_UF2_TXT) {
-      xmemcpy(data, (__xdata void *)uf2_config.info_uf2_txt,
-              strlen(uf2_config.info_uf2_txt));
+      xmemcpy(data, (__xdata void *)uf2_config.info_uf2_txt, info_uf2_txt_size);
     } else if(cluster == CLUSTER_INDEX_HTM) {
-      xmemcpy(data, (__xdata void *)uf2_config.index_htm,
-              strlen(uf2_config.index_htm));
+      xmemcpy(data, (__xdata void *)uf2_config.index_htm, index_htm_size);
     } else if(cluster == CLUSTER_STATUS_TXT) {
       fill_status(data);
     } else if(cluster >= CLUSTER_CURRENT_UF2 &&
-              cluster < CLUSTER_CURRENT_UF2 + FIRMWARE_SECTORS) {
+              cluster < CLUSTER_CURRENT_UF2 + firmware_sectors) {
       __xdata struct uf2_block *block = (__xdata struct uf2_block *)data;
       xmemclr(data, BYTES_PER_SECTOR);
 
@@ -234,6 +290,66 @@ bool uf2_fat_read(uint32_t lba, __xdata uint8_t *data) {
   return false;
 }
 
+// The contents of the storage are read back in small chunks, since there is not enough RAM
+// to hold a whole page for large page sizes. A UF2 payload is at most 256 bytes long, so with
+// the smallest page size of 8 bytes it spans at most 32 pages, one per bit of the mask.
+#define COMPARE_CHUNK_SIZE 32
+
+static __xdata uint8_t compare_buffer[COMPARE_CHUNK_SIZE];
+
+static bool firmware_write_changed(uint32_t address, __xdata uint8_t *data, uint16_t length) {
+  uint16_t page_size = uf2_config.firmware_page_size;
+  uint8_t  page_shift, page_count, page, first_dirty;
+  uint16_t offset, index;
+  uint32_t dirty = 0;
+
+  if(page_size < 8 || page_size > 256 || (page_size & (page_size - 1)) ||
+     length == 0 || length > 256 ||
+     ((uint16_t)address & (page_size - 1)) || (length & (page_size - 1)))
+    return uf2_config.firmware_write(address, data, length);
+
+  for(page_shift = 3; (1 << page_shift) != page_size; page_shift++);
+  page_count = length >> page_shift;
+
+  for(offset = 0; offset < length; offset += COMPARE_CHUNK_SIZE) {
+    uint16_t chunk = length - offset;
+    if(chunk > COMPARE_CHUNK_SIZE)
+      chunk = COMPARE_CHUNK_SIZE;
+
+    // If the storage cannot be read back, assume everything differs.
+    if(!uf2_config.firmware_read(address + offset, compare_buffer, chunk)) {
+      dirty = 0xffffffff;
+      break;
+    }
+
+    for(index = 0; index < chunk; index++) {
+      if(compare_buffer[index] != data[offset + index])
+        dirty |= (uint32_t)1 << ((offset + index) >> page_shift);
+    }
+  }
+
+  for(page = 0; page < page_count; ) {
+    if(!(dirty & ((uint32_t)1 << page))) {
+      stat_skipped++;
+      page++;
+      continue;
+    }
+
+    first_dirty = page;
+    while(page < page_count && (dirty & ((uint32_t)1 << page))) {
+      stat_written++;
+      page++;
+    }
+
+    offset = (uint16_t)first_dirty << page_shift;
+    if(!uf2_config.firmware_write(address + offset, data + offset,
+                                  (uint16_t)(page - first_dirty) << page_shift))
+      return false;
+  }
+
+  return true;
+}
+
 bool uf2_fat_write(uint32_t lba, __xdata const uint8_t *data) {
   if(lba >= DATA_OFFSET && lba < DATA_OFFSET + DATA_SECTORS) {
     __xdata const struct uf2_block *block = (__xdata struct uf2_block *)data;
@@ -252,8 +368,8 @@ bool uf2_fat_write(uint32_t lba, __xdata const uint8_t *data) {
 
     stat_accepted++;
 
-    if(uf2_config.firmware_write(block->target_addr, (__xdata uint8_t *)&block->data,
-                                 block->payload_size)) {
+    if(firmware_write_changed(block->target_addr, (__xdata uint8_t *)&block->data,
+                              block->payload_size)) {
       stat_flashed++;
     } else {
       stat_failed++;
@@ -264,3 +380,47 @@ bool uf2_fat_write(uint32_t lba, __xdata const uint8_t *data) {
   stat_ignored++;
   return true;
 }
+
+// When built as the fx2uf2_direct library, the block device functions are the direct
+// scsi_blockdev_* callbacks of the fx2usbmassstor_direct library.
+#ifdef FX2_DIRECT_CALLS
+#define BLOCKDEV_FN(name) bool scsi_blockdev_##name
+#define REENTRANT
+#else
+#define BLOCKDEV_FN(name) static bool uf2_blockdev_##name
+#define REENTRANT         __reentrant
+#endif
+
+BLOCKDEV_FN(read)(uint32_t lba, __xdata uint8_t *data, uint16_t count) REENTRANT {
+  while(count--) {
+    if(!uf2_fat_read(lba++, data))
+      return false;
+    data += BYTES_PER_SECTOR;
+  }
+  return true;
+}
+
+BLOCKDEV_FN(write)(uint32_t lba, __xdata const uint8_t *data, uint16_t count) REENTRANT {
+  while(count--) {
+    if(!uf2_fat_write(lba++, data))
+      return false;
+    data += BYTES_PER_SECTOR;
+  }
+  return true;
+}
+
+#ifdef FX2_DIRECT_CALLS
+bool scsi_blockdev_flush(void) {
+  // Every sector is written to the firmware storage as it arrives.
+  return true;
+}
+
+// The sector count is filled in from uf2_config by usb_mass_storage_bbb_command.
+blockdev_t uf2_blockdev;
+#else
+// The sector count is filled in from uf2_config by uf2_scsi_command.
+blockdev_t uf2_blockdev = {
+  .read   = uf2_blockdev_read,
+  .write  = uf2_blockdev_write,
+};
+#endif
@@ -7,10 +7,15 @@
 bool usb_self_powered;
 bool usb_remote_wakeup;
 uint8_t usb_config_value;
+__xdata uint8_t usb_alt_settings[USB_MAX_INTERFACES];
 
 void usb_init(bool disconnect) {
+  uint8_t interface;
+
   usb_remote_wakeup = false;
   usb_config_value = 0;
+  for(interface = 0; interface < USB_MAX_INTERFACES; interface++)
+    usb_alt_settings[interface] = 0;
 
   ENABLE_USB_AUTOVEC();
   USBIE  |= _SUDAV;
@@ -251,7 +256,8 @@ void usb_reset_data_toggles(usb_descriptor_set_c *set, uint8_t interface_num,
 
     do {
       if(config_item->generic->bDescriptorType == USB_DESC_INTERFACE) {
-        use_interface = (config_item->interface->bInterfaceNumber == interface_num &&
+        use_interface = (interface_num == 0xff && alt_setting == 0xff) ||
+                        (config_item->interface->bInterfaceNumber == interface_num &&
                          config_item->interface->bAlternateSetting == alt_setting);
       } else if(config_item->generic->bDescriptorType == USB_DESC_ENDPOINT) {
         if(!use_interface) continue;
@@ -263,3 +269,35 @@ void usb_reset_data_toggles(usb_descriptor_set_c *set, uint8_t interface_num,
     } while((++config_item)->generic);
   }
 }
+
+bool usb_find_configuration(usb_descriptor_set_c *set, uint8_t config_value) {
+  uint8_t nconfig;
+  if(config_value == 0)
+    return true;
+
+  for(nconfig = 0; nconfig < set->config_count; nconfig++) {
+    if(set->configs[nconfig]->desc.bConfigurationValue == config_value)
+      return true;
+  }
+  return false;
+}
+
+bool usb_find_interface(usb_descriptor_set_c *set, uint8_t interface_num, uint8_t alt_setting) {
+  uint8_t nconfig;
+  for(nconfig = 0; nconfig < set->config_count; nconfig++) {
+    usb_configuration_c *config = set->configs[nconfig];
+    __code const union usb_config_item *config_item = &config->items[0];
+
+    if(config->desc.bConfigurationValue != usb_config_value)
+      continue;
+
+    do {
+      if(config_item->generic->bDescriptorType == USB_DESC_INTERFACE &&
+         config_item->interface->bInterfaceNumber == interface_num &&
+         (alt_setting == 0xff ||
+          config_item->interface->bAlternateSetting == alt_setting))
+        return true;
+    } while((++config_item)->generic);
+  }
+  return false;
+}
@@ -0,0 +1,216 @@
+#include <fx2lib.h>
+#include <fx2delay.h>
+#include <fx2usbaudio.h>
+
+#pragma save
+#pragma nooverlay
+static void put_rate(__xdata uint8_t *data, uint32_t rate, uint8_t length) {
+  while(length--) {
+    *data++ = rate;
+    rate >>= 8;
+  }
+}
+
+static bool setup_uac1(usb_audio_state_t *audio, __xdata struct usb_req_setup *req) {
+  if((req->bmRequestType & (USB_TYPE_MASK|USB_RECIP_MASK)) != (USB_TYPE_CLASS|USB_RECIP_ENDPT))
+    return false;
+  if((req->wIndex & 0xff) != audio->data_endpoint)
+    return false;
+
+  if((req->wValue >> 8) != USB_AUDIO_EP_SAMPLING_FREQ_CONTROL || req->wLength != 3) {
+    STALL_EP0();
+    return true;
+  }
+
+  if(req->bmRequestType & USB_DIR_IN) {
+    uint32_t rate;
+    if(req->bRequest == USB_AUDIO_REQ_GET_CUR) {
+      rate = audio->sample_rate;
+    } else if(req->bRequest == USB_AUDIO_REQ_GET_MIN) {
+      rate = audio->sample_rates[0];
+    } else if(req->bRequest == USB_AUDIO_REQ_GET_MAX) {
+      rate = audio->sample_rates[audio->sample_rate_count - 1];
+    } else {
+      STALL_EP0();
+      return true;
+    }
+    put_rate(EP0BUF, rate, 3);
+    SETUP_EP0_IN_BUF(3);
+  } else if(req->bRequest == USB_AUDIO_REQ_SET_CUR && !audio->pending) {
+    audio->pending = true;
+    SETUP_EP0_OUT_BUF();
+  } else {
+    STALL_EP0();
+  }
+  return true;
+}
+
+static bool setup_uac2(usb_audio_state_t *audio, __xdata struct usb_req_setup *req) {
+  if((req->bmRequestType & (USB_TYPE_MASK|USB_RECIP_MASK)) != (USB_TYPE_CLASS|USB_RECIP_IFACE))
+    return false;
+  if(req->wIndex != ((audio->clock_id << 8) | audio->control_interface))
+    return false;
+
+  if((req->wValue >> 8) == USB_AUDIO2_CS_SAM_FREQ_CONTROL) {
+    if(req->bmRequestType & USB_DIR_IN) {
+      if(req->bRequest == USB_AUDIO2_REQ_CUR && req->wLength == 4) {
+        put_rate(EP0BUF, audio->sample_rate, 4);
+        SETUP_EP0_IN_BUF(4);
+        return true;
+      } else if(req->bRequest == USB_AUDIO2_REQ_RANGE && req->wLength >= 2) {
+        // Layout 2 parameter block: wNumSubRanges, then a (dMIN, dMAX, dRES) triple for every
+        // subrange. Each discrete sampling frequency is a subrange of its own.
+        __xdata uint8_t *data = scratch;
+        uint16_t length = 2 + 12 * audio->sample_rate_count;
+        uint8_t index;
+
+        *data++ = audio->sample_rate_count;
+        *data++ = 0;
+        for(index = 0; index < audio->sample_rate_count; index++) {
+          put_rate(data,     audio->sample_rates[index], 4);
+          put_rate(data + 4, audio->sample_rates[index], 4);
+          put_rate(data + 8, 0, 4);
+          data += 12;
+        }
+
+        if(length > req->wLength)
+          length = req->wLength;
+        SETUP_EP0_IN_DATA(scratch, length);
+        return true;
+      }
+    } else if(req->bRequest == USB_AUDIO2_REQ_CUR && req->wLength == 4 && !audio->pending) {
+      audio->pending = true;
+      SETUP_EP0_OUT_BUF();
+      return true;
+    }
+  } else if((req->wValue >> 8) == USB_AUDIO2_CS_CLOCK_VALID_CONTROL) {
+    if((req->bmRequestType & USB_DIR_IN) && req->bRequest == USB_AUDIO2_REQ_CUR &&
+       req->wLength == 1) {
+      EP0BUF[0] = 1;
+      SETUP_EP0_IN_BUF(1);
+      return true;
+    }
+  }
+
+  STALL_EP0();
+  return true;
+}
+
+bool usb_audio_setup(usb_audio_state_t *audio, __xdata struct usb_req_setup *req) {
+  if(audio->version == USB_IFACE_PROTOCOL_AUDIO_2_0)
+    return setup_uac2(audio, req);
+  else
+    return setup_uac1(audio, req);
+}
+#pragma restore
+
+void usb_audio_setup_deferred(usb_audio_state_t *audio) {
+  uint32_t rate;
+  uint8_t index;
+
+  if(!audio->pending)
+    return;
+
+  // Don't wait for the data stage; we will be called again from the main loop.
+  if(EP0CS & _BUSY)
+    return;
+
+  rate = ((uint32_t)EP0BUF[2] << 16) | ((uint16_t)EP0BUF[1] << 8) | EP0BUF[0];
+  if(audio->version == USB_IFACE_PROTOCOL_AUDIO_2_0)
+    rate |= (uint32_t)EP0BUF[3] << 24;
+
+  for(index = 0; index < audio->sample_rate_count; index++) {
+    if(audio->sample_rates[index] == rate)
+      break;
+  }
+
+  if(index < audio->sample_rate_count &&
+     (!audio->set_sample_rate || audio->set_sample_rate(rate))) {
+    audio->sample_rate = rate;
+    ACK_EP0();
+  } else {
+    STALL_EP0();
+  }
+
+  audio->pending = false;
+}
+
+#pragma save
+#pragma nooverlay
+void usb_audio_sof(usb_audio_state_t *audio, uint16_t sample_count) {
+  bool high_speed = USBCS & _HSM;
+  __xdata uint8_t *buffer;
+  uint16_t stamp;
+
+  stamp = ((USBFRAMEH << 8) | USBFRAMEL) & 0x7ff;
+  if(high_speed)
+    stamp = (stamp << 3) | (MICROFRAME & 0x7);
+
+  if((stamp & 0x3f) == 0) {
+    // A period is exactly 64 frames or microframes long, so no division is necessary.
+    uint16_t elapsed = (stamp - audio->last_stamp) & (high_speed ? 0x3fff : 0x7ff);
+    if(elapsed == 64) {
+      uint16_t samples = sample_count - audio->last_count;
+      if(high_speed)
+        audio->feedback = (uint32_t)samples << 10; // 16.16 samples per microframe
+      else
+        audio->feedback = (uint32_t)samples << 8;  // 10.14 samples per frame
+    }
+    audio->last_stamp = stamp;
+    audio->last_count = sample_count;
+  }
+
+  switch(audio->feedback_endpoint) {
+    case 0x82: if(EP2CS & _FULL) return; buffer = EP2FIFOBUF; break;
+    case 0x84: if(EP4CS & _FULL) return; buffer = EP4FIFOBUF; break;
+    case 0x86: if(EP6CS & _FULL) return; buffer = EP6FIFOBUF; break;
+    case 0x88: if(EP8CS & _FULL) return; buffer = EP8FIFOBUF; break;
+    default: return;
+  }
+
+  put_rate(buffer, audio->feedback, high_speed ? 4 : 3);
+  switch(audio->feedback_endpoint) {
+    case 0x82: EP2BCH = 0; SYNCDELAY; EP2BCL = high_speed ? 4 : 3; break;
+    case 0x84: EP4BCH = 0; SYNCDELAY; EP4BCL = high_speed ? 4 : 3; break;
+    case 0x86: EP6BCH = 0; SYNCDELAY; EP6BCL = high_speed ? 4 : 3; break;
+    case 0x88: EP8BCH = 0; SYNCDELAY; EP8BCL = high_speed ? 4 : 3; break;
+  }
+}
+#pragma restore
+
+#define CONFIGURE_FIFO(ep) \
+  do { \
+    EP##ep##CFG = _VALID|_DIR|_TYPE0|_BUF1|(packet_size > 512 ? _SIZE : 0); \
+    SYNCDELAY; \
+    EP##ep##FIFOCFG = 0; \
+    SYNCDELAY; \
+    FIFORESET = _NAKALL|ep; \
+    SYNCDELAY; \
+    EP##ep##AUTOINLENH = packet_size >> 8; \
+    SYNCDELAY; \
+    EP##ep##AUTOINLENL = packet_size & 0xff; \
+    SYNCDELAY; \
+    EP##ep##ISOINPKTS = packets; \
+    SYNCDELAY; \
+    EP##ep##FIFOCFG = _AUTOIN|_ZEROLENIN|(word_wide ? _WORDWIDE : 0); \
+    SYNCDELAY; \
+  } while(0)
+
+void usb_audio_configure_fifo(uint8_t endpoint, uint16_t packet_size, uint8_t packets,
+                              bool word_wide) {
+  REVCTL = _ENH_PKT|_DYN_OUT;
+  SYNCDELAY;
+  FIFORESET = _NAKALL;
+  SYNCDELAY;
+
+  switch(endpoint) {
+    case 0x82: CONFIGURE_FIFO(2); break;
+    case 0x84: CONFIGURE_FIFO(4); break;
+    case 0x86: CONFIGURE_FIFO(6); break;
+    case 0x88: CONFIGURE_FIFO(8); break;
+  }
+
+  FIFORESET = 0;
+  SYNCDELAY;
+}
+#undef CONFIGURE_FIFO
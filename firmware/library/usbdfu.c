@@ -6,6 +6,19 @@
 
 __xdata uint8_t scratch2[512];
 
+static void start_dnload(usb_dfu_iface_state_t *dfu) {
+  dfu->busy_buffer = dfu->receive_buffer;
+  dfu->busy_length = dfu->length;
+  dfu->busy        = true;
+  if(dfu->dnload_buffer) {
+    // Receive the next block into the other buffer while this one is being written.
+    dfu->receive_buffer = (dfu->receive_buffer == scratch2) ? dfu->dnload_buffer : scratch2;
+    dfu->state = USB_DFU_STATE_dfuDNLOAD_IDLE;
+  } else {
+    dfu->state = USB_DFU_STATE_dfuDNBUSY;
+  }
+}
+
 bool usb_dfu_setup(usb_dfu_iface_state_t *dfu, __xdata struct usb_req_setup *req) {
   uint8_t interface = dfu->state > USB_DFU_STATE_appDETACH ? 0 : dfu->interface;
 
@@ -35,10 +48,10 @@ bool usb_dfu_setup(usb_dfu_iface_state_t *dfu, __xdata struct usb_req_setup *req
       req->wLength == sizeof(struct usb_dfu_req_get_status)) {
     __xdata struct usb_dfu_req_get_status *status =
       (__xdata struct usb_dfu_req_get_status *)EP0BUF;
+    uint16_t poll_timeout;
 
-    if((dfu->state == USB_DFU_STATE_dfuDNLOAD_SYNC ||
-        dfu->state == USB_DFU_STATE_dfuMANIFEST_SYNC) &&
-       !dfu->sync) {
+    if((dfu->state == USB_DFU_STATE_dfuDNLOAD_SYNC && !dfu->stashed) ||
+       (dfu->state == USB_DFU_STATE_dfuMANIFEST_SYNC && !dfu->sync)) {
       // If we're here, then EP0BUF is still in use, but the host already sent GETSTATUS.
       // If we do SETUP_EP0_* right now, we'll overwrite EP0BUF, and get corrupted data.
       // So, delay responding to this packet until after EP0BUF is copied a second scratch
@@ -50,14 +63,31 @@ bool usb_dfu_setup(usb_dfu_iface_state_t *dfu, __xdata struct usb_req_setup *req
       dfu->sync = true;
       return true;
     } else if(dfu->state == USB_DFU_STATE_dfuDNLOAD_SYNC) {
-      dfu->state = USB_DFU_STATE_dfuDNBUSY;
+      // The block has been stashed away, and is written by usb_dfu_setup_deferred. If
+      // the previous block is still being written, this one waits for it in dfuDNBUSY.
+      dfu->pending = false;
+      if(dfu->busy) {
+        dfu->state = USB_DFU_STATE_dfuDNBUSY;
+      } else {
+        start_dnload(dfu);
+      }
     } else if(dfu->state == USB_DFU_STATE_dfuMANIFEST_SYNC) {
       dfu->state = USB_DFU_STATE_dfuMANIFEST;
     }
 
+    if(dfu->state == USB_DFU_STATE_dfuDNBUSY) {
+      // Ask the host to wait for as long as writing the previous block took, or 10 ms before
+      // the first block has been written.
+      poll_timeout = dfu->poll_timeout ? dfu->poll_timeout : 10;
+    } else if(dfu->state == USB_DFU_STATE_dfuDNLOAD_IDLE) {
+      // The next block can be sent right away.
+      poll_timeout = 0;
+    } else {
+      poll_timeout = 10;
+    }
     status->bStatus = dfu->status;
-    status->bwPollTimeout = 10;
-    status->bwPollTimeoutHigh = 0;
+    status->bwPollTimeout = poll_timeout & 0xff;
+    status->bwPollTimeoutHigh = poll_timeout >> 8;
     status->bState = dfu->state;
     status->iString = 0;
     SETUP_EP0_IN_BUF(sizeof(struct usb_dfu_req_get_status));
@@ -75,36 +105,48 @@ bool usb_dfu_setup(usb_dfu_iface_state_t *dfu, __xdata struct usb_req_setup *req
       return true;
     }
 
+    // Blocks are transferred through scratch2 in as many EP0 packets as necessary.
     if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_IN &&
-        req->bRequest == USB_DFU_REQ_UPLOAD) {
+        req->bRequest == USB_DFU_REQ_UPLOAD &&
+        req->wLength <= sizeof(scratch2)) {
       if(dfu->state == USB_DFU_STATE_dfuIDLE) {
         dfu->state    = USB_DFU_STATE_dfuUPLOAD_IDLE;
         dfu->offset   = 0;
         dfu->length   = req->wLength;
         dfu->pending  = true;
+        dfu->stashed  = false;
         return true;
       } else if(dfu->state == USB_DFU_STATE_dfuUPLOAD_IDLE) {
         dfu->length   = req->wLength;
         dfu->pending  = true;
+        dfu->stashed  = false;
         return true;
       }
     }
 
     if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_OUT &&
-        req->bRequest == USB_DFU_REQ_DNLOAD) {
-      if(dfu->state == USB_DFU_STATE_dfuIDLE) {
+        req->bRequest == USB_DFU_REQ_DNLOAD &&
+        req->wLength <= sizeof(scratch2)) {
+      // A new session cannot start until the last block of an aborted one has been written.
+      if(dfu->state == USB_DFU_STATE_dfuIDLE && !dfu->busy) {
         dfu->state    = USB_DFU_STATE_dfuDNLOAD_SYNC;
         dfu->offset   = 0;
         dfu->length   = req->wLength;
+        dfu->transferred = 0;
         dfu->pending  = true;
         dfu->sync     = false;
+        dfu->stashed  = false;
+        dfu->poll_timeout   = 0;
+        dfu->receive_buffer = scratch2;
         SETUP_EP0_OUT_BUF();
         return true;
       } else if(dfu->state == USB_DFU_STATE_dfuDNLOAD_IDLE && req->wLength > 0) {
         dfu->state    = USB_DFU_STATE_dfuDNLOAD_SYNC;
         dfu->length   = req->wLength;
+        dfu->transferred = 0;
         dfu->pending  = true;
         dfu->sync     = false;
+        dfu->stashed  = false;
         SETUP_EP0_OUT_BUF();
         return true;
       } else if(dfu->state == USB_DFU_STATE_dfuDNLOAD_IDLE) {
@@ -124,28 +166,105 @@ bool usb_dfu_setup(usb_dfu_iface_state_t *dfu, __xdata struct usb_req_setup *req
          dfu->state == USB_DFU_STATE_dfuDNLOAD_IDLE ||
          dfu->state == USB_DFU_STATE_dfuMANIFEST_SYNC ||
          dfu->state == USB_DFU_STATE_dfuUPLOAD_IDLE) {
-        dfu->state = USB_DFU_STATE_dfuIDLE;
+        // The deferred handler may still be waiting for the host to finish a transfer.
+        dfu->state   = USB_DFU_STATE_dfuIDLE;
+        dfu->pending = false;
         ACK_EP0();
         return true;
       }
     }
   }
 
-  dfu->status = USB_DFU_STATUS_errSTALLEDPKT;
+  // If writing a block failed after the host was told it was downloaded, the host learns about
+  // that only when its next request, usually DNLOAD, is stalled; keep the original status.
+  if(dfu->state != USB_DFU_STATE_dfuERROR)
+    dfu->status = USB_DFU_STATUS_errSTALLEDPKT;
   dfu->state  = USB_DFU_STATE_dfuERROR;
   STALL_EP0();
   return true;
 }
+
+void usb_dfu_ep0out(usb_dfu_iface_state_t *dfu) {
+  uint8_t chunk, index;
+
+  if(dfu->state != USB_DFU_STATE_dfuDNLOAD_SYNC || dfu->stashed)
+    return;
+
+  // xmemcpy uses the autopointers, which would corrupt a copy interrupted by this function.
+  chunk = EP0BCL;
+  if(chunk > dfu->length - dfu->transferred)
+    chunk = dfu->length - dfu->transferred;
+  for(index = 0; index < chunk; index++)
+    dfu->receive_buffer[dfu->transferred + index] = EP0BUF[index];
+  dfu->transferred += chunk;
+  if(dfu->transferred < dfu->length) {
+    // Receive the next packet of the block.
+    SETUP_EP0_OUT_BUF();
+    return;
+  }
+  dfu->stashed = true;
+  ACK_EP0();
+}
 #pragma restore
 
 void usb_dfu_setup_deferred(usb_dfu_iface_state_t *dfu) {
+  if(dfu->busy) {
+    // Write the stashed block. With a second buffer, the host is meanwhile sending the next
+    // block, which is received by usb_dfu_ep0out; otherwise, the host is polling the state
+    // of the interface, which remains dfuDNBUSY until the write finishes.
+    uint16_t frame = (USBFRAMEH << 8) | USBFRAMEL;
+    usb_dfu_status_t status =
+      dfu->firmware_dnload(dfu->offset, dfu->busy_buffer, dfu->busy_length);
+    dfu->poll_timeout = ((((USBFRAMEH << 8) | USBFRAMEL) - frame) & 0x7ff) + 1;
+    if(status != USB_DFU_STATUS_OK) {
+      dfu->status = status;
+      dfu->state  = USB_DFU_STATE_dfuERROR;
+      dfu->busy   = false;
+      if(dfu->pending) {
+        // A block that is still being received is rejected.
+        dfu->pending = false;
+        STALL_EP0();
+      }
+      return;
+    }
+    dfu->offset += dfu->busy_length;
+    // The interface may enter dfuDNBUSY from an interrupt until the busy flag is cleared, but
+    // not afterwards, so the flag is cleared first.
+    dfu->busy = false;
+    if(dfu->state == USB_DFU_STATE_dfuDNBUSY) {
+      if(dfu->dnload_buffer) {
+        // The next block has been received while this one was being written.
+        start_dnload(dfu);
+      } else {
+        dfu->state = USB_DFU_STATE_dfuDNLOAD_IDLE;
+      }
+    }
+  }
+
   if(dfu->pending) {
     if(dfu->state == USB_DFU_STATE_dfuUPLOAD_IDLE) {
-      uint16_t length = dfu->length;
-      dfu->status = dfu->firmware_upload(dfu->offset, &EP0BUF[0], &dfu->length);
+      if(!dfu->stashed) {
+        dfu->requested   = dfu->length;
+        dfu->transferred = 0;
+        dfu->status = dfu->firmware_upload(dfu->offset, scratch2, &dfu->length);
+        dfu->stashed = true;
+      }
       if(dfu->status == USB_DFU_STATUS_OK) {
-        SETUP_EP0_IN_BUF(dfu->length);
-        if(dfu->length < length) {
+        // Send the block one packet at a time. A block that is shorter than requested must be
+        // terminated with a short packet, which is a zero length packet if necessary.
+        uint16_t chunk;
+        if(EP0CS & _BUSY)
+          return;
+        chunk = dfu->length - dfu->transferred;
+        if(chunk > sizeof(EP0BUF))
+          chunk = sizeof(EP0BUF);
+        xmemcpy(EP0BUF, &scratch2[dfu->transferred], chunk);
+        SETUP_EP0_IN_BUF(chunk);
+        dfu->transferred += chunk;
+        if(chunk == sizeof(EP0BUF) && dfu->transferred < dfu->requested)
+          return;
+
+        if(dfu->length < dfu->requested) {
           dfu->state = USB_DFU_STATE_dfuIDLE;
         }
         dfu->offset += dfu->length;
@@ -153,25 +272,37 @@ void usb_dfu_setup_deferred(usb_dfu_iface_state_t *dfu) {
         return;
       }
     } else if(dfu->state == USB_DFU_STATE_dfuDNLOAD_SYNC) {
-      while(EP0CS & _BUSY);
-      xmemcpy(scratch2, &EP0BUF[0], dfu->length);
-      ACK_EP0();
+      // None of the steps below wait for the host; if the host is not done yet, return, and
+      // continue from the same step on the next call, so that the main loop keeps running.
+      // With a second buffer, the packets are received by usb_dfu_ep0out instead.
+      if(!dfu->stashed && !dfu->dnload_buffer) {
+        uint16_t chunk;
+        if(EP0CS & _BUSY)
+          return;
+        chunk = EP0BCL;
+        if(chunk > dfu->length - dfu->transferred)
+          chunk = dfu->length - dfu->transferred;
+        xmemcpy(&dfu->receive_buffer[dfu->transferred], &EP0BUF[0], chunk);
+        dfu->transferred += chunk;
+        if(dfu->transferred < dfu->length) {
+          // Receive the next packet of the block.
+          SETUP_EP0_OUT_BUF();
+          return;
+        }
+        dfu->stashed = true;
+        ACK_EP0();
+      }
 
-      // Wait until we get a GETSTATUS request (in case we still haven't got one), and then reply
-      // to it from here, after we've safely stashed away EP0BUF contents.
-      while(!dfu->sync);
+      // If we got a GETSTATUS request before the block was stashed away, reply to it from here,
+      // after we've safely stashed away EP0BUF contents. Otherwise, the reply is sent from
+      // the interrupt handler, which also clears the pending flag.
+      if(!dfu->stashed || !dfu->sync)
+        return;
       usb_dfu_setup(dfu, (__xdata struct usb_req_setup *)SETUPDAT);
       return;
-    } else if(dfu->state == USB_DFU_STATE_dfuDNBUSY) {
-      dfu->status = dfu->firmware_dnload(dfu->offset, scratch2, dfu->length);
-      if(dfu->status == USB_DFU_STATUS_OK) {
-        dfu->offset += dfu->length;
-        dfu->state = USB_DFU_STATE_dfuDNLOAD_IDLE;
-        dfu->pending = false;
-        return;
-      }
     } else if(dfu->state == USB_DFU_STATE_dfuMANIFEST_SYNC) {
-      while(!dfu->sync);
+      if(!dfu->sync)
+        return;
       usb_dfu_setup(dfu, (__xdata struct usb_req_setup *)SETUPDAT);
       return;
     } else if(dfu->state == USB_DFU_STATE_dfuMANIFEST) {
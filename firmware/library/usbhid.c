@@ -0,0 +1,181 @@
+#include <fx2lib.h>
+#include <fx2delay.h>
+#include <fx2usbhid.h>
+
+#pragma save
+#pragma nooverlay
+bool usb_hid_setup(usb_hid_iface_state_t *hid, __xdata struct usb_req_setup *req) {
+  if(req->wIndex != hid->interface)
+    return false;
+
+  if(req->bmRequestType == (USB_RECIP_IFACE|USB_TYPE_STANDARD|USB_DIR_IN) &&
+     req->bRequest == USB_REQ_GET_DESCRIPTOR) {
+    uint8_t  type   = req->wValue >> 8;
+    uint16_t length;
+
+    if(type == USB_DESC_HID && (req->wValue & 0xff) == 0) {
+      length = hid->hid_descriptor->bLength;
+      xmemcpy(scratch, (__xdata void *)hid->hid_descriptor, length);
+    } else if(type == USB_DESC_HID_REPORT && (req->wValue & 0xff) == 0) {
+      length = hid->hid_descriptor->wReportDescriptorLength;
+      xmemcpy(scratch, (__xdata void *)hid->report_descriptor, length);
+    } else {
+      STALL_EP0();
+      return true;
+    }
+
+    if(length > req->wLength)
+      length = req->wLength;
+    SETUP_EP0_IN_DATA(scratch, length);
+    return true;
+  }
+
+  if((req->bmRequestType & (USB_TYPE_MASK|USB_RECIP_MASK)) != (USB_TYPE_CLASS|USB_RECIP_IFACE))
+    return false;
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_IN &&
+     req->bRequest == USB_HID_REQ_GET_REPORT && req->wLength > 0 && !hid->pending) {
+    hid->request  = USB_HID_REQ_GET_REPORT;
+    hid->type     = req->wValue >> 8;
+    hid->id       = req->wValue & 0xff;
+    hid->length   = (req->wLength > 64) ? 64 : req->wLength;
+    hid->pending  = true;
+    return true;
+  }
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_OUT &&
+     req->bRequest == USB_HID_REQ_SET_REPORT && req->wLength > 0 && req->wLength <= 64 &&
+     !hid->pending) {
+    hid->request  = USB_HID_REQ_SET_REPORT;
+    hid->type     = req->wValue >> 8;
+    hid->id       = req->wValue & 0xff;
+    hid->length   = req->wLength;
+    hid->pending  = true;
+    SETUP_EP0_OUT_BUF();
+    return true;
+  }
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_OUT &&
+     req->bRequest == USB_HID_REQ_SET_IDLE && req->wLength == 0) {
+    // Only a single idle rate is maintained for all reports.
+    hid->idle_rate = req->wValue >> 8;
+    ACK_EP0();
+    return true;
+  }
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_IN &&
+     req->bRequest == USB_HID_REQ_GET_IDLE && req->wLength == 1) {
+    EP0BUF[0] = hid->idle_rate;
+    SETUP_EP0_IN_BUF(1);
+    return true;
+  }
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_OUT &&
+     req->bRequest == USB_HID_REQ_SET_PROTOCOL && req->wLength == 0 &&
+     req->wValue <= USB_HID_PROTOCOL_REPORT) {
+    hid->protocol = req->wValue;
+    ACK_EP0();
+    return true;
+  }
+
+  if((req->bmRequestType & USB_DIR_MASK) == USB_DIR_IN &&
+     req->bRequest == USB_HID_REQ_GET_PROTOCOL && req->wLength == 1) {
+    EP0BUF[0] = hid->protocol;
+    SETUP_EP0_IN_BUF(1);
+    return true;
+  }
+
+  STALL_EP0();
+  return true;
+}
+#pragma restore
+
+void usb_hid_setup_deferred(usb_hid_iface_state_t *hid) {
+  if(!hid->pending)
+    return;
+
+  if(hid->request == USB_HID_REQ_GET_REPORT) {
+    if(hid->get_report && hid->get_report(hid->type, hid->id, EP0BUF, &hid->length)) {
+      SETUP_EP0_IN_BUF(hid->length);
+    } else {
+      STALL_EP0();
+    }
+  } else if(hid->request == USB_HID_REQ_SET_REPORT) {
+    // Don't wait for the data stage; we will be called again from the main loop.
+    if(EP0CS & _BUSY)
+      return;
+
+    if(hid->set_report && hid->set_report(hid->type, hid->id, EP0BUF, hid->length)) {
+      ACK_EP0();
+    } else {
+      STALL_EP0();
+    }
+  }
+
+  hid->pending = false;
+}
+
+__xdata uint8_t *usb_hid_in_buffer(usb_hid_iface_state_t *hid) {
+  switch(hid->in_endpoint) {
+    case 0x81: return (EP1INCS & _BUSY) ? 0 : EP1INBUF;
+    case 0x82: return (EP2CS   & _FULL) ? 0 : EP2FIFOBUF;
+    case 0x84: return (EP4CS   & _FULL) ? 0 : EP4FIFOBUF;
+    case 0x86: return (EP6CS   & _FULL) ? 0 : EP6FIFOBUF;
+    case 0x88: return (EP8CS   & _FULL) ? 0 : EP8FIFOBUF;
+    default:   return 0;
+  }
+}
+
+void usb_hid_in_commit(usb_hid_iface_state_t *hid, uint16_t length) {
+  switch(hid->in_endpoint) {
+    case 0x81: EP1INBC = length; break;
+    case 0x82: EP2BCH = length >> 8; SYNCDELAY; EP2BCL = length; break;
+    case 0x84: EP4BCH = length >> 8; SYNCDELAY; EP4BCL = length; break;
+    case 0x86: EP6BCH = length >> 8; SYNCDELAY; EP6BCL = length; break;
+    case 0x88: EP8BCH = length >> 8; SYNCDELAY; EP8BCL = length; break;
+  }
+}
+
+bool usb_hid_out_deferred(usb_hid_iface_state_t *hid) {
+  __xdata uint8_t *data;
+  uint16_t length;
+  bool accepted;
+
+  switch(hid->out_endpoint) {
+    case 0x01:
+      if(EP1OUTCS & _BUSY) return true;
+      data = EP1OUTBUF; length = EP1OUTBC;
+      break;
+    case 0x02:
+      if(EP2CS & _EMPTY) return true;
+      data = EP2FIFOBUF; length = (EP2BCH << 8) | EP2BCL;
+      break;
+    case 0x04:
+      if(EP4CS & _EMPTY) return true;
+      data = EP4FIFOBUF; length = (EP4BCH << 8) | EP4BCL;
+      break;
+    case 0x06:
+      if(EP6CS & _EMPTY) return true;
+      data = EP6FIFOBUF; length = (EP6BCH << 8) | EP6BCL;
+      break;
+    case 0x08:
+      if(EP8CS & _EMPTY) return true;
+      data = EP8FIFOBUF; length = (EP8BCH << 8) | EP8BCL;
+      break;
+    default:
+      return true;
+  }
+
+  accepted = hid->set_report &&
+             hid->set_report(USB_HID_REPORT_OUTPUT, /*id=*/0, data, length);
+
+  switch(hid->out_endpoint) {
+    case 0x01: EP1OUTBC = 0; break;
+    case 0x02: EP2BCL   = 0; break;
+    case 0x04: EP4BCL   = 0; break;
+    case 0x06: EP6BCL   = 0; break;
+    case 0x08: EP8BCL   = 0; break;
+  }
+
+  return accepted;
+}
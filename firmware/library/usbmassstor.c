@@ -1,5 +1,17 @@
 #include <fx2usbmassstor.h>
 
+// When built as the fx2usbmassstor_direct library, the usb_mass_storage_bbb_* callbacks
+// are called directly rather than through the function pointers in the state.
+#ifdef FX2_DIRECT_CALLS
+#define COMMAND(state)  usb_mass_storage_bbb_command
+#define DATA_OUT(state) usb_mass_storage_bbb_data_out
+#define DATA_IN(state)  usb_mass_storage_bbb_data_in
+#else
+#define COMMAND(state)  (state)->command
+#define DATA_OUT(state) (state)->data_out
+#define DATA_IN(state)  (state)->data_in
+#endif
+
 #pragma save
 #pragma nooverlay
 bool usb_mass_storage_bbb_setup(usb_mass_storage_bbb_state_t *state,
@@ -48,7 +60,7 @@ bool usb_mass_storage_bbb_bulk_out(usb_mass_storage_bbb_state_t *state,
     if(cbw->bCBWLUN > state->max_lun)
       return false;
 
-    state->_success = state->command(cbw->bCBWLUN, cbw->CBWCB, cbw->bCBWCBLength);
+    state->_success = COMMAND(state)(cbw->bCBWLUN, cbw->CBWCB, cbw->bCBWCBLength);
 
     state->_tag = cbw->dCBWTag;
     state->_lun = cbw->bCBWLUN;
@@ -76,7 +88,7 @@ bool usb_mass_storage_bbb_bulk_out(usb_mass_storage_bbb_state_t *state,
   if(state->_state == USB_MASS_STORAGE_BBB_STATE_DATA_OUT ||
      state->_state == USB_MASS_STORAGE_BBB_STATE_FAIL_OUT) {
     if(state->_state == USB_MASS_STORAGE_BBB_STATE_DATA_OUT) {
-      if(!state->data_out(state->_lun, data, length)) {
+      if(!DATA_OUT(state)(state->_lun, data, length)) {
         state->_residue = state->_data_length;
         state->_success = false;
         state->_state   = USB_MASS_STORAGE_BBB_STATE_FAIL_OUT;
@@ -100,7 +112,7 @@ bool usb_mass_storage_bbb_bulk_in(usb_mass_storage_bbb_state_t *state,
     *length = (state->_data_length > state->max_in_size)
               ? state->max_in_size : state->_data_length;
     if(state->_state == USB_MASS_STORAGE_BBB_STATE_DATA_IN) {
-      if(!state->data_in(state->_lun, data, *length)) {
+      if(!DATA_IN(state)(state->_lun, data, *length)) {
         state->_residue = state->_data_length;
         state->_success = false;
         state->_state   = USB_MASS_STORAGE_BBB_STATE_FAIL_IN;
@@ -127,3 +139,9 @@ bool usb_mass_storage_bbb_bulk_in(usb_mass_storage_bbb_state_t *state,
 
   return false;
 }
+
+bool usb_mass_storage_bbb_bulk_in_ready(usb_mass_storage_bbb_state_t *state) {
+  return state->_state == USB_MASS_STORAGE_BBB_STATE_DATA_IN ||
+         state->_state == USB_MASS_STORAGE_BBB_STATE_FAIL_IN ||
+         state->_state == USB_MASS_STORAGE_BBB_STATE_STATUS;
+}
@@ -0,0 +1,31 @@
+#include <fx2usb.h>
+
+#pragma save
+#pragma nooverlay
+bool usb_route_setup(usb_setup_handler_set_c *set, __xdata struct usb_req_setup *req) {
+  uint8_t index = req->wIndex & 0xff;
+  usb_setup_handler_t handler;
+
+  switch(req->bmRequestType & USB_RECIP_MASK) {
+    case USB_RECIP_IFACE:
+      if(index >= set->interface_count)
+        return false;
+      handler = set->interfaces[index];
+      break;
+
+    case USB_RECIP_ENDPT:
+      index &= 0x0f;
+      if(index >= set->endpoint_count)
+        return false;
+      handler = set->endpoints[index];
+      break;
+
+    default:
+      return false;
+  }
+
+  if(!handler)
+    return false;
+  return handler(req);
+}
+#pragma restore
@@ -0,0 +1,176 @@
+#include <fx2lib.h>
+#include <fx2delay.h>
+#include <fx2usbvideo.h>
+
+#define PROBE_COMMIT_LENGTH sizeof(struct usb_video_probe_commit)
+
+#pragma save
+#pragma nooverlay
+bool usb_video_setup(usb_video_state_t *video, __xdata struct usb_req_setup *req) {
+  uint8_t selector = req->wValue >> 8;
+  uint16_t length;
+
+  if((req->bmRequestType & (USB_TYPE_MASK|USB_RECIP_MASK)) != (USB_TYPE_CLASS|USB_RECIP_IFACE) ||
+     req->wIndex != video->interface)
+    return false;
+
+  if(selector != USB_VIDEO_VS_PROBE_CONTROL && selector != USB_VIDEO_VS_COMMIT_CONTROL) {
+    STALL_EP0();
+    return true;
+  }
+
+  if(req->bmRequestType & USB_DIR_IN) {
+    length = PROBE_COMMIT_LENGTH;
+    switch(req->bRequest) {
+      case USB_VIDEO_REQ_GET_INFO:
+        EP0BUF[0] = USB_VIDEO_INFO_SUPPORTS_GET|USB_VIDEO_INFO_SUPPORTS_SET;
+        length = 1;
+        break;
+
+      case USB_VIDEO_REQ_GET_LEN:
+        EP0BUF[0] = PROBE_COMMIT_LENGTH;
+        EP0BUF[1] = 0;
+        length = 2;
+        break;
+
+      case USB_VIDEO_REQ_GET_CUR:
+        if(selector == USB_VIDEO_VS_PROBE_CONTROL)
+          xmemcpy(EP0BUF, (__xdata void *)&video->probe, PROBE_COMMIT_LENGTH);
+        else
+          xmemcpy(EP0BUF, (__xdata void *)&video->committed, PROBE_COMMIT_LENGTH);
+        break;
+
+      case USB_VIDEO_REQ_GET_MIN:
+      case USB_VIDEO_REQ_GET_MAX:
+      case USB_VIDEO_REQ_GET_DEF:
+        if(selector == USB_VIDEO_VS_PROBE_CONTROL) {
+          xmemcpy(EP0BUF, (__xdata void *)video->defaults, PROBE_COMMIT_LENGTH);
+          break;
+        }
+        // fallthrough
+
+      default:
+        STALL_EP0();
+        return true;
+    }
+
+    if(length > req->wLength)
+      length = req->wLength;
+    SETUP_EP0_IN_BUF(length);
+    return true;
+  }
+
+  if(req->bRequest == USB_VIDEO_REQ_SET_CUR && req->wLength <= 64 && !video->pending) {
+    video->selector = selector;
+    video->pending  = true;
+    SETUP_EP0_OUT_BUF();
+    return true;
+  }
+
+  STALL_EP0();
+  return true;
+}
+#pragma restore
+
+void usb_video_setup_deferred(usb_video_state_t *video) {
+  uint16_t length;
+
+  if(!video->pending)
+    return;
+
+  // Don't wait for the data stage; we will be called again from the main loop.
+  if(EP0CS & _BUSY)
+    return;
+
+  // USB Video Class 1.1 hosts may send a longer control; the extra fields are ignored.
+  length = EP0BCL;
+  if(length > PROBE_COMMIT_LENGTH)
+    length = PROBE_COMMIT_LENGTH;
+
+  if(video->selector == USB_VIDEO_VS_PROBE_CONTROL) {
+    xmemcpy((__xdata void *)&video->probe, EP0BUF, length);
+    if(!video->negotiate || video->negotiate(&video->probe)) {
+      ACK_EP0();
+    } else {
+      xmemcpy((__xdata void *)&video->probe, (__xdata void *)video->defaults,
+              PROBE_COMMIT_LENGTH);
+      STALL_EP0();
+    }
+  } else {
+    xmemcpy((__xdata void *)&video->committed, EP0BUF, length);
+    if(video->commit)
+      video->commit(&video->committed);
+    video->header_info = 0;
+    video->streaming = true;
+    ACK_EP0();
+  }
+
+  video->pending = false;
+}
+
+#pragma save
+#pragma nooverlay
+void usb_video_packet(usb_video_state_t *video, uint16_t length, bool end_of_frame) {
+  __xdata uint8_t *buffer;
+
+  switch(video->endpoint) {
+    case 0x82: buffer = EP2FIFOBUF; break;
+    case 0x84: buffer = EP4FIFOBUF; break;
+    case 0x86: buffer = EP6FIFOBUF; break;
+    case 0x88: buffer = EP8FIFOBUF; break;
+    default: return;
+  }
+
+  if(!video->streaming) {
+    INPKTEND = _SKIP|(video->endpoint & 0x0f);
+    return;
+  }
+
+  // Only the two header bytes are touched; the payload stays where GPIF or the slave FIFO
+  // has put it.
+  buffer[0] = USB_VIDEO_PAYLOAD_HEADER_LENGTH;
+  buffer[1] = USB_VIDEO_HEADER_EOH|video->header_info|(end_of_frame ? USB_VIDEO_HEADER_EOF : 0);
+
+  switch(video->endpoint) {
+    case 0x82: EP2BCH = length >> 8; SYNCDELAY; EP2BCL = length & 0xff; break;
+    case 0x84: EP4BCH = length >> 8; SYNCDELAY; EP4BCL = length & 0xff; break;
+    case 0x86: EP6BCH = length >> 8; SYNCDELAY; EP6BCL = length & 0xff; break;
+    case 0x88: EP8BCH = length >> 8; SYNCDELAY; EP8BCL = length & 0xff; break;
+  }
+
+  if(end_of_frame)
+    video->header_info ^= USB_VIDEO_HEADER_FID;
+}
+#pragma restore
+
+#define CONFIGURE_FIFO(ep) \
+  do { \
+    EP##ep##CFG = _VALID|_DIR|(isochronous ? _TYPE0 : _TYPE1)|_BUF1| \
+                  (packet_size > 512 ? _SIZE : 0); \
+    SYNCDELAY; \
+    EP##ep##FIFOCFG = 0; \
+    SYNCDELAY; \
+    FIFORESET = _NAKALL|ep; \
+    SYNCDELAY; \
+    EP##ep##FIFOCFG = word_wide ? _WORDWIDE : 0; \
+    SYNCDELAY; \
+  } while(0)
+
+void usb_video_configure_fifo(uint8_t endpoint, uint16_t packet_size, bool isochronous,
+                              bool word_wide) {
+  REVCTL = _ENH_PKT|_DYN_OUT;
+  SYNCDELAY;
+  FIFORESET = _NAKALL;
+  SYNCDELAY;
+
+  switch(endpoint) {
+    case 0x82: CONFIGURE_FIFO(2); break;
+    case 0x84: CONFIGURE_FIFO(4); break;
+    case 0x86: CONFIGURE_FIFO(6); break;
+    case 0x88: CONFIGURE_FIFO(8); break;
+  }
+
+  FIFORESET = 0;
+  SYNCDELAY;
+}
+#undef CONFIGURE_FIFO
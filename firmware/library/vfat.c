@@ -0,0 +1,213 @@
+#include <fx2lib.h>
+#include <fx2vfat.h>
+#include <fat.h>
+
+#define BYTES_PER_SECTOR  BLOCKDEV_SECTOR_SIZE
+#define SECTOR_SHIFT      9
+#define FAT_OFFSET        1
+#define ROOT_SECTORS      1
+#define ROOT_ENTRIES      (ROOT_SECTORS << 4)
+
+#define MIN_CLUSTERS      4085
+#define MAX_CLUSTERS      65524
+
+#define CLUSTER_FIRST     2
+#define CLUSTER_LAST      0xffff
+
+bool vfat_init(vfat_volume_t *volume) {
+  uint8_t  cluster_shift, index;
+  uint32_t cluster_count;
+  uint16_t next_cluster;
+
+  if(volume->file_count > VFAT_MAX_FILES)
+    return false;
+
+  for(cluster_shift = 0; cluster_shift <= 6; cluster_shift++) {
+    if(volume->sectors_per_cluster == (1 << cluster_shift))
+      break;
+  }
+  if(cluster_shift > 6)
+    return false;
+
+  // The size of the FAT depends on the number of clusters, which depends on the size of the FAT;
+  // sizing the FAT for the entire volume wastes at most one sector.
+  cluster_count = volume->total_sectors >> cluster_shift;
+  if(cluster_count > MAX_CLUSTERS)
+    return false;
+  volume->_fat_sectors   = (cluster_count + CLUSTER_FIRST + 255) >> 8;
+  volume->_root_offset   = FAT_OFFSET + volume->_fat_sectors;
+  volume->_data_offset   = volume->_root_offset + ROOT_SECTORS;
+  volume->_cluster_shift = cluster_shift;
+
+  cluster_count = (volume->total_sectors - volume->_data_offset) >> cluster_shift;
+  if(cluster_count < MIN_CLUSTERS)
+    return false;
+
+  // Every file is a single contiguous run of clusters, allocated in directory order.
+  next_cluster = CLUSTER_FIRST;
+  for(index = 0; index < volume->file_count; index++) {
+    vfat_file_t *file = &volume->files[index];
+    uint32_t clusters = (file->size + ((uint32_t)BYTES_PER_SECTOR << cluster_shift) - 1) >>
+                        (SECTOR_SHIFT + cluster_shift);
+
+    if(clusters == 0) {
+      file->_first_cluster = 0;
+      file->_last_cluster  = 0;
+      continue;
+    }
+
+    if(clusters > CLUSTER_FIRST + cluster_count - next_cluster)
+      return false;
+
+    file->_first_cluster = next_cluster;
+    file->_last_cluster  = next_cluster + (uint16_t)clusters - 1;
+    next_cluster += (uint16_t)clusters;
+  }
+
+  return true;
+}
+
+static void fill_boot(vfat_volume_t *volume, __xdata uint8_t *data) {
+  __xdata struct fat16_boot_sector *boot =
+    (__xdata struct fat16_boot_sector *)data;
+
+  xmemclr(data, BYTES_PER_SECTOR);
+  xmemcpy(boot->oem_name_version, (__xdata void *)"MSWIN4.1",     8);
+  boot->jump_to_bootstrap[0]  = 0xeb;
+  boot->jump_to_bootstrap[1]  = 0x3c;
+  boot->jump_to_bootstrap[2]  = 0x90;
+  boot->bytes_per_sector      = BYTES_PER_SECTOR;
+  boot->sectors_per_cluster   = volume->sectors_per_cluster;
+  boot->reserved_sectors      = FAT_OFFSET;
+  boot->fat_copies            = 1;
+  boot->root_entries          = ROOT_ENTRIES;
+  boot->media_descriptor      = 0xf8;
+  boot->sectors_per_fat       = volume->_fat_sectors;
+  boot->total_sectors         = volume->total_sectors;
+  boot->extended_signature    = 0x29;
+  xmemcpy(boot->volume_label,     (__xdata void *)volume->volume_label, 11);
+  xmemcpy(boot->filesystem_type,  (__xdata void *)"FAT16   ",           8);
+  boot->signature[0]          = 0x55;
+  boot->signature[1]          = 0xaa;
+}
+
+static void fill_fat(vfat_volume_t *volume, uint16_t sector, __xdata uint8_t *data) {
+  __xdata uint16_t *next_cluster = (__xdata uint16_t *)data;
+  uint16_t first = sector << 8;
+  uint16_t last  = first + 255;
+  uint8_t  index;
+
+  xmemclr(data, BYTES_PER_SECTOR);
+
+  // Each sector holds 256 entries. Since every file is a contiguous chain, the part of it that
+  // falls into this sector is found by intersecting two ranges.
+  for(index = 0; index < volume->file_count; index++) {
+    vfat_file_t *file = &volume->files[index];
+    uint16_t begin, end, count, value;
+    __xdata uint16_t *entry;
+
+    if(file->_first_cluster == 0 ||
+       file->_last_cluster < first || file->_first_cluster > last)
+      continue;
+
+    begin = (first > file->_first_cluster) ? first : file->_first_cluster;
+    end   = (last  < file->_last_cluster)  ? last  : file->_last_cluster;
+    count = end - begin + 1;
+    value = begin + 1;
+    entry = &next_cluster[begin - first];
+
+    while(count--)
+      *entry++ = value++;
+    if(end == file->_last_cluster)
+      next_cluster[end - first] = CLUSTER_LAST;
+  }
+
+  if(first == 0) {
+    next_cluster[0] = 0xfff8;
+    next_cluster[1] = CLUSTER_LAST;
+  }
+}
+
+static void fill_root(vfat_volume_t *volume, __xdata uint8_t *data) {
+  __xdata struct fat_directory_entry *entry =
+    (__xdata struct fat_directory_entry *)data;
+  uint8_t index;
+
+  xmemclr(data, BYTES_PER_SECTOR);
+
+  xmemcpy(entry->filename_ext, (__xdata void *)volume->volume_label, 11);
+  entry->volume_label = true;
+  entry++;
+
+  for(index = 0; index < volume->file_count; index++, entry++) {
+    vfat_file_t *file = &volume->files[index];
+
+    xmemcpy(entry->filename_ext, (__xdata void *)file->filename_ext, 11);
+    entry->read_only     = true;
+    entry->create.date   = FAT_DATE(2069, 4, 20);
+    entry->modify.date   = entry->create.date;
+    entry->first_cluster = file->_first_cluster;
+    entry->size          = file->size;
+  }
+}
+
+static bool fill_data(vfat_volume_t *volume, uint32_t sector, __xdata uint8_t *data) {
+  uint8_t  cluster_shift = volume->_cluster_shift;
+  uint16_t cluster = (uint16_t)(sector >> cluster_shift) + CLUSTER_FIRST;
+  uint16_t sector_offset =
+    ((uint16_t)sector & (volume->sectors_per_cluster - 1)) << SECTOR_SHIFT;
+  uint8_t  index;
+
+  for(index = 0; index < volume->file_count; index++) {
+    vfat_file_t *file = &volume->files[index];
+    uint32_t offset;
+    uint16_t length;
+
+    if(file->_first_cluster == 0 ||
+       cluster < file->_first_cluster || cluster > file->_last_cluster)
+      continue;
+
+    offset = ((uint32_t)(cluster - file->_first_cluster) << (SECTOR_SHIFT + cluster_shift)) +
+             sector_offset;
+    if(offset >= file->size) {
+      xmemclr(data, BYTES_PER_SECTOR);
+      return true;
+    }
+
+    length = BYTES_PER_SECTOR;
+    if(file->size - offset < BYTES_PER_SECTOR)
+      length = file->size - offset;
+    if(!file->read(offset, data, length))
+      return false;
+    if(length < BYTES_PER_SECTOR)
+      xmemclr(data + length, BYTES_PER_SECTOR - length);
+    return true;
+  }
+
+  // Just return some garbage, to make things faster. It's not allocated anyway,
+  // so it should not matter what we return here.
+  return true;
+}
+
+bool vfat_read(vfat_volume_t *volume, uint32_t lba, __xdata uint8_t *data, uint16_t count) {
+  while(count--) {
+    if(lba >= volume->total_sectors)
+      return false;
+
+    if(lba < FAT_OFFSET) {
+      fill_boot(volume, data);
+    } else if(lba < volume->_root_offset) {
+      fill_fat(volume, (uint16_t)lba - FAT_OFFSET, data);
+    } else if(lba < volume->_data_offset) {
+      fill_root(volume, data);
+    } else {
+      if(!fill_data(volume, lba - volume->_data_offset, data))
+        return false;
+    }
+
+    lba++;
+    data += BYTES_PER_SECTOR;
+  }
+
+  return true;
+}
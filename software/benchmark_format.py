@@ -0,0 +1,45 @@
+# Measures the speed of the Intel HEX writer and reader of fx2.format on a multi-megabyte image.
+#
+# Usage: python benchmark_format.py [MEGABYTES]
+#
+# The image consists of MEGABYTES (4 by default) of random data at address 0, followed by
+# a 1000-byte chunk at the next bank boundary. To compare two versions of fx2.format, copy
+# this script out of the source tree (so that the fx2 package next to it is not imported first),
+# and run it with PYTHONPATH pointing at each of them.
+
+import io
+import os
+import sys
+import time
+from fx2.format import input_data, output_data
+
+
+def measure(fn, repeat=3):
+    best = None
+    for _ in range(repeat):
+        started = time.perf_counter()
+        result  = fn()
+        elapsed = time.perf_counter() - started
+        best    = elapsed if best is None else min(best, elapsed)
+    return best, result
+
+
+size = int(float(sys.argv[1]) * 1048576) if len(sys.argv) > 1 else 4 * 1048576
+data = [(0, os.urandom(size)), ((size + 0xffff) & ~0xffff, os.urandom(1000))]
+
+def write():
+    output = io.BytesIO()
+    output_data(output, data, "ihex")
+    return output.getvalue()
+
+write_time, ihex = measure(write)
+read_time, read_back = measure(lambda: input_data(io.BytesIO(ihex), "ihex"))
+
+expected = b"".join(chunk for (addr, chunk) in data)
+if b"".join(bytes(chunk) for (addr, chunk) in read_back) != expected:
+    raise SystemExit("Data read back does not match")
+
+print("image: {:.1f} MiB of data, {:.1f} MB of Intel HEX"
+      .format(sum(len(chunk) for (addr, chunk) in data) / 1048576, len(ihex) / 1e6))
+print("write: {:.2f} s".format(write_time))
+print("read:  {:.2f} s".format(read_time))
@@ -1,3 +1,4 @@
+import re
 import struct
 import usb1
 
@@ -19,6 +20,22 @@ REQ_EXT_RAM    = 0xA3
 REQ_RENUMERATE = 0xA8
 REQ_EEPROM_DB  = 0xA9
 REQ_PAGE_SIZE  = 0xB0
+REQ_BULK_CMD   = 0xB1
+
+
+def _transfer_error(status):
+    # Map the status of a failed asynchronous transfer to the exception that the equivalent
+    # synchronous transfer would have raised.
+    if status == usb1.TRANSFER_STALL:
+        return usb1.USBErrorPipe()
+    elif status == usb1.TRANSFER_TIMED_OUT:
+        return usb1.USBErrorTimeout()
+    elif status == usb1.TRANSFER_NO_DEVICE:
+        return usb1.USBErrorNoDevice()
+    elif status == usb1.TRANSFER_OVERFLOW:
+        return usb1.USBErrorOverflow()
+    else:
+        return usb1.USBErrorIO()
 
 
 class FX2Config:
@@ -67,6 +84,42 @@ class FX2Config:
             addr += 1023
             chunk = chunk[1023:]
 
+    def optimize(self, max_gap=3):
+        """
+        Rewrite ``firmware`` to make the EEPROM image as small as possible, and so minimize
+        the time it takes to load it on startup, without changing what ends up in the RAM.
+
+        Every chunk costs a 4-byte header, so overlapping or adjacent chunks, as well as chunks
+        separated by at most ``max_gap`` unused bytes, are merged, with the unused bytes
+        filled with zeroes.
+        """
+        image   = bytearray(0x10000)
+        present = bytearray(0x10000)
+        for (addr, chunk) in self.firmware:
+            image[addr:addr + len(chunk)] = chunk
+            present[addr:addr + len(chunk)] = b"\x01" * len(chunk)
+
+        runs = []
+        for match in re.finditer(rb"\x01+", present):
+            if runs and match.start() - runs[-1][1] <= max_gap:
+                runs[-1][1] = match.end()
+            else:
+                runs.append([match.start(), match.end()])
+
+        self.firmware = []
+        for (start, end) in runs:
+            self.append(start, image[start:end])
+
+    def load_time(self, i2c_400khz=None):
+        """
+        Estimate the time, in seconds, that it takes to load the EEPROM image on startup
+        at the I2C clock selected by ``i2c_400khz`` (by default, the configured one).
+        """
+        if i2c_400khz is None:
+            i2c_400khz = self.i2c_400khz
+        # Every byte takes nine clock cycles: eight data bits and an acknowledge bit.
+        return len(self.encode()) * 9 / (400e3 if i2c_400khz else 100e3)
+
     def encode(self, max_size=None):
         """
         Convert configuration to an image that can be loaded into an EEPROM.
@@ -111,7 +164,7 @@ class FX2Config:
         to be complete; if it is ``False``, it is an error unless the image
         contains the final data record.
         """
-        if data[0] == 0xFF:
+        if len(data) == 0 or data[0] == 0xFF:
             return None
         elif data[0] == 0xC0:
             has_firmware = False
@@ -163,6 +216,11 @@ class FX2Config:
         return not (self == other)
 
 
+def _port_path(usb_device):
+    return "{}-{}".format(usb_device.getBusNumber(),
+                          ".".join(str(port) for port in usb_device.getPortNumberList()))
+
+
 class FX2DeviceError(Exception):
     """An exception raised on a communication error."""
 
@@ -172,29 +230,102 @@ class FX2Device:
     A Cypress FX2 series device.
 
     The initializer of this class locates the device by provided VID:PID pair,
-    or raises a :exc:`FX2DeviceError`.
+    or raises a :exc:`FX2DeviceError`. Alternatively, an already open ``usb`` handle and
+    its ``usb_context`` may be provided; see also :meth:`find_all`.
 
     usb : usb1.USBDeviceHandle
-        Raw USB device handle.
+        Raw USB device handle, or any object that implements its ``controlRead``,
+        ``controlWrite``, ``bulkRead`` and ``bulkWrite`` methods.
+    usb_context : usb1.USBContext
+        The libusb context of ``usb``, which may be shared with other devices, or ``None``
+        if ``usb`` is not a libusb device handle (e.g. :class:`fx2.sim.SimulatedFX2Device`).
+    pipeline_depth : int
+        Maximum number of control transfers kept in flight by the methods that transfer
+        data in chunks. If 1, or if asynchronous transfers are not supported, the chunks
+        are transferred one at a time.
+
+        The host controller still performs the control transfers one after another; queueing
+        them only removes the delay between a transfer completing and the next one being
+        submitted, which matters most for short chunks. If a chunk fails, the chunks queued
+        behind it are cancelled, but those the host controller has already started still
+        complete, so a write may have changed the RAM or EEPROM past the failed chunk.
+        Set this to 1 to stop at the first failed chunk.
+    use_bulk_loader : bool
+        If ``True``, the methods that require the second stage bootloader transfer more than
+        one control packet worth of data through its bulk command channel, if it has one.
+        Otherwise, or if it does not, they use control transfers.
+
+        ``False`` by default, since the bundled ``boot-cypress.ihex`` has not yet been rebuilt
+        with the bulk command channel; set it only with a bootloader built from the current
+        ``firmware/boot-cypress`` sources.
     """
-    def __init__(self, vendor_id=VID_CYPRESS, product_id=PID_FX2):
+    def __init__(self, vendor_id=VID_CYPRESS, product_id=PID_FX2, usb_context=None, usb=None):
         self.timeout = 1000
-
-        self.usb_context = usb1.USBContext()
-        try:
-            self.usb = self.usb_context.openByVendorIDAndProductID(vendor_id, product_id)
-        except usb1.USBErrorAccess:
-            raise FX2DeviceError("Cannot access device {:04x}:{:04x}"
-                                 .format(vendor_id, product_id))
-        if self.usb is None:
-            raise FX2DeviceError("Device {:04x}:{:04x} not found"
-                                 .format(vendor_id, product_id))
+        self.pipeline_depth = 8
+        self.use_bulk_loader = False
+        self._bulk_loader = None
+
+        if usb_context is None and usb is None:
+            usb_context = usb1.USBContext()
+        self.usb_context = usb_context
+        if usb is None:
+            try:
+                usb = self.usb_context.openByVendorIDAndProductID(vendor_id, product_id)
+            except usb1.USBErrorAccess:
+                raise FX2DeviceError("Cannot access device {:04x}:{:04x}"
+                                     .format(vendor_id, product_id))
+            if usb is None:
+                raise FX2DeviceError("Device {:04x}:{:04x} not found"
+                                     .format(vendor_id, product_id))
+        self.usb = usb
 
         try:
             self.usb.setAutoDetachKernelDriver(True)
         except usb1.USBErrorNotSupported:
             pass
 
+    @classmethod
+    def find_all(cls, vendor_id=VID_CYPRESS, product_id=PID_FX2, port_paths=None,
+                 usb_context=None):
+        """
+        Locate every device with the provided VID:PID pair, optionally only those attached
+        to one of ``port_paths`` (see :attr:`port_path`), and return a list of them, ordered
+        by port path. All of the devices share ``usb_context`` (by default, a new context).
+        Raises :exc:`FX2DeviceError` if any of the devices cannot be accessed, after closing
+        the devices already opened (and the context, if it was created here).
+        """
+        own_context = usb_context is None
+        if own_context:
+            usb_context = usb1.USBContext()
+
+        devices = []
+        for usb_device in usb_context.getDeviceIterator(skip_on_error=True):
+            if (usb_device.getVendorID() != vendor_id or
+                    usb_device.getProductID() != product_id):
+                continue
+            port_path = _port_path(usb_device)
+            if port_paths is not None and port_path not in port_paths:
+                continue
+            try:
+                usb = usb_device.open()
+            except usb1.USBErrorAccess:
+                for device in devices:
+                    device.usb.close()
+                if own_context:
+                    usb_context.close()
+                raise FX2DeviceError("Cannot access device {:04x}:{:04x} at {}"
+                                     .format(vendor_id, product_id, port_path))
+            devices.append(cls(vendor_id, product_id, usb_context, usb))
+        return sorted(devices, key=lambda device: device.port_path)
+
+    @property
+    def port_path(self):
+        """
+        The location of the device, as the bus number followed by the port numbers leading to
+        the device, e.g. ``"1-2.3"`` for port 3 of the hub attached to port 2 of bus 1.
+        """
+        return _port_path(self.usb.getDevice())
+
     def control_read(self, request_type, request, value, index, length,
                      timeout=None):
         """
@@ -213,6 +344,84 @@ class FX2Device:
             timeout = self.timeout
         self.usb.controlWrite(request_type, request, value, index, data, timeout)
 
+    def _handle_events(self):
+        # If the context is shared between threads, another thread may process the completion
+        # of our transfers while we are waiting, so the wait is bounded.
+        self.usb_context.handleEventsTimeout(tv=0.1)
+
+    def _control_pipelined(self, requests):
+        # Issue a sequence of control requests, each either a read (if ``data_or_length``
+        # is an integer) or a write, keeping up to ``pipeline_depth`` of them in flight,
+        # so that the host does not idle for a round trip between consecutive chunks.
+        # Control transfers to the same device are always completed in order, but if one of
+        # them fails, the ones after it may still be performed before they are cancelled.
+        requests = list(requests)
+        results  = [None] * len(requests)
+        if self.pipeline_depth <= 1 or len(requests) <= 1 or \
+                not hasattr(self.usb, "getTransfer"):
+            for index, (request_type, request, value, windex, data_or_length) in \
+                    enumerate(requests):
+                if isinstance(data_or_length, int):
+                    results[index] = self.control_read(request_type, request, value, windex,
+                                                       data_or_length)
+                else:
+                    self.control_write(request_type, request, value, windex, data_or_length)
+            return results
+
+        errors    = []
+        in_flight = set()
+
+        def callback(transfer):
+            in_flight.discard(transfer)
+            status = transfer.getStatus()
+            if status == usb1.TRANSFER_COMPLETED:
+                index = transfer.getUserData()
+                if isinstance(requests[index][4], int):
+                    results[index] = bytes(transfer.getBuffer()[:transfer.getActualLength()])
+            else:
+                errors.append(_transfer_error(status))
+
+        transfers = [self.usb.getTransfer() for _ in range(min(self.pipeline_depth,
+                                                               len(requests)))]
+        try:
+            next_index = 0
+            while (next_index < len(requests) or in_flight) and not errors:
+                for transfer in transfers:
+                    if next_index == len(requests) or errors:
+                        break
+                    if transfer in in_flight:
+                        continue
+                    request_type, request, value, windex, data_or_length = \
+                        requests[next_index]
+                    if isinstance(data_or_length, int):
+                        request_type |= usb1.ENDPOINT_IN
+                    else:
+                        data_or_length = bytes(data_or_length)
+                    # A queued transfer cannot start before the ones ahead of it complete,
+                    # each of which may take up to the timeout.
+                    transfer.setControl(request_type, request, value, windex, data_or_length,
+                                        callback=callback, user_data=next_index,
+                                        timeout=self.timeout * (len(in_flight) + 1))
+                    transfer.submit()
+                    in_flight.add(transfer)
+                    next_index += 1
+                if in_flight:
+                    self._handle_events()
+        finally:
+            for transfer in list(in_flight):
+                try:
+                    transfer.cancel()
+                except usb1.USBError:
+                    pass
+            while in_flight:
+                self._handle_events()
+            for transfer in transfers:
+                transfer.close()
+
+        if errors:
+            raise errors[0]
+        return results
+
     def bulk_read(self, endpoint, length, timeout=None):
         """
         Issue an USB bulk read request with timeout defaulting to ``self.timeout``.
@@ -234,42 +443,57 @@ class FX2Device:
         Read ``length`` bytes at ``addr`` from internal RAM.
         Note that not all memory can be addressed this way; consult the TRM.
         """
-        data = bytearray()
+        requests = []
+        unaligned = []
         while length > 0:
             chunk_length = min(length, 4096)
             if addr & 1: # unaligned
-                data += self.control_read(usb1.REQUEST_TYPE_VENDOR,
-                                          REQ_RAM, addr, 0, chunk_length + 1)[1:]
+                requests.append((usb1.REQUEST_TYPE_VENDOR, REQ_RAM, addr, 0, chunk_length + 1))
             else:
-                data += self.control_read(usb1.REQUEST_TYPE_VENDOR,
-                                          REQ_RAM, addr, 0, chunk_length)
+                requests.append((usb1.REQUEST_TYPE_VENDOR, REQ_RAM, addr, 0, chunk_length))
+            unaligned.append(addr & 1)
             addr += chunk_length
             length -= chunk_length
+
+        data = bytearray()
+        for chunk, skip in zip(self._control_pipelined(requests), unaligned):
+            data += chunk[skip:]
         return data
 
+    @staticmethod
+    def _write_ram_requests(addr, data):
+        requests = []
+        while len(data) > 0:
+            chunk_length = min(len(data), 4096)
+            requests.append((usb1.REQUEST_TYPE_VENDOR, REQ_RAM, addr, 0, data[:chunk_length]))
+            addr += chunk_length
+            data = data[chunk_length:]
+        return requests
+
     def write_ram(self, addr, data):
         """
         Write ``data`` to ``addr`` to internal RAM.
         Note that not all memory can be addressed this way; consult the TRM.
         """
-        while len(data) > 0:
-            chunk_length = min(len(data), 4096)
-            self.control_write(usb1.REQUEST_TYPE_VENDOR, REQ_RAM, addr, 0, data[:chunk_length])
-            addr += chunk_length
-            data = data[chunk_length:]
+        self._control_pipelined(self._write_ram_requests(addr, data))
 
     def cpu_reset(self, is_reset):
         """Bring CPU in or out of reset."""
         self.write_ram(REG_CPUCS, [1 if is_reset else 0])
+        # The firmware may be replaced while the CPU is in reset.
+        self._bulk_loader = None
 
     def load_ram(self, chunks):
         """
         Write ``chunks``, a list of ``(address, data)`` pairs, to internal RAM,
         and start the CPU core. See also ``write_ram``.
         """
-        self.cpu_reset(True)
+        requests = []
         for address, data in chunks:
-            self.write_ram(address, data)
+            requests += self._write_ram_requests(address, data)
+
+        self.cpu_reset(True)
+        self._control_pipelined(requests)
         self.cpu_reset(False)
 
     @staticmethod
@@ -282,20 +506,80 @@ class FX2Device:
             raise ValueError("Address width {addr_width} is not supported"
                              .format(addr_width=addr_width))
 
+    def _bulk_endpoints(self, length):
+        # Discover the bulk command channel once per firmware. Control transfers are used
+        # if the data fits into a single packet, since they take a single round trip.
+        if not self.use_bulk_loader or length <= 64:
+            return None
+        if self._bulk_loader is None:
+            self._bulk_loader = False
+            try:
+                endpoints = self.control_read(usb1.REQUEST_TYPE_VENDOR, REQ_BULK_CMD,
+                                              0, 0, 2)
+            except usb1.USBErrorPipe:
+                return None
+            if len(endpoints) == 2:
+                self.usb.claimInterface(0)
+                self.usb.setInterfaceAltSetting(0, 1)
+                self._bulk_loader = tuple(endpoints)
+        return self._bulk_loader or None
+
+    def _bulk_command(self, request, addr, data_or_length, timeout):
+        # Issue a command through the bulk command channel of the second stage bootloader,
+        # in chunks that fit into the 16-bit length field of the command header.
+        out_endpoint, in_endpoint = self._bulk_loader
+        is_read = isinstance(data_or_length, int)
+        length  = data_or_length if is_read else len(data_or_length)
+
+        result = bytearray()
+        offset = 0
+        while offset < length:
+            chunk_length = min(length - offset, 0x8000)
+            request_type = usb1.REQUEST_TYPE_VENDOR | (usb1.ENDPOINT_IN if is_read else 0)
+            header = struct.pack("<BBHHH", request_type, request, (addr + offset) & 0xffff,
+                                 0, chunk_length)
+            try:
+                self.usb.bulkWrite(out_endpoint, header, self.timeout)
+                if is_read:
+                    chunk = self.usb.bulkRead(in_endpoint, chunk_length, timeout(chunk_length))
+                    result += chunk
+                else:
+                    chunk = data_or_length[offset:offset + chunk_length]
+                    self.usb.bulkWrite(out_endpoint, bytes(chunk), timeout(chunk_length))
+                status = self.usb.bulkRead(in_endpoint, 512, self.timeout)
+            except usb1.USBError:
+                # The command may have been abandoned halfway, so the channel is out of sync.
+                self._bulk_loader = False
+                raise
+            # Report a failure the same way as the equivalent control request.
+            if status != b"\x00" or len(chunk) != chunk_length:
+                raise usb1.USBErrorPipe()
+            offset += chunk_length
+        return result
+
+    def _eeprom_read_timeout(self, length):
+        # Reading the EEPROM at 100 kHz takes about 0.1 ms per byte.
+        return self.timeout + length // 10
+
     def read_boot_eeprom(self, addr, length, addr_width, chunk_size=0x100):
         """
-        Read ``length`` bytes at ``addr`` from boot EEPROM in ``chunk_size`` chunks.
+        Read ``length`` bytes at ``addr`` from boot EEPROM in ``chunk_size`` chunks
+        (if control transfers are used).
 
         Requires the second stage bootloader.
         """
-        data = bytearray()
+        if self._bulk_endpoints(length):
+            return self._bulk_command(self._eeprom_cmd(addr_width), addr, length,
+                                      self._eeprom_read_timeout)
+
+        requests = []
         while length > 0:
             chunk_length = min(length, chunk_size)
-            data += self.control_read(usb1.REQUEST_TYPE_VENDOR,
-                                      self._eeprom_cmd(addr_width), addr, 0, chunk_length)
+            requests.append((usb1.REQUEST_TYPE_VENDOR,
+                             self._eeprom_cmd(addr_width), addr, 0, chunk_length))
             addr += chunk_length
             length -= chunk_length
-        return data
+        return bytearray().join(self._control_pipelined(requests))
 
     def write_boot_eeprom(self, addr, data, addr_width, chunk_size=0x10, page_size=0):
         """
@@ -309,12 +593,21 @@ class FX2Device:
         Requires the second stage bootloader or a compatible firmware.
         """
         self.control_write(usb1.REQUEST_TYPE_VENDOR, REQ_PAGE_SIZE, page_size, 0, [])
+        if self._bulk_endpoints(len(data)):
+            # Every page takes a write cycle of up to 10 ms.
+            def timeout(length):
+                return self.timeout + 10 * (length // (1 << page_size) + 2)
+            self._bulk_command(self._eeprom_cmd(addr_width), addr, data, timeout)
+            return
+
+        requests = []
         while len(data) > 0:
             chunk_length = min(len(data), chunk_size)
-            self.control_write(usb1.REQUEST_TYPE_VENDOR,
-                               self._eeprom_cmd(addr_width), addr, 0, data[:chunk_length])
+            requests.append((usb1.REQUEST_TYPE_VENDOR,
+                             self._eeprom_cmd(addr_width), addr, 0, data[:chunk_length]))
             addr += chunk_length
             data = data[chunk_length:]
+        self._control_pipelined(requests)
 
     def read_ext_ram(self, addr, length):
         """
@@ -323,6 +616,8 @@ class FX2Device:
 
         Requires the second stage bootloader.
         """
+        if self._bulk_endpoints(length):
+            return self._bulk_command(REQ_EXT_RAM, addr, length, lambda length: self.timeout)
         return self.control_read(usb1.REQUEST_TYPE_VENDOR, REQ_EXT_RAM, addr, 0, length)
 
     def write_ext_ram(self, addr, data):
@@ -332,6 +627,9 @@ class FX2Device:
 
         Requires the second stage bootloader or a compatible firmware.
         """
+        if self._bulk_endpoints(len(data)):
+            self._bulk_command(REQ_EXT_RAM, addr, data, lambda length: self.timeout)
+            return
         self.control_write(usb1.REQUEST_TYPE_VENDOR, REQ_EXT_RAM, addr, 0, data)
 
     def reenumerate(self):
@@ -341,3 +639,4 @@ class FX2Device:
         Requires the second stage bootloader or a compatible firmware.
         """
         self.control_write(usb1.REQUEST_TYPE_VENDOR, REQ_RENUMERATE, 0, 0, [])
+        self._bulk_loader = None
@@ -0,0 +1,317 @@
+import time
+import struct
+import usb1
+from zlib import crc32
+
+
+__all__ = ["DFUDevice", "DFUError", "encode_dfu_suffix", "decode_dfu_suffix"]
+
+
+IFACE_CLASS_APP_SPECIFIC = 0xFE
+IFACE_SUBCLASS_DFU       = 0x01
+IFACE_PROTOCOL_RUNTIME   = 0x01
+IFACE_PROTOCOL_UPGRADE   = 0x02
+
+DESC_DFU_FUNCTIONAL = 0x21
+
+ATTR_CAN_DNLOAD             = 1 << 0
+ATTR_CAN_UPLOAD             = 1 << 1
+ATTR_MANIFESTATION_TOLERANT = 1 << 2
+ATTR_WILL_DETACH            = 1 << 3
+
+REQ_DETACH    = 0
+REQ_DNLOAD    = 1
+REQ_UPLOAD    = 2
+REQ_GETSTATUS = 3
+REQ_CLRSTATUS = 4
+REQ_GETSTATE  = 5
+REQ_ABORT     = 6
+
+STATE_appIDLE                = 0
+STATE_appDETACH              = 1
+STATE_dfuIDLE                = 2
+STATE_dfuDNLOAD_SYNC         = 3
+STATE_dfuDNBUSY              = 4
+STATE_dfuDNLOAD_IDLE         = 5
+STATE_dfuMANIFEST_SYNC       = 6
+STATE_dfuMANIFEST            = 7
+STATE_dfuMANIFEST_WAIT_RESET = 8
+STATE_dfuUPLOAD_IDLE         = 9
+STATE_dfuERROR               = 10
+
+STATUS_OK = 0
+
+STATUS_NAMES = [
+    "OK", "errTARGET", "errFILE", "errWRITE", "errERASE", "errCHECK_ERASED", "errPROG",
+    "errVERIFY", "errADDRESS", "errNOTDONE", "errFIRMWARE", "errVENDOR", "errUSBR", "errPOR",
+    "errUNKNOWN", "errSTALLEDPKT",
+]
+
+SUFFIX_FORMAT = "<HHHH3sBL"
+SUFFIX_LENGTH = struct.calcsize(SUFFIX_FORMAT)
+
+
+class DFUError(Exception):
+    """An exception raised on a DFU protocol error."""
+
+
+def encode_dfu_suffix(image, vendor_id=0xFFFF, product_id=0xFFFF, device_id=0xFFFF):
+    """
+    Append a DFU suffix (including the CRC) identifying the device the image is intended for
+    to ``image``, and return the result.
+    """
+    image = bytes(image)
+    image += struct.pack("<HHHH3sB", device_id, product_id, vendor_id, 0x0100,
+                         b"UFD", SUFFIX_LENGTH)
+    image += struct.pack("<L", crc32(image) ^ 0xffffffff)
+    return image
+
+
+def decode_dfu_suffix(image):
+    """
+    Verify the DFU suffix of ``image``, and return a ``(payload, vendor_id, product_id,
+    device_id)`` tuple, where ``0xFFFF`` matches any ID. Raises :class:`ValueError` if
+    the suffix is missing or its CRC does not match.
+    """
+    if len(image) < SUFFIX_LENGTH:
+        raise ValueError("DFU image is too short")
+
+    device_id, product_id, vendor_id, bcd_dfu, signature, length, crc = \
+        struct.unpack_from(SUFFIX_FORMAT, image, len(image) - SUFFIX_LENGTH)
+    if signature != b"UFD" or length < SUFFIX_LENGTH or length > len(image):
+        raise ValueError("DFU image has no DFU suffix")
+    if crc32(image[:-4]) ^ 0xffffffff != crc:
+        raise ValueError("DFU image CRC mismatch (expected {:08x}, found {:08x})"
+                         .format(crc32(image[:-4]) ^ 0xffffffff, crc))
+
+    return bytes(image[:-length]), vendor_id, product_id, device_id
+
+
+def _find_dfu_interface(usb_device):
+    for setting in usb_device.iterSettings():
+        if (setting.getClass() == IFACE_CLASS_APP_SPECIFIC and
+                setting.getSubClass() == IFACE_SUBCLASS_DFU):
+            for extra in setting.getExtra():
+                if len(extra) >= 9 and extra[1] == DESC_DFU_FUNCTIONAL:
+                    attributes, detach_timeout, transfer_size = \
+                        struct.unpack_from("<BHH", extra, 2)
+                    return (setting.getNumber(), setting.getProtocol(),
+                            attributes, detach_timeout, transfer_size)
+    return None
+
+
+class DFUDevice:
+    """
+    A USB Device Firmware Upgrade interface, such as the one implemented by ``fx2usbdfu.h``.
+
+    usb : usb1.USBDeviceHandle
+        Raw USB device handle, or any object that implements its ``controlRead``
+        and ``controlWrite`` methods, such as :class:`fx2.sim.SimulatedDFUDevice`.
+    interface : int
+        The bInterfaceNumber field of the DFU interface.
+    transfer_size : int
+        The wTransferSize field of the DFU functional descriptor.
+    attributes : int
+        The bmAttributes field of the DFU functional descriptor.
+    """
+    def __init__(self, usb, interface=0, transfer_size=64,
+                 attributes=ATTR_CAN_DNLOAD|ATTR_CAN_UPLOAD, timeout=1000):
+        self.usb           = usb
+        self.interface     = interface
+        self.transfer_size = transfer_size
+        self.attributes    = attributes
+        self.timeout       = timeout
+        self._poll_at      = 0
+
+    @classmethod
+    def open(cls, usb_context, vendor_id, product_id, dfu_product_id=None,
+             reenumerate_timeout=5.0):
+        """
+        Locate a device with a DFU interface by VID:PID pair. If the device is in runtime mode,
+        detach it and wait until it re-enumerates in DFU mode with ``dfu_product_id``
+        (by default, ``product_id``). Raises :exc:`DFUError` if the device could not be found.
+        """
+        if dfu_product_id is None:
+            dfu_product_id = product_id
+
+        usb = usb_context.openByVendorIDAndProductID(vendor_id, product_id)
+        if usb is None and dfu_product_id != product_id:
+            usb = usb_context.openByVendorIDAndProductID(vendor_id, dfu_product_id)
+        if usb is None:
+            raise DFUError("Device {:04x}:{:04x} not found".format(vendor_id, product_id))
+
+        found = _find_dfu_interface(usb.getDevice())
+        if found is None:
+            usb.close()
+            raise DFUError("Device {:04x}:{:04x} has no DFU interface"
+                           .format(vendor_id, product_id))
+        interface, protocol, attributes, detach_timeout, transfer_size = found
+
+        if protocol == IFACE_PROTOCOL_RUNTIME:
+            cls(usb, interface, transfer_size, attributes).detach(detach_timeout)
+            if not attributes & ATTR_WILL_DETACH:
+                try:
+                    usb.resetDevice()
+                except usb1.USBErrorNotFound:
+                    pass
+            usb.close()
+
+            usb = cls._wait_for_dfu_mode(usb_context, vendor_id, dfu_product_id,
+                                         reenumerate_timeout)
+            interface, protocol, attributes, detach_timeout, transfer_size = \
+                _find_dfu_interface(usb.getDevice())
+
+        try:
+            usb.setAutoDetachKernelDriver(True)
+        except usb1.USBErrorNotSupported:
+            pass
+        usb.claimInterface(interface)
+        return cls(usb, interface, transfer_size, attributes)
+
+    @staticmethod
+    def _wait_for_dfu_mode(usb_context, vendor_id, product_id, timeout):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            for usb_device in usb_context.getDeviceIterator(skip_on_error=True):
+                if (usb_device.getVendorID() == vendor_id and
+                        usb_device.getProductID() == product_id):
+                    found = _find_dfu_interface(usb_device)
+                    if found is not None and found[1] == IFACE_PROTOCOL_UPGRADE:
+                        try:
+                            return usb_device.open()
+                        except usb1.USBError:
+                            pass # still enumerating
+            time.sleep(0.1)
+        raise DFUError("Device {:04x}:{:04x} did not re-enumerate in DFU mode"
+                       .format(vendor_id, product_id))
+
+    def _control_read(self, request, value, length):
+        return self.usb.controlRead(usb1.TYPE_CLASS|usb1.RECIPIENT_INTERFACE,
+                                    request, value, self.interface, length, self.timeout)
+
+    def _control_write(self, request, value, data):
+        self.usb.controlWrite(usb1.TYPE_CLASS|usb1.RECIPIENT_INTERFACE,
+                              request, value, self.interface, data, self.timeout)
+
+    def detach(self, timeout=1000):
+        """Request the device to switch to DFU mode."""
+        self._control_write(REQ_DETACH, timeout, b"")
+
+    def get_state(self):
+        """Return the current state of the DFU interface."""
+        return self._control_read(REQ_GETSTATE, 0, 1)[0]
+
+    def get_status(self):
+        """
+        Return the ``(status, state)`` pair of the DFU interface.
+
+        The ``bwPollTimeout`` field of the response is honored: if this method is called again
+        before it elapses, it waits for exactly the remaining time.
+        """
+        delay = self._poll_at - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        status, poll_timeout_low, poll_timeout_high, state, _ = \
+            struct.unpack("<BBHBB", self._control_read(REQ_GETSTATUS, 0, 6))
+        poll_timeout = poll_timeout_low | (poll_timeout_high << 8)
+        self._poll_at = time.monotonic() + poll_timeout / 1000
+        return status, state
+
+    def clear_status(self):
+        """Leave the dfuERROR state."""
+        self._control_write(REQ_CLRSTATUS, 0, b"")
+
+    def abort(self):
+        """Return to the dfuIDLE state."""
+        self._control_write(REQ_ABORT, 0, b"")
+
+    def _check(self, status, state):
+        if state == STATE_dfuERROR or status != STATUS_OK:
+            name = STATUS_NAMES[status] if status < len(STATUS_NAMES) else str(status)
+            self.clear_status()
+            raise DFUError("DFU operation failed with status {}".format(name))
+
+    def _wait_while(self, *states):
+        while True:
+            status, state = self.get_status()
+            self._check(status, state)
+            if state not in states:
+                return state
+
+    def _prepare(self):
+        status, state = self.get_status()
+        if state == STATE_dfuERROR:
+            self.clear_status()
+        elif state != STATE_dfuIDLE:
+            self.abort()
+
+    def download(self, image, progress=None):
+        """
+        Download ``image`` to the device and manifest it. If ``progress`` is specified,
+        it is called with the number of bytes downloaded so far after each block.
+        Raises :exc:`DFUError` if the device reports an error.
+        """
+        if not self.attributes & ATTR_CAN_DNLOAD:
+            raise DFUError("Device does not support DFU download")
+
+        self._prepare()
+        image = memoryview(bytes(image))
+        offset, block_num = 0, 0
+        while offset < len(image):
+            block = image[offset:offset + self.transfer_size]
+            try:
+                self._control_write(REQ_DNLOAD, block_num & 0xffff, block)
+            except usb1.USBErrorPipe:
+                # An error writing the previous block is reported by stalling this one.
+                self._check(*self.get_status())
+                raise
+            # A device that overlaps writing the block with receiving the next one reports
+            # dfuDNLOAD-IDLE right away, in which case the next block is sent immediately.
+            self._wait_while(STATE_dfuDNLOAD_SYNC, STATE_dfuDNBUSY)
+            offset    += len(block)
+            block_num += 1
+            if progress:
+                progress(offset)
+
+        try:
+            self._control_write(REQ_DNLOAD, block_num & 0xffff, b"")
+        except usb1.USBErrorPipe:
+            self._check(*self.get_status())
+            raise
+        try:
+            state = self._wait_while(STATE_dfuMANIFEST_SYNC, STATE_dfuMANIFEST)
+        except usb1.USBErrorPipe:
+            # An error writing the last block may be reported by stalling the first GETSTATUS.
+            self._check(*self.get_status())
+            raise
+        except usb1.USBErrorNoDevice:
+            # The device has reset itself after manifestation.
+            return
+        if state not in (STATE_dfuIDLE, STATE_dfuMANIFEST_WAIT_RESET):
+            raise DFUError("Unexpected DFU state {} after manifestation".format(state))
+
+    def upload(self, progress=None):
+        """
+        Upload the firmware from the device and return it. If ``progress`` is specified,
+        it is called with the number of bytes uploaded so far after each block.
+        Raises :exc:`DFUError` if the device reports an error.
+        """
+        if not self.attributes & ATTR_CAN_UPLOAD:
+            raise DFUError("Device does not support DFU upload")
+
+        self._prepare()
+        data = bytearray()
+        block_num = 0
+        while True:
+            try:
+                block = self._control_read(REQ_UPLOAD, block_num & 0xffff, self.transfer_size)
+            except usb1.USBErrorPipe:
+                self._check(*self.get_status())
+                raise
+            data += block
+            block_num += 1
+            if progress:
+                progress(len(data))
+            if len(block) < self.transfer_size:
+                break
+        return data
@@ -1,6 +1,7 @@
 import os
 import io
 import re
+import binascii
 
 
 __all__ = ['input_data', 'output_data']
@@ -30,7 +31,7 @@ def flatten_data(data, *, fill=0x00):
     Flatten a list of ``(addr, chunk)`` pairs, such as that returned by :func:`input_data`,
     to a flat byte array, such as that accepted by :func:`output_data`.
     """
-    data_flat = bytearray([fill]) * max([addr + len(chunk) for (addr, chunk) in data])
+    data_flat = bytearray([fill]) * max((addr + len(chunk) for (addr, chunk) in data), default=0)
     for (addr, chunk) in data:
         data_flat[addr:addr+len(chunk)] = chunk
     return data_flat
@@ -64,6 +65,79 @@ def diff_data(old, new):
     return diff
 
 
+_NEGATE = bytes(-byte & 0xff for byte in range(256))
+
+
+def _ihex_data_records(recoff, data):
+    # Format ``data`` at ``recoff`` as Intel HEX data records, 16 bytes each, which must not
+    # cross a bank boundary. Iterating over the records in Python is slow, so the records
+    # are assembled field by field using strided slices instead.
+    count, tail = divmod(len(data), 0x10)
+    addrs   = range(recoff, recoff + count * 0x10, 0x10)
+    records = bytearray(count * 21)
+    records[0::21] = bytes([0x10]) * count
+    records[1::21] = bytes((addr >> 8) & 0xff for addr in addrs)
+    records[2::21] = bytes(addr & 0xff for addr in addrs)
+    for index in range(0x10):
+        records[4 + index::21] = data[index:count * 0x10:0x10]
+
+    # The checksums are computed by summing the fields as 16-bit lanes of big integers,
+    # which cannot overflow into the next lane.
+    lanes = bytearray(count * 2)
+    total = 0
+    for index in range(20):
+        lanes[0::2] = records[index::21]
+        total += int.from_bytes(lanes, "little")
+    records[20::21] = total.to_bytes(count * 2, "little")[0::2].translate(_NEGATE)
+
+    output = bytearray()
+    if count > 0:
+        output += b":"
+        output += binascii.hexlify(records, b"\n", 21).upper().replace(b"\n", b"\n:")
+        output += b"\n"
+    if tail > 0:
+        recoff += count * 0x10
+        record = bytearray([tail, (recoff >> 8) & 0xff, recoff & 0xff, 0x00])
+        record += data[count * 0x10:]
+        record.append(-sum(record) & 0xff)
+        output += b":" + binascii.hexlify(record).upper() + b"\n"
+    return output
+
+
+def diff_pages(old, new, page_size, max_gap=0):
+    """
+    Compute the difference between ``old`` and ``new`` byte arrays in units of ``page_size``
+    byte pages, and return a list of ``(addr, chunk)`` pairs containing every page of ``new``
+    that has any bytes changed from ``old``. Each chunk starts at a page boundary and consists
+    of whole pages, except that the last one may be cut short at the end of ``new``.
+
+    Runs of changed pages separated by at most ``max_gap`` unchanged pages are merged into
+    a single chunk. Since the write cycle time of an EEPROM is the same for a single byte or
+    an entire page, the changed pages are written with the minimum number of write cycles
+    if ``max_gap`` is 0; a larger ``max_gap`` trades write cycles for fewer chunks.
+    """
+    old, new = bytes(old[:len(new)]), bytes(new)
+
+    # Comparing the images in large blocks first skips the unchanged parts quickly
+    # even if the pages are tiny.
+    block_size = max(page_size, 256)
+    dirty = []
+    for block in range(0, len(new), block_size):
+        if old[block:block + block_size] == new[block:block + block_size]:
+            continue
+        for page in range(block, min(block + block_size, len(new)), page_size):
+            if old[page:page + page_size] != new[page:page + page_size]:
+                dirty.append(page)
+
+    diff = []
+    for page in dirty:
+        if diff and page - diff[-1][1] <= max_gap * page_size:
+            diff[-1][1] = page + page_size
+        else:
+            diff.append([page, page + page_size])
+    return [(start, new[start:end]) for (start, end) in diff]
+
+
 def output_data(file, data, fmt="auto", offset=0):
     """
     Write Intel HEX, hexadecimal, or binary ``data`` to ``file``.
@@ -110,43 +184,23 @@ def output_data(file, data, fmt="auto", offset=0):
         if not isinstance(data, list):
             data = [(offset, data)]
 
-        def write_record(record):
-            record.append((~sum(record) + 1) & 0xff)
-            file.write(b":")
-            file.write(bytes(record).hex().upper().encode())
-            file.write(b"\n")
-
         bankoff = 0
         for (addr, chunk) in data:
+            chunk = bytes(chunk)
             pos = 0
             while pos < len(chunk):
                 recoff = addr + pos
                 if bankoff != recoff >> 16:
                     bankoff = recoff >> 16
-                    write_record([
-                        2,
-                        0x00, # dummy
-                        0x00, # dummy
-                        0x04, # Extended Linear Address
-                        (bankoff >> 8) & 0xff,
-                        (bankoff >> 0) & 0xff,
-                    ])
-                recdata = chunk[pos:pos + 0x10]
-                write_record([
-                    len(recdata),
-                    (recoff >> 8) & 0xff,
-                    (recoff >> 0) & 0xff,
-                    0x00, # Data
-                    *list(recdata)
-                ])
-                pos += len(recdata)
-
-        write_record([
-            0,
-            0x00, # dummy
-            0x00, # dummy
-            0x01, # End Of File
-        ])
+                    file.write(b":02000004%04X%02X\n" % # Extended Linear Address
+                               (bankoff & 0xffff, -(6 + (bankoff >> 8) + bankoff) & 0xff))
+                # The records are formatted one bank at a time, which keeps the number of
+                # write calls low without building the whole file in memory.
+                end = min(len(chunk), pos + 0x10000 - (recoff & 0xffff))
+                file.write(_ihex_data_records(recoff, chunk[pos:end]))
+                pos = end
+
+        file.write(b":00000001FF\n") # End Of File
 
 
 def input_data(file_or_data, fmt="auto", offset=0):
@@ -157,7 +211,8 @@ def input_data(file_or_data, fmt="auto", offset=0):
 
     Raises :class:`ValueError` if the input data has invalid format.
 
-    Returns a list of ``(address, data)`` chunks.
+    Returns a list of ``(address, data)`` chunks, where contiguous data is merged into
+    a single chunk.
 
     :param fmt:
         ``"ihex"`` for Intel HEX, ``"hex"`` for hexadecimal, ``"bin"`` for binary,
@@ -190,71 +245,79 @@ def input_data(file_or_data, fmt="auto", offset=0):
         return [(offset, bindata)]
 
     elif fmt == "ihex":
-        RE_HDR = re.compile(rb":([0-9a-f]{8})", re.I)
-        RE_WS  = re.compile(rb"\s*")
-
         segoff  = 0
         bankoff = 0
-        resoff  = 0
-        resbuf  = []
+        base    = offset
+        resoff  = resend = None
+        resbuf  = None
         res     = []
 
-        pos = 0
-        while pos < len(data):
-            match = RE_HDR.match(data, pos)
-            if match is None:
-                raise ValueError("Invalid record header at offset {}".format(pos))
-            *rechdr, = bytes.fromhex(match.group(1).decode())
-            reclen, recoffh, recoffl, rectype = rechdr
-
-            recdatahex = data[match.end(0):match.end(0)+(reclen+1)*2]
-            if len(recdatahex) < (reclen + 1) * 2:
-                raise ValueError("Truncated record at offset {}".format(pos))
-            try:
-                *recdata, recsum = bytes.fromhex(recdatahex.decode())
-            except ValueError:
-                raise ValueError("Invalid record data at offset {}".format(pos))
-            if sum(rechdr + recdata + [recsum]) & 0xff != 0:
-                raise ValueError("Invalid record checksum at offset {}".format(pos))
+        # Every record starts with a colon, so splitting on it yields the records one by one,
+        # each followed by any whitespace that separates it from the next one.
+        records = data.split(b":")
+        if records[0].strip():
+            raise ValueError("Invalid record header at offset 0")
+
+        unhexlify = binascii.unhexlify
+        pos = len(records[0])
+        for record in records[1:]:
+            recpos = pos
+            pos += 1 + len(record)
+
+            if record[6:8] == b"01":
+                # Anything following the End Of File record is ignored, so only take as much
+                # of the text as the record itself occupies.
+                try:
+                    record = record[:(int(record[:2], 16) + 5) * 2]
+                except ValueError:
+                    raise ValueError("Invalid record header at offset {}".format(recpos))
 
-            if rectype == 0x01:
+            try:
+                record = unhexlify(record.rstrip())
+            except binascii.Error:
+                raise ValueError("Invalid record data at offset {}".format(recpos))
+            if len(record) < 5:
+                raise ValueError("Invalid record header at offset {}".format(recpos))
+            reclen, recoffh, recoffl, rectype = record[:4]
+            if len(record) != reclen + 5:
+                if len(record) < reclen + 5:
+                    raise ValueError("Truncated record at offset {}".format(recpos))
+                raise ValueError("Invalid record data at offset {}".format(recpos))
+            if sum(record) & 0xff != 0:
+                raise ValueError("Invalid record checksum at offset {}".format(recpos))
+
+            if rectype == 0x00:
+                recoff = base + ((recoffh << 8) | recoffl)
+                # Contiguous records, including those across segment or bank boundaries,
+                # are merged into a single chunk.
+                if recoff != resend:
+                    if resbuf:
+                        res.append((resoff, resbuf))
+                    resoff = resend = recoff
+                    resbuf = bytearray()
+                resbuf += record[4:-1]
+                resend += reclen
+
+            elif rectype == 0x01:
                 break
 
             elif rectype in (0x02, 0x04):
-                res.append((offset + resoff + segoff + bankoff, resbuf))
-
-                # If we switch segments/banks, we know there is a discontinuity, so
-                # make no assumption about previous position or buffer contents.
-                resoff  = 0
-                resbuf  = []
+                if reclen != 2:
+                    raise ValueError("Invalid record data at offset {}".format(recpos))
                 if rectype == 0x02:
-                    segoff  = ((recdata[0] << 8) | recdata[1]) << 4
-                elif rectype == 0x04:
-                    bankoff = ((recdata[0] << 8) | recdata[1]) << 16
+                    segoff  = ((record[4] << 8) | record[5]) << 4
                 else:
-                    assert False
+                    bankoff = ((record[4] << 8) | record[5]) << 16
+                base = offset + segoff + bankoff
 
-            elif rectype == 0x05:
+            elif rectype in (0x03, 0x05):
                 pass
 
-            elif rectype == 0x00:
-                recoff = (recoffh << 8) | recoffl
-                if resoff + len(resbuf) == recoff:
-                    resbuf += recdata
-                else:
-                    if len(resbuf) > 0:
-                        res.append((offset + resoff + segoff + bankoff, resbuf))
-                    resoff  = recoff
-                    resbuf  = recdata
-
             else:
-                raise ValueError("Unknown record type {:02x} at offset {}".format(rectype, pos))
-
-            match = RE_WS.match(data, match.end(0) + len(recdatahex))
-            pos = match.end(0)
+                raise ValueError("Unknown record type {:02x} at offset {}".format(rectype, recpos))
 
         # Handle last record that was seen before Record Type 0x01.
-        if len(resbuf) > 0:
-            res.append((offset + resoff + segoff + bankoff, resbuf))
+        if resbuf:
+            res.append((resoff, resbuf))
 
         return res
@@ -1,6 +1,7 @@
 import math
 import sys
 import os
+import time
 import io
 import re
 import struct
@@ -8,10 +9,13 @@ import collections
 import argparse
 import textwrap
 import usb1
-from zlib import crc32
+from concurrent.futures import ThreadPoolExecutor
 
 from . import VID_CYPRESS, PID_FX2, FX2Config, FX2Device, FX2DeviceError
-from .format import input_data, output_data, diff_data
+from .sim import SimulatedFX2Device
+from .dfu import DFUDevice, DFUError, encode_dfu_suffix, decode_dfu_suffix
+from .format import input_data, output_data, diff_pages
+from .lz import compress_config
 
 
 class VID_PID(collections.namedtuple("VID_PID", "vid pid")):
@@ -103,6 +107,20 @@ def get_argparser():
     parser.add_argument(
         "-B", "--bootloader", action="store_true",
         help="load the second stage bootloader provided with fx2tool")
+    parser.add_argument(
+        "-A", "--all-devices", action="store_true",
+        help="perform the command on every device with the VID:PID pair at once "
+             "(only for load, program and update)")
+    parser.add_argument(
+        "-P", "--port", metavar="PATH", action="append",
+        help="perform the command on the device attached to the specified port, "
+             "e.g. 1-2.3 for port 3 of the hub on port 2 of bus 1; may be repeated "
+             "(implies --all-devices)")
+    parser.add_argument(
+        "--simulate", metavar="EEPROM-FILE", action="append",
+        help="operate on a simulated device instead, whose EEPROM contents are kept in "
+             "the specified file, and report the time it would take on stderr; may be "
+             "repeated to simulate several devices (implies --all-devices)")
 
     subparsers = parser.add_subparsers(dest="action", metavar="COMMAND")
     subparsers.required = True
@@ -220,6 +238,20 @@ def get_argparser():
             "-F", "--fast", dest="i2c_400khz", default=False, action="store_true",
             help="use 400 kHz clock for loading firmware via I2C")
 
+    def add_optimize_args(parser):
+        parser.add_argument(
+            "-O", "--optimize", default=False, action="store_true",
+            help="merge firmware records to minimize boot load time, and report it")
+        parser.add_argument(
+            "-Z", "--compress", default=False, action="store_true",
+            help="store the firmware compressed, and load it using the decompressor stage "
+                 "specified with --decompressor (FX2LP only; the firmware must not use "
+                 "code RAM above 0x3c00)")
+        parser.add_argument(
+            "--decompressor", metavar="FILENAME", type=argparse.FileType("rb"),
+            help="with --compress, use the specified decompressor stage, built from "
+                 "firmware/boot-lz (it is not provided with fx2tool)")
+
     p_program = subparsers.add_parser("program",
         formatter_class=TextHelpFormatter,
         help="program USB IDs or firmware",
@@ -228,6 +260,7 @@ def get_argparser():
     add_eeprom_args(p_program)
     add_eeprom_write_args(p_program)
     add_program_args(p_program)
+    add_optimize_args(p_program)
     p_program.add_argument(
         "-f", "--firmware", metavar="FILENAME", type=argparse.FileType("rb"),
         help="read firmware from the specified file")
@@ -267,6 +300,7 @@ def get_argparser():
     g_update_firmware.add_argument(
         "-n", "--no-firmware", default=False, action="store_true",
         help="remove any firmware present")
+    add_optimize_args(p_update)
 
     p_dump = subparsers.add_parser("dump",
         formatter_class=TextHelpFormatter,
@@ -285,6 +319,7 @@ def get_argparser():
         "into an image that can be flashed into the boot EEPROM using "
         "the UF2 firmware update protocol.")
     add_program_args(p_uf2)
+    add_optimize_args(p_uf2)
     p_uf2.add_argument(
         "firmware_file", metavar="FIRMWARE-FILE", type=argparse.FileType("rb"),
         help="read firmware from the specified file")
@@ -299,6 +334,7 @@ def get_argparser():
         "into an image that can be flashed into the boot EEPROM using "
         "the standard Device Firmware Update protocol.")
     add_program_args(p_dfu)
+    add_optimize_args(p_dfu)
     p_dfu.add_argument(
         "--dfu-pid", dest="dfu_product_id", metavar="ID", type=usb_id,
         help="DFU mode USB product ID (default: firmware product ID)")
@@ -309,9 +345,38 @@ def get_argparser():
         "dfu_file", metavar="DFU-FILE", type=argparse.FileType("wb"),
         help="write DFU image to the specified file")
 
+    dfu_note = textwrap.dedent("""
+    The device is selected with the --device option. If it is running the application
+    firmware, it is detached and the tool waits for it to re-enumerate in DFU mode.
+    """)
+
+    p_dfu_download = subparsers.add_parser("dfu-download",
+        formatter_class=TextHelpFormatter,
+        help="download a DFU firmware update image to a device",
+        description="Verifies the suffix of a DFU image, and downloads it to a device "
+        "using the Device Firmware Update protocol.\n" + dfu_note)
+    p_dfu_download.add_argument(
+        "dfu_file", metavar="DFU-FILE", type=argparse.FileType("rb"),
+        help="read DFU image from the specified file")
+
+    p_dfu_upload = subparsers.add_parser("dfu-upload",
+        formatter_class=TextHelpFormatter,
+        help="upload firmware from a device",
+        description="Uploads firmware from a device using the Device Firmware Update "
+        "protocol, and writes it as a DFU image.\n" + dfu_note)
+    p_dfu_upload.add_argument(
+        "dfu_file", metavar="DFU-FILE", type=argparse.FileType("wb"),
+        help="write DFU image to the specified file")
+
     return parser
 
 
+def eeprom_chunk_size(page_size):
+    # Write whole pages, and at least one packet worth of data, per request. The bootloader
+    # writes the EEPROM one packet at a time, so a request takes at most 64 write cycles.
+    return max(1 << page_size, 64)
+
+
 def read_entire_boot_eeprom(device, address_width):
     # We don't know how large the EEPROM is, so we use a heuristic tailored
     # for the C2 load: if we detect a chunk identical to the first chunk
@@ -332,12 +397,255 @@ def read_entire_boot_eeprom(device, address_width):
     return data
 
 
+def encode_config(config, args):
+    if args.optimize:
+        config.optimize()
+        if not args.compress:
+            print("Image size: {} bytes, load time: {:.0f} ms at 100 kHz, {:.0f} ms at 400 kHz"
+                  .format(len(config.encode()),
+                          config.load_time(i2c_400khz=False) * 1000,
+                          config.load_time(i2c_400khz=True) * 1000),
+                  file=sys.stderr)
+
+    payload = b""
+    if args.compress:
+        firmware_size = sum(len(chunk) for (addr, chunk) in config.firmware)
+        plain_time = config.load_time()
+        config, payload = compress_config(config, args.decompressor)
+        if args.optimize:
+            config.optimize()
+        print("Firmware size: {} bytes, compressed: {} bytes, image size: {} bytes"
+              .format(firmware_size, len(payload), len(config.encode()) + len(payload)),
+              file=sys.stderr)
+        # Decompression takes CPU time, and the stage itself must be loaded, so small or dense
+        # firmware may boot slower when compressed, especially at 400 kHz.
+        compressed_time = SimulatedFX2Device(config.encode() + payload).boot()
+        print("Estimated boot time: {:.0f} ms compressed, {:.0f} ms uncompressed"
+              .format(compressed_time * 1000, plain_time * 1000),
+              file=sys.stderr)
+        if compressed_time >= plain_time:
+            print("Warning: compression does not shorten the boot time of this firmware",
+                  file=sys.stderr)
+
+    return config, config.encode() + payload
+
+
+def verify_image(device, args, config, image):
+    # The compressed payload, if any, follows the configuration.
+    offset = len(config.encode())
+    read_image = device.read_boot_eeprom(0, len(image), args.address_width)
+    if FX2Config.decode(read_image) != config or read_image[offset:] != image[offset:]:
+        raise SystemExit("Verification failed")
+
+
+def program_device(device, args, firmware):
+    device.cpu_reset(False)
+
+    config = FX2Config(args.vendor_id, args.product_id, args.device_id,
+                       args.disconnect, args.i2c_400khz)
+    for address, chunk in firmware:
+        config.append(address, chunk)
+    config, image = encode_config(config, args)
+
+    device.write_boot_eeprom(0, image, args.address_width,
+                             chunk_size=eeprom_chunk_size(args.page_size),
+                             page_size=args.page_size)
+
+    verify_image(device, args, config, image)
+
+
+def update_device(device, args, firmware):
+    device.cpu_reset(False)
+
+    old_image = read_entire_boot_eeprom(device, args.address_width)
+
+    config = FX2Config.decode(old_image)
+    if config is None:
+        raise ValueError("Device erased; use the program command instead")
+    if args.vendor_id  is not None:
+        config.vendor_id  = args.vendor_id
+    if args.product_id is not None:
+        config.product_id = args.product_id
+    if args.device_id  is not None:
+        config.device_id  = args.device_id
+    if args.disconnect is not None:
+        config.disconnect = args.disconnect
+    if args.i2c_400khz is not None:
+        config.i2c_400khz = args.i2c_400khz
+    if firmware is not None:
+        config.firmware = []
+        for (addr, chunk) in firmware:
+            config.append(addr, chunk)
+    config, new_image = encode_config(config, args)
+
+    for (addr, chunk) in diff_pages(old_image, new_image, 1 << args.page_size):
+        device.write_boot_eeprom(addr, chunk, args.address_width,
+                                 chunk_size=eeprom_chunk_size(args.page_size),
+                                 page_size=args.page_size)
+
+    verify_image(device, args, config, new_image)
+
+
+def print_boot_time(simulated_device):
+    boot_time = simulated_device.boot()
+    if boot_time is not None:
+        print("Simulated boot time: {:.0f} ms".format(boot_time * 1000), file=sys.stderr)
+
+
+def read_simulated_eeprom(filename):
+    if os.path.exists(filename):
+        with open(filename, "rb") as f:
+            return f.read()
+
+
+def write_simulated_eeprom(filename, device):
+    with open(filename, "wb") as f:
+        f.write(device.usb.eeprom)
+
+
+def read_firmware(args):
+    # The firmware is read before any device is opened, since with --all-devices, it is
+    # written to several devices.
+    if args.action in ("load", "program", "update") and args.firmware:
+        return input_data(args.firmware, args.format)
+    elif args.action == "program" or (args.action == "update" and args.no_firmware):
+        return []
+    else:
+        return None
+
+
+def error_message(args, error):
+    if isinstance(error, usb1.USBErrorPipe):
+        if args.action in ["read_eeprom", "write_eeprom"]:
+            return "Command not acknowledged (wrong address width?)"
+        else:
+            return "Command not acknowledged"
+    elif isinstance(error, usb1.USBErrorTimeout):
+        if args.action in ["read_eeprom", "write_eeprom"]:
+            return "Command timeout (bootloader not loaded?)"
+        else:
+            return "Command timeout"
+    else:
+        return str(error)
+
+
+def perform_on_all_devices(devices, perform, args):
+    # Every device is handled by its own thread, but all of them share a libusb context,
+    # and the pipelined transfers of each device proceed while the others wait for USB.
+    # `devices` is a list of (name, device) pairs, where device is None if it was not found.
+    def perform_timed(device):
+        if device is None:
+            return "Device not found", 0.0
+        started = time.monotonic()
+        try:
+            perform(device)
+            result = None
+        except (usb1.USBError, FX2DeviceError, ValueError) as e:
+            result = error_message(args, e)
+        except SystemExit as e:
+            result = str(e)
+        except Exception as e:
+            # Any other failure is reported for this device only, so that the results of
+            # the rest are not lost.
+            result = "{}: {}".format(type(e).__name__, e)
+        if isinstance(device.usb, SimulatedFX2Device):
+            elapsed = device.usb.elapsed
+        else:
+            elapsed = time.monotonic() - started
+        return result, elapsed
+
+    with ThreadPoolExecutor(max_workers=len(devices)) as executor:
+        results = list(executor.map(perform_timed, (device for (name, device) in devices)))
+
+    failures = 0
+    for (name, device), (result, elapsed) in zip(devices, results):
+        print("{}: {} ({:.2f} s)".format(name, result or "OK", elapsed))
+        if result is not None:
+            failures += 1
+    if failures:
+        raise SystemExit("{} of {} devices failed".format(failures, len(devices)))
+
+
 def main():
     resource_dir = os.path.dirname(os.path.abspath(__file__))
     args = get_argparser().parse_args()
 
-    if args.action in ("uf2", "dfu"):
+    try:
+        if args.bootloader:
+            bootloader_ihex = os.path.join(resource_dir, "boot-cypress.ihex")
+            stage2 = input_data(open(bootloader_ihex, "rb"))
+        elif args.stage2:
+            stage2 = input_data(args.stage2)
+        else:
+            stage2 = None
+        firmware = read_firmware(args)
+        if getattr(args, "compress", False):
+            if args.action == "update" and firmware is None:
+                raise SystemExit("Compression requires firmware to be specified")
+            if not args.decompressor:
+                raise SystemExit("Compression requires a decompressor stage; "
+                                 "build firmware/boot-lz and specify --decompressor")
+            args.decompressor = input_data(args.decompressor)
+    except ValueError as e:
+        raise SystemExit(str(e))
+
+    if args.simulate and args.port:
+        raise SystemExit("Simulated devices are selected with --simulate, not --port")
+
+    if args.all_devices or args.port or (args.simulate and len(args.simulate) > 1):
+        if args.action not in ("load", "program", "update"):
+            raise SystemExit("Only load, program and update can be performed on all devices")
+        if args.simulate:
+            # Each simulated device is named after the file its EEPROM is kept in.
+            devices = [(filename,
+                        FX2Device(usb=SimulatedFX2Device(read_simulated_eeprom(filename))))
+                       for filename in args.simulate]
+        else:
+            vid, pid = args.device
+            usb_context = usb1.USBContext()
+            try:
+                devices = [(device.port_path, device)
+                           for device in FX2Device.find_all(vid, pid, port_paths=args.port,
+                                                            usb_context=usb_context)]
+            except FX2DeviceError as e:
+                usb_context.close()
+                raise SystemExit(e)
+            if args.port:
+                # Every requested port is reported, so that a missing device is not mistaken
+                # for a successful one.
+                found = {name: device for (name, device) in devices}
+                devices = [(port_path, found.get(port_path))
+                           for port_path in sorted(set(args.port))]
+            elif not devices:
+                usb_context.close()
+                raise SystemExit("No devices {:04x}:{:04x} found".format(vid, pid))
+        def perform(device):
+            if stage2 is not None:
+                device.load_ram(stage2)
+            if args.action == "load":
+                device.load_ram(firmware)
+            elif args.action == "program":
+                program_device(device, args, firmware)
+            elif args.action == "update":
+                update_device(device, args, firmware)
+
+        try:
+            perform_on_all_devices(devices, perform, args)
+        finally:
+            if args.simulate:
+                for filename, device in devices:
+                    write_simulated_eeprom(filename, device)
+            else:
+                for name, device in devices:
+                    if device is not None:
+                        device.usb.close()
+                usb_context.close()
+        return
+
+    if args.action in ("uf2", "dfu", "dfu-download", "dfu-upload"):
         device = None
+    elif args.simulate:
+        device = FX2Device(usb=SimulatedFX2Device(read_simulated_eeprom(args.simulate[0])))
     else:
         try:
             vid, pid = args.device
@@ -346,15 +654,11 @@ def main():
             raise SystemExit(e)
 
     try:
-        if device is not None:
-            if args.bootloader:
-                bootloader_ihex = os.path.join(resource_dir, "boot-cypress.ihex")
-                device.load_ram(input_data(open(bootloader_ihex, "rb")))
-            elif args.stage2:
-                device.load_ram(input_data(args.stage2))
+        if device is not None and stage2 is not None:
+            device.load_ram(stage2)
 
         if args.action == "load":
-            device.load_ram(input_data(args.firmware, args.format))
+            device.load_ram(firmware)
 
         elif args.action == "read_ram":
             device.cpu_reset(True)
@@ -388,72 +692,21 @@ def main():
             device.cpu_reset(False)
             for address, chunk in data:
                 device.write_boot_eeprom(address, chunk, args.address_width,
-                                         chunk_size=min(args.page_size * 4, 64),
+                                         chunk_size=eeprom_chunk_size(args.page_size),
                                          page_size=args.page_size)
 
         elif args.action == "reenumerate":
             device.reenumerate()
 
         elif args.action == "program":
-            device.cpu_reset(False)
-
-            if args.firmware:
-                firmware = input_data(args.firmware, args.format)
-            else:
-                firmware = []
-
-            config = FX2Config(args.vendor_id, args.product_id, args.device_id,
-                               args.disconnect, args.i2c_400khz)
-            for address, chunk in firmware:
-                config.append(address, chunk)
-            image = config.encode()
-
-            device.write_boot_eeprom(0, image, args.address_width,
-                                     chunk_size=min(args.page_size * 4, 64),
-                                     page_size=args.page_size)
-
-            image = device.read_boot_eeprom(0, len(image), args.address_width)
-            if FX2Config.decode(image) != config:
-                raise SystemExit("Verification failed")
+            program_device(device, args, firmware)
+            if args.simulate:
+                print_boot_time(device.usb)
 
         elif args.action == "update":
-            device.cpu_reset(False)
-
-            if args.firmware:
-                firmware = input_data(args.firmware, args.format)
-            elif args.no_firmware:
-                firmware = []
-            else:
-                firmware = None
-
-            old_image = read_entire_boot_eeprom(device, args.address_width)
-
-            config = FX2Config.decode(old_image)
-            if args.vendor_id  is not None:
-                config.vendor_id  = args.vendor_id
-            if args.product_id is not None:
-                config.product_id = args.product_id
-            if args.device_id  is not None:
-                config.device_id  = args.device_id
-            if args.disconnect is not None:
-                config.disconnect = args.disconnect
-            if args.i2c_400khz is not None:
-                config.i2c_400khz = args.i2c_400khz
-            if firmware is not None:
-                config.firmware = []
-                for (addr, chunk) in firmware:
-                    config.append(addr, chunk)
-
-            new_image = config.encode()
-
-            for (addr, chunk) in diff_data(old_image, new_image):
-                device.write_boot_eeprom(addr, chunk, args.address_width,
-                                         chunk_size=min(args.page_size * 4, 64),
-                                         page_size=args.page_size)
-
-            new_image = device.read_boot_eeprom(0, len(new_image), args.address_width)
-            if FX2Config.decode(new_image) != config:
-                raise SystemExit("Verification failed")
+            update_device(device, args, firmware)
+            if args.simulate:
+                print_boot_time(device.usb)
 
         elif args.action == "dump":
             device.cpu_reset(False)
@@ -486,7 +739,7 @@ def main():
                                args.disconnect, args.i2c_400khz)
             for address, chunk in input_data(args.firmware_file, args.format):
                 config.append(address, chunk)
-            image = config.encode()
+            config, image = encode_config(config, args)
 
             UF2_MAGIC_START_0           = 0x0A324655
             UF2_MAGIC_START_1           = 0x9E5D5157
@@ -525,37 +778,45 @@ def main():
                                args.disconnect, args.i2c_400khz)
             for address, chunk in input_data(args.firmware_file, args.format):
                 config.append(address, chunk)
-            image = config.encode()
-
-            suffix = struct.pack(">BBBBHHHH",
-                struct.calcsize(">LBBBBHHHH"),
-                0x44, 0x46, 0x55, # ucDfuSignature
-                0x0100, # bcdDFU
-                args.vendor_id,
-                args.dfu_product_id or args.product_id,
-                args.device_id)
-            image += bytes(reversed(suffix))
-            image += struct.pack("<L", crc32(image) ^ 0xffffffff)
+            config, image = encode_config(config, args)
+
+            image = encode_dfu_suffix(image, args.vendor_id,
+                                      args.dfu_product_id or args.product_id,
+                                      args.device_id)
 
             args.dfu_file.write(image)
 
-    except usb1.USBErrorPipe:
-        if args.action in ["read_eeprom", "write_eeprom"]:
-            raise SystemExit("Command not acknowledged (wrong address width?)")
-        else:
-            raise SystemExit("Command not acknowledged")
+        elif args.action == "dfu-download":
+            image, vendor_id, product_id, device_id = decode_dfu_suffix(args.dfu_file.read())
+            if vendor_id not in (0xffff, args.device.vid):
+                raise SystemExit("DFU image is intended for a device with VID {:04x}"
+                                 .format(vendor_id))
 
-    except usb1.USBErrorTimeout:
-        if args.action in ["read_eeprom", "write_eeprom"]:
-            raise SystemExit("Command timeout (bootloader not loaded?)")
-        else:
-            raise SystemExit("Command timeout")
+            with usb1.USBContext() as usb_context:
+                dfu_device = DFUDevice.open(usb_context, args.device.vid, args.device.pid,
+                    dfu_product_id=None if product_id == 0xffff else product_id)
+                dfu_device.download(image)
 
-    except ValueError as e:
+        elif args.action == "dfu-upload":
+            with usb1.USBContext() as usb_context:
+                dfu_device = DFUDevice.open(usb_context, args.device.vid, args.device.pid)
+                image = dfu_device.upload()
+
+            args.dfu_file.write(encode_dfu_suffix(image, args.device.vid, args.device.pid))
+
+    except (usb1.USBErrorPipe, usb1.USBErrorTimeout) as e:
+        raise SystemExit(error_message(args, e))
+
+    except (ValueError, DFUError) as e:
         raise SystemExit(str(e))
 
     finally:
-        if device is not None:
+        if device is not None and args.simulate:
+            write_simulated_eeprom(args.simulate[0], device)
+            print("Simulated time: {:.3f} s ({} requests, {} EEPROM write cycles)"
+                  .format(device.usb.elapsed, device.usb.requests, device.usb.write_cycles),
+                  file=sys.stderr)
+        elif device is not None:
             device.usb_context.close()
 
 
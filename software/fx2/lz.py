@@ -0,0 +1,203 @@
+import re
+import struct
+
+from . import FX2Config
+
+
+__all__ = ["compress", "decompress", "encode_payload", "decode_payload", "compress_config"]
+
+
+SIGNATURE    = b"LZ"
+
+MIN_MATCH    = 3
+MAX_MATCH    = MIN_MATCH + 0xf
+MAX_DISTANCE = 0x1000
+
+_LITERAL_COST = 9  # bits, including the flag bit
+_MATCH_COST   = 17 # bits, including the flag bit
+
+
+def _longest_matches(data, max_candidates):
+    # For every position, find the longest match that starts at most MAX_DISTANCE bytes
+    # before it, using a hash chain of the positions of every 3-byte prefix.
+    matches = [(0, 0)] * len(data)
+    chains  = {}
+    for pos in range(len(data) - MIN_MATCH + 1):
+        prefix = data[pos:pos + MIN_MATCH]
+        chain  = chains.setdefault(prefix, [])
+        best_length, best_distance = 0, 0
+        limit = min(MAX_MATCH, len(data) - pos)
+        for candidate in reversed(chain[-max_candidates:]):
+            distance = pos - candidate
+            if distance > MAX_DISTANCE:
+                break
+            length = MIN_MATCH
+            while length < limit and data[candidate + length] == data[pos + length]:
+                length += 1
+            if length > best_length:
+                best_length, best_distance = length, distance
+                if length == limit:
+                    break
+        matches[pos] = (best_length, best_distance)
+        chain.append(pos)
+    return matches
+
+
+def compress(data, max_candidates=256):
+    """
+    Compress ``data`` into the LZSS format understood by the ``boot-lz`` stage, and return
+    the result. The matches are chosen such that the compressed data is as short as possible;
+    ``max_candidates`` limits the number of earlier occurrences of every 3-byte sequence
+    that are considered.
+    """
+    data    = bytes(data)
+    matches = _longest_matches(data, max_candidates)
+
+    # Since every match can also be used at any shorter length, the shortest encoding is found
+    # by going backwards and picking the cheapest item at each position.
+    cost   = [0] * (len(data) + 1)
+    choice = [0] * len(data)
+    for pos in range(len(data) - 1, -1, -1):
+        cost[pos], choice[pos] = cost[pos + 1] + _LITERAL_COST, 0
+        match_length, _ = matches[pos]
+        for length in range(MIN_MATCH, match_length + 1):
+            if cost[pos + length] + _MATCH_COST < cost[pos]:
+                cost[pos], choice[pos] = cost[pos + length] + _MATCH_COST, length
+
+    output = bytearray()
+    flags_pos, flag_bit = None, 8
+    pos = 0
+    while pos < len(data):
+        if flag_bit == 8:
+            flags_pos, flag_bit = len(output), 0
+            output.append(0)
+        length = choice[pos]
+        if length:
+            output[flags_pos] |= 1 << flag_bit
+            output += struct.pack(">H", ((length - MIN_MATCH) << 12) | (matches[pos][1] - 1))
+            pos += length
+        else:
+            output.append(data[pos])
+            pos += 1
+        flag_bit += 1
+    return bytes(output)
+
+
+def decompress(data, length, offset=0):
+    """
+    Decompress ``length`` bytes from the LZSS format at ``offset`` in ``data``, and return
+    a ``(output, offset)`` tuple, where ``offset`` points past the compressed data.
+    Raises :class:`ValueError` if the compressed data is invalid.
+    """
+    output = bytearray()
+    flags, flag_bit = 0, 8
+    try:
+        while len(output) < length:
+            if flag_bit == 8:
+                flags, flag_bit = data[offset], 0
+                offset += 1
+            if flags & (1 << flag_bit):
+                match, = struct.unpack_from(">H", data, offset)
+                offset += 2
+                match_length, distance = (match >> 12) + MIN_MATCH, (match & 0xfff) + 1
+                if distance > len(output) or len(output) + match_length > length:
+                    raise ValueError("Invalid match at offset {}".format(offset - 2))
+                # The match may overlap the data it produces.
+                for _ in range(match_length):
+                    output.append(output[-distance])
+            else:
+                output.append(data[offset])
+                offset += 1
+            flag_bit += 1
+    except (IndexError, struct.error):
+        raise ValueError("Truncated compressed data")
+    return bytes(output), offset
+
+
+def encode_payload(chunks, entry=0x0000, max_gap=64):
+    """
+    Compress a list of ``(addr, chunk)`` pairs, such as :attr:`fx2.FX2Config.firmware`,
+    into the payload loaded by the ``boot-lz`` stage, which jumps to ``entry`` afterwards.
+
+    Every segment costs a header, while a run of zeroes compresses to a few bytes, so chunks
+    separated by at most ``max_gap`` unused bytes are merged, with the unused bytes filled
+    with zeroes.
+    """
+    image   = bytearray(0x10000)
+    present = bytearray(0x10000)
+    for (addr, chunk) in chunks:
+        image[addr:addr + len(chunk)] = chunk
+        present[addr:addr + len(chunk)] = b"\x01" * len(chunk)
+
+    runs = []
+    for match in re.finditer(rb"\x01+", present):
+        if runs and match.start() - runs[-1][1] <= max_gap:
+            runs[-1][1] = match.end()
+        else:
+            runs.append([match.start(), match.end()])
+
+    payload = bytearray(SIGNATURE)
+    for (start, end) in runs:
+        payload += struct.pack(">HH", end - start, start)
+        payload += compress(image[start:end])
+    payload += struct.pack(">HH", 0x8000, entry)
+    return bytes(payload)
+
+
+def decode_payload(data, offset=0):
+    """
+    Decompress the payload loaded by the ``boot-lz`` stage at ``offset`` in ``data``, and
+    return a ``(chunks, entry, length)`` tuple, where ``length`` is the size of the payload.
+    Raises :class:`ValueError` if there is no valid payload.
+    """
+    start = offset
+    if bytes(data[offset:offset + len(SIGNATURE)]) != SIGNATURE:
+        raise ValueError("No compressed payload")
+    offset += len(SIGNATURE)
+
+    chunks = []
+    while True:
+        if offset + 4 > len(data):
+            raise ValueError("Truncated compressed payload")
+        length, addr = struct.unpack_from(">HH", data, offset)
+        offset += 4
+        if length & 0x8000:
+            return chunks, addr, offset - start
+        chunk, offset = decompress(data, length, offset)
+        chunks.append((addr, chunk))
+
+
+def compress_config(config, stage):
+    """
+    Split ``config`` into an :class:`fx2.FX2Config` that loads the ``stage`` firmware
+    (a list of ``(addr, chunk)`` pairs of the ``boot-lz`` stage), and the compressed payload
+    with the firmware of ``config``, which must be appended to the EEPROM image of the former.
+    Returns a ``(stage_config, payload)`` tuple.
+
+    The stage is linked at the top of the code RAM (``CODE_LOC``), where SDCC places its reset
+    vector, which is a ``LJMP`` to the startup code; a jump to it is placed at the reset vector
+    of the CPU. The stage keeps its buffer in the scratch RAM at ``0xE000``. Raises
+    :class:`ValueError` if the stage does not start with a ``LJMP``, or if the firmware overlaps
+    either of them.
+
+    The ``boot-lz`` stage is not provided with this package, and has not yet been verified
+    on hardware.
+    """
+    stage_first = min(addr for (addr, chunk) in stage)
+    stage_last  = max(addr + len(chunk) for (addr, chunk) in stage) - 1
+    if next(chunk for (addr, chunk) in stage if addr == stage_first)[0] != 0x02:
+        raise ValueError("Decompressor does not start with its reset vector at {:04x}"
+                         .format(stage_first))
+    for (addr, chunk) in config.firmware:
+        if addr <= stage_last and addr + len(chunk) > stage_first:
+            raise ValueError("Firmware overlaps the decompressor at {:04x}-{:04x}"
+                             .format(stage_first, stage_last))
+        if addr >= 0xE000:
+            raise ValueError("Firmware in scratch RAM cannot be compressed")
+
+    stage_config = FX2Config(config.vendor_id, config.product_id, config.device_id,
+                             config.disconnect, config.i2c_400khz)
+    stage_config.append(0x0000, struct.pack(">BH", 0x02, stage_first)) # LJMP
+    for (addr, chunk) in stage:
+        stage_config.append(addr, chunk)
+    return stage_config, encode_payload(config.firmware)
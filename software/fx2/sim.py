@@ -0,0 +1,461 @@
+import time
+import struct
+import usb1
+
+from . import (REG_CPUCS, REQ_RAM, REQ_EEPROM_SB, REQ_EXT_RAM, REQ_RENUMERATE, REQ_EEPROM_DB,
+               REQ_PAGE_SIZE, REQ_BULK_CMD, FX2Config)
+from .lz import SIGNATURE as LZ_SIGNATURE, decode_payload
+from .dfu import (REQ_DNLOAD, REQ_UPLOAD, REQ_GETSTATUS, REQ_CLRSTATUS, REQ_GETSTATE,
+                  REQ_ABORT, STATE_dfuIDLE, STATE_dfuDNLOAD_SYNC, STATE_dfuDNBUSY,
+                  STATE_dfuDNLOAD_IDLE, STATE_dfuMANIFEST_SYNC, STATE_dfuMANIFEST,
+                  STATE_dfuUPLOAD_IDLE, STATE_dfuERROR, STATUS_OK)
+
+
+__all__ = ["SimulatedFX2Device", "SimulatedDFUDevice"]
+
+
+STATUS_errADDRESS    = 8
+STATUS_errSTALLEDPKT = 15
+
+
+class SimulatedFX2Device:
+    """
+    A simulation of an FX2 device with a boot EEPROM, for testing and benchmarking
+    :class:`fx2.FX2Device` and ``fx2tool`` without hardware. It implements the methods of
+    :class:`usb1.USBDeviceHandle` that :class:`fx2.FX2Device` uses, and is passed to it as
+    the ``usb`` handle.
+
+    The simulated ROM implements the ``0xA0`` request for accessing the on-chip RAM
+    and the ``CPUCS`` register. Whatever firmware is loaded into the RAM is assumed to
+    implement the vendor requests of the ``boot-cypress`` second stage bootloader once
+    the CPU is brought out of reset; until then, these requests are stalled.
+
+    The EEPROM is written the same way as by ``boot-cypress``: each packet is split at
+    the boundaries of the pages set by the ``0xB0`` request, and each part takes one write
+    cycle. If that page size is larger than ``page_size``, the writes wrap around within
+    the EEPROM page, like they do in a real EEPROM.
+
+    If ``bulk_loader`` is ``True``, the bulk command channel of ``boot-cypress`` is
+    implemented as well, on endpoints ``0x02`` and ``0x86`` of the alternate setting 1.
+    This is disabled by default, since the ``boot-cypress.ihex`` provided with this package
+    has not been rebuilt with that channel yet.
+
+    The time the simulated operations would take is accumulated in ``elapsed``; if
+    ``realtime`` is ``True``, the simulation also sleeps for that long.
+
+    The time it takes to start up from the EEPROM is estimated by :meth:`boot`.
+
+    eeprom : bytearray
+        Contents of the simulated EEPROM.
+    ram : bytearray
+        Contents of the 64 KiB address space accessible with the ``movx`` instruction.
+    address_width : int
+        Address width of the EEPROM, in bytes; the requests for the other address width
+        are stalled.
+    page_size : int
+        Size of an EEPROM page, in bytes.
+    write_time : float
+        Duration of an EEPROM write cycle, in seconds.
+    round_trip : float
+        Duration of a USB control or bulk transfer, in seconds, excluding the data packets.
+    ep0_packet_time : float
+        Duration of a 64-byte data packet of a request handled by the second stage
+        bootloader, which copies and acknowledges every packet, in seconds.
+    bulk_packet_time : float
+        Duration of a 512-byte bulk packet, in seconds.
+    requests : int
+        Number of control transfers issued to the device.
+    write_cycles : int
+        Number of EEPROM write cycles performed.
+    elapsed : float
+        Total simulated time, in seconds.
+    """
+    def __init__(self, eeprom=None, eeprom_size=16384, address_width=2, page_size=64,
+                 write_time=0.005, round_trip=0.000250, ep0_packet_time=0.000050,
+                 bulk_packet_time=0.000012, bulk_loader=False, realtime=False):
+        if eeprom is None:
+            eeprom = b"\xff" * eeprom_size
+        self.eeprom         = bytearray(eeprom)
+        self.ram            = bytearray(0x10000)
+        self.address_width  = address_width
+        self.page_size      = page_size
+        self.write_time     = write_time
+        self.round_trip     = round_trip
+        self.ep0_packet_time  = ep0_packet_time
+        self.bulk_packet_time = bulk_packet_time
+        self.bulk_loader    = bulk_loader
+        self.realtime       = realtime
+        self.requests       = 0
+        self.write_cycles   = 0
+        self.elapsed        = 0.0
+
+        self.ram[REG_CPUCS] = 1
+        self._running       = False
+        self._loaded        = False
+        self._host_page_log = 0
+        self._alt_setting   = 0
+        self._bulk_write    = None
+        self._bulk_in       = []
+
+    def _spend(self, duration):
+        self.elapsed += duration
+        if self.realtime:
+            time.sleep(duration)
+
+    def _request(self, request, length=0):
+        self.requests += 1
+        self._spend(self.round_trip)
+
+        if request == REQ_RAM:
+            return
+        if not self._running:
+            raise usb1.USBErrorPipe()
+        if request in (REQ_EEPROM_SB, REQ_EEPROM_DB):
+            if not self._eeprom_width_ok(request):
+                raise usb1.USBErrorPipe()
+        elif request == REQ_BULK_CMD:
+            if not self.bulk_loader:
+                raise usb1.USBErrorPipe()
+        elif request not in (REQ_EXT_RAM, REQ_RENUMERATE, REQ_PAGE_SIZE):
+            raise usb1.USBErrorPipe()
+        self._spend(-(-length // 64) * self.ep0_packet_time)
+
+    def _eeprom_width_ok(self, request):
+        width = 1 if request == REQ_EEPROM_SB else 2
+        return width == self.address_width
+
+    def _eeprom_write(self, addr, data):
+        # Like the firmware, split the packet at the page boundaries it assumes.
+        host_page = 1 << self._host_page_log
+        pos = 0
+        while pos < len(data):
+            length = min(host_page - addr % host_page, len(data) - pos)
+            for offset in range(length):
+                # The EEPROM latches the upper address bits at the start of the write,
+                # and increments only the address within the page.
+                page_base = addr - addr % self.page_size
+                byte_addr = page_base + (addr + offset) % self.page_size
+                self.eeprom[byte_addr % len(self.eeprom)] = data[pos + offset]
+            self.write_cycles += 1
+            self._spend(self.write_time)
+            addr = (addr + length) & 0xffff
+            pos += length
+
+    def _eeprom_read(self, addr, length):
+        return bytes(self.eeprom[(addr + offset) % len(self.eeprom)]
+                     for offset in range(length))
+
+    def controlWrite(self, request_type, request, value, index, data, timeout=0):
+        data = bytes(data)
+        self._request(request, len(data))
+
+        if request == REQ_RAM:
+            self.ram[value:value + len(data)] = data
+            if value <= REG_CPUCS < value + len(data):
+                is_reset = self.ram[REG_CPUCS] & 1
+                if is_reset:
+                    self._running = False
+                elif self._loaded:
+                    self._running = True
+            elif self.ram[REG_CPUCS] & 1:
+                self._loaded = True
+
+        elif request in (REQ_EEPROM_SB, REQ_EEPROM_DB):
+            # The bootloader receives the data stage one packet at a time.
+            for pos in range(0, len(data), 64):
+                self._eeprom_write((value + pos) & 0xffff, data[pos:pos + 64])
+
+        elif request == REQ_EXT_RAM:
+            self.ram[value:value + len(data)] = data
+
+        elif request == REQ_PAGE_SIZE:
+            self._host_page_log = value
+
+        return len(data)
+
+    def controlRead(self, request_type, request, value, index, length, timeout=0):
+        self._request(request, length)
+
+        if request == REQ_RAM:
+            # The ROM reads the RAM in 16-bit words, so an unaligned read starts at
+            # the preceding even address.
+            value &= ~1
+            return bytes(self.ram[value:value + length])
+
+        elif request in (REQ_EEPROM_SB, REQ_EEPROM_DB):
+            return self._eeprom_read(value, length)
+
+        elif request == REQ_EXT_RAM:
+            return bytes(self.ram[value:value + length])
+
+        elif request == REQ_BULK_CMD:
+            return bytes([0x02, 0x86])[:length]
+
+        raise usb1.USBErrorPipe()
+
+    # Each read of the boot-lz stage takes a start condition, the chip address, two address
+    # bytes, and a repeated start condition with the chip address.
+    LZ_READ_SIZE     = 256
+    LZ_READ_OVERHEAD = 5
+    # This is a guess that has not been measured on hardware: inflating a byte is assumed
+    # to take about 50 instruction cycles, with the core running at 48 MHz.
+    LZ_TIME_PER_BYTE = 4e-6
+
+    def boot(self):
+        """
+        Load the firmware from the EEPROM into the RAM, the same way as the boot ROM does,
+        and if the firmware is followed by a payload compressed by
+        :func:`fx2.lz.compress_config`, also as the ``boot-lz`` stage does. Returns
+        the estimated time it takes, in seconds, or ``None`` if no firmware is loaded.
+
+        Every byte read from the EEPROM takes nine I2C clock cycles; the time it takes to run
+        the ``boot-lz`` stage is estimated as ``LZ_TIME_PER_BYTE`` per decompressed byte,
+        which is a rough guess rather than a measured figure.
+        """
+        config = FX2Config.decode(self.eeprom)
+        if config is None or not config.firmware:
+            return None
+
+        for (addr, chunk) in config.firmware:
+            self.ram[addr:addr + len(chunk)] = chunk
+        offset = len(config.encode())
+        i2c_bytes = offset
+        cpu_time  = 0.0
+
+        if self.eeprom[offset:offset + len(LZ_SIGNATURE)] == LZ_SIGNATURE:
+            chunks, entry, length = decode_payload(self.eeprom, offset)
+            # The stage finds the payload by reading the header of every record.
+            i2c_bytes += (len(config.firmware) + 1) * (self.LZ_READ_OVERHEAD + 4)
+            reads = -(-length // self.LZ_READ_SIZE)
+            i2c_bytes += reads * (self.LZ_READ_OVERHEAD + self.LZ_READ_SIZE)
+            for (addr, chunk) in chunks:
+                self.ram[addr:addr + len(chunk)] = chunk
+                cpu_time += len(chunk) * self.LZ_TIME_PER_BYTE
+
+        i2c_clock = 400e3 if config.i2c_400khz else 100e3
+        return i2c_bytes * 9 / i2c_clock + cpu_time
+
+    def _bulk_transfer(self, endpoint, length):
+        self.requests += 1
+        self._spend(self.round_trip + max(1, -(-length // 512)) * self.bulk_packet_time)
+        if (not self.bulk_loader or not self._running or self._alt_setting != 1 or
+                endpoint not in (0x02, 0x86)):
+            raise usb1.USBErrorPipe()
+
+    def _bulk_command(self, header):
+        request_type, request, addr, index, length = struct.unpack("<BBHHH", header)
+        if request in (REQ_EEPROM_SB, REQ_EEPROM_DB):
+            is_valid = self._eeprom_width_ok(request)
+        else:
+            is_valid = request == REQ_EXT_RAM
+
+        if not request_type & usb1.ENDPOINT_IN:
+            if length > 0:
+                self._bulk_write = [request, addr, length, is_valid]
+            else:
+                self._bulk_in.append(bytes([not is_valid]))
+        elif not is_valid:
+            self._bulk_in += [b"", b"\x01"]
+        elif request == REQ_EXT_RAM:
+            self._bulk_in += [bytes(self.ram[addr:addr + length]), b"\x00"]
+        else:
+            self._bulk_in += [self._eeprom_read(addr, length), b"\x00"]
+
+    def bulkWrite(self, endpoint, data, timeout=0):
+        self._bulk_transfer(endpoint, len(data))
+        data = bytes(data)
+
+        if self._bulk_write is None:
+            # Anything but a command header is discarded.
+            if len(data) == 8:
+                self._bulk_command(data)
+            return len(data)
+
+        request, addr, length, is_valid = self._bulk_write
+        chunk = data[:length]
+        if is_valid and request == REQ_EXT_RAM:
+            self.ram[addr:addr + len(chunk)] = chunk
+        elif is_valid:
+            # The bootloader writes the EEPROM one packet at a time.
+            for pos in range(0, len(chunk), 512):
+                self._eeprom_write((addr + pos) & 0xffff, chunk[pos:pos + 512])
+        self._bulk_write = [request, (addr + len(chunk)) & 0xffff, length - len(chunk),
+                            is_valid]
+        if length == len(chunk):
+            self._bulk_write = None
+            self._bulk_in.append(bytes([not is_valid]))
+        return len(data)
+
+    def bulkRead(self, endpoint, length, timeout=0):
+        data = self._bulk_in[0][:length] if self._bulk_in else b""
+        self._bulk_transfer(endpoint, len(data))
+        if not self._bulk_in:
+            raise usb1.USBErrorTimeout()
+        self._bulk_in.pop(0)
+        return data
+
+    def claimInterface(self, interface):
+        pass
+
+    def setInterfaceAltSetting(self, interface, alt_setting):
+        self._alt_setting = alt_setting
+
+    def setAutoDetachKernelDriver(self, enable):
+        pass
+
+
+class SimulatedDFUDevice:
+    """
+    A simulation of a device in DFU mode that implements the protocol the same way
+    as ``fx2usbdfu.h``, backed by a byte array, for testing DFU clients without hardware.
+    It implements the ``controlRead`` and ``controlWrite`` methods of
+    :class:`usb1.USBDeviceHandle`, and can be passed to :class:`fx2.dfu.DFUDevice`.
+
+    Writing a block takes ``write_time`` seconds, during which the device reports the
+    ``dfuDNBUSY`` state, and the time the previous block took in ``bwPollTimeout``.
+    If ``dnload_buffer`` is ``True``, the device has a second block buffer, like
+    the firmware with the ``dnload_buffer`` field set: it reports ``dfuDNLOAD-IDLE``
+    as soon as a block is received, and receives the next block while writing the previous
+    one. In this case, an error writing a block is reported by stalling the next request.
+
+    memory : bytearray
+        Contents of the simulated firmware storage.
+    requests : list
+        All requests issued to the device, as ``(request, value, length)`` tuples.
+    """
+    def __init__(self, size=16384, transfer_size=512, write_time=0.005, dnload_buffer=False):
+        self.memory        = bytearray(b"\xff" * size)
+        self.transfer_size = transfer_size
+        self.write_time    = write_time
+        self.dnload_buffer = dnload_buffer
+        self.requests      = []
+        self.manifested    = False
+
+        self._state        = STATE_dfuIDLE
+        self._status       = STATUS_OK
+        self._offset       = 0
+        self._poll_timeout = 0
+        self._received     = None
+        self._busy         = None
+        self._busy_until   = 0
+
+    def _stall(self):
+        # Like the firmware, keep the status of an earlier error, such as a failed write.
+        if self._state != STATE_dfuERROR:
+            self._status = STATUS_errSTALLEDPKT
+        self._state  = STATE_dfuERROR
+        raise usb1.USBErrorPipe()
+
+    def _start_write(self):
+        self._busy, self._received = self._received, None
+        self._busy_until = time.monotonic() + self.write_time
+        if self.dnload_buffer:
+            self._state = STATE_dfuDNLOAD_IDLE
+        else:
+            self._state = STATE_dfuDNBUSY
+
+    def _finish_write(self, wait=False):
+        # The firmware writes a block in its main loop, and keeps responding to requests
+        # meanwhile; the write is finished by the first request after it takes ``write_time``.
+        if self._busy is None:
+            return
+        delay = self._busy_until - time.monotonic()
+        if delay > 0:
+            if not wait:
+                return
+            time.sleep(delay)
+
+        data, self._busy = self._busy, None
+        self._poll_timeout = max(1, round(self.write_time * 1000))
+        if self._offset + len(data) > len(self.memory):
+            self._status = STATUS_errADDRESS
+            self._state  = STATE_dfuERROR
+            return
+        self.memory[self._offset:self._offset + len(data)] = data
+        self._offset += len(data)
+        if self._state == STATE_dfuDNBUSY:
+            if self.dnload_buffer:
+                # The next block has been received while this one was being written.
+                self._start_write()
+            else:
+                self._state = STATE_dfuDNLOAD_IDLE
+
+    def controlWrite(self, request_type, request, value, index, data, timeout=0):
+        self.requests.append((request, value, len(data)))
+        self._finish_write()
+
+        if request == REQ_DNLOAD and len(data) <= self.transfer_size:
+            if self._state == STATE_dfuIDLE and len(data) > 0 and self._busy is None:
+                self._offset       = 0
+                self._poll_timeout = 0
+                self._received     = bytes(data)
+                self._state        = STATE_dfuDNLOAD_SYNC
+                return len(data)
+            elif self._state == STATE_dfuDNLOAD_IDLE and len(data) > 0:
+                self._received = bytes(data)
+                self._state    = STATE_dfuDNLOAD_SYNC
+                return len(data)
+            elif self._state == STATE_dfuDNLOAD_IDLE:
+                self._state = STATE_dfuMANIFEST_SYNC
+                return 0
+
+        elif request == REQ_CLRSTATUS and self._state == STATE_dfuERROR:
+            self._status = STATUS_OK
+            self._state  = STATE_dfuIDLE
+            return 0
+
+        elif request == REQ_ABORT and self._state in (STATE_dfuIDLE, STATE_dfuDNLOAD_SYNC,
+                                                      STATE_dfuDNLOAD_IDLE,
+                                                      STATE_dfuMANIFEST_SYNC,
+                                                      STATE_dfuUPLOAD_IDLE):
+            self._state = STATE_dfuIDLE
+            return 0
+
+        self._stall()
+
+    def controlRead(self, request_type, request, value, index, length, timeout=0):
+        self.requests.append((request, value, length))
+        self._finish_write()
+
+        if request == REQ_GETSTATUS and length == 6:
+            if self._state == STATE_dfuDNLOAD_SYNC:
+                if self._busy is not None:
+                    self._state = STATE_dfuDNBUSY
+                else:
+                    self._start_write()
+            elif self._state == STATE_dfuMANIFEST_SYNC:
+                # The last block is written before manifestation; if that fails, the firmware
+                # stalls this request.
+                self._finish_write(wait=True)
+                if self._state == STATE_dfuERROR:
+                    self._stall()
+                self._state = STATE_dfuMANIFEST
+            elif self._state == STATE_dfuMANIFEST:
+                self.manifested = True
+                self._state = STATE_dfuIDLE
+
+            if self._state == STATE_dfuDNBUSY:
+                poll_timeout = self._poll_timeout or 10
+            elif self._state == STATE_dfuDNLOAD_IDLE:
+                poll_timeout = 0
+            else:
+                poll_timeout = 10
+            return struct.pack("<BBHBB", self._status, poll_timeout & 0xff,
+                               poll_timeout >> 8, self._state, 0)
+
+        elif request == REQ_GETSTATE and length == 1:
+            return bytes([self._state])
+
+        elif request == REQ_UPLOAD and length <= self.transfer_size:
+            if self._state == STATE_dfuIDLE:
+                self._finish_write(wait=True)
+                self._offset = 0
+                self._state  = STATE_dfuUPLOAD_IDLE
+            if self._state == STATE_dfuUPLOAD_IDLE:
+                data = bytes(self.memory[self._offset:self._offset + length])
+                self._offset += len(data)
+                if len(data) < length:
+                    self._state = STATE_dfuIDLE
+                return data
+
+        self._stall()
@@ -0,0 +1,318 @@
+import collections
+import usb1
+
+from . import _transfer_error
+
+
+__all__ = ["BulkReader", "BulkWriter"]
+
+
+class _BulkStream:
+    def __init__(self, device, endpoint, transfer_size, transfer_count, timeout):
+        if transfer_size <= 0 or transfer_count <= 0:
+            raise ValueError("Transfer size and count must be positive")
+
+        self.endpoint            = endpoint
+        self.transfer_size       = transfer_size
+        self.bytes_transferred   = 0
+        self.transfers_completed = 0
+
+        self._context   = device.usb_context
+        self._buffers   = [bytearray(transfer_size) for _ in range(transfer_count)]
+        self._transfers = []
+        for index, buffer in enumerate(self._buffers):
+            transfer = device.usb.getTransfer()
+            transfer.setBulk(endpoint, buffer, callback=self._callback, user_data=index,
+                             timeout=timeout)
+            self._transfers.append(transfer)
+        self._completed = collections.deque()
+        self._pending   = 0
+        self._running   = False
+        self._error     = None
+
+    def _submit(self, transfer):
+        transfer.submit()
+        self._pending += 1
+
+    def _callback(self, transfer):
+        self._pending -= 1
+        status = transfer.getStatus()
+        if status == usb1.TRANSFER_CANCELLED:
+            return
+        if status == usb1.TRANSFER_COMPLETED:
+            self.transfers_completed += 1
+            if self._pending == 0 and self._running:
+                self._starved()
+        # A failed transfer is handed to the application in order as well, so that it stays
+        # in the ring, and the data it transferred before failing is not lost.
+        self._completed.append(transfer)
+
+    def _check_error(self):
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise error
+
+    def _wait(self):
+        # Process events until at least one transfer completes.
+        while not self._completed:
+            self._check_error()
+            if self._pending == 0:
+                raise ValueError("No transfers are pending")
+            self._context.handleEvents()
+        self._check_error()
+
+    def _drain(self):
+        # Process events until all transfers complete.
+        while self._pending > 0:
+            self._context.handleEvents()
+        self._check_error()
+
+    def stop(self):
+        """
+        Cancel all pending transfers and wait until they are retired. Data received by
+        the cancelled transfers is discarded.
+        """
+        self._running = False
+        for transfer in self._transfers:
+            if transfer.isSubmitted():
+                try:
+                    transfer.cancel()
+                except usb1.USBErrorNotFound:
+                    pass # already completed
+        while self._pending > 0:
+            self._context.handleEvents()
+
+    def close(self):
+        """Stop the stream and release the transfers."""
+        self.stop()
+        for transfer in self._transfers:
+            transfer.close()
+        self._transfers = []
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+
+class BulkReader(_BulkStream):
+    """
+    A continuous reader of an IN bulk endpoint, for streaming data produced by the device,
+    e.g. by slave FIFO or GPIF capture firmware.
+
+    ``transfer_count`` transfers of ``transfer_size`` bytes each are kept pending on
+    the endpoint at all times, except while the application holds on to the data; each
+    transfer has its own buffer, and the data is delivered as a :class:`memoryview` of that
+    buffer, without copying. For sustained high-speed throughput, ``transfer_size`` should be
+    at least 64 KiB, and the application should return to the reader within the time it takes
+    to fill ``transfer_count - 1`` transfers. The throughput that can be sustained depends on
+    the host controller and on the application, and has not been measured against
+    a particular target.
+
+    The reader is used as a context manager, either as an iterator::
+
+        with BulkReader(device, 0x86) as reader:
+            for data in reader:
+                output.write(data)
+
+    or with a callback::
+
+        with BulkReader(device, 0x86) as reader:
+            reader.run(lambda data: output.write(data) > 0)
+
+    endpoint : int
+        Endpoint address, including the direction bit.
+    transfer_size : int
+        Size of each transfer; should be a multiple of the maximum packet size.
+    bytes_transferred : int
+        Number of bytes delivered to the application so far.
+    transfers_completed : int
+        Number of transfers completed so far.
+    overruns : int
+        Number of times every transfer was completed while the application was holding on to
+        the data, such that no transfer was pending on the endpoint. The device must either
+        throttle or drop data when this happens.
+    """
+    def __init__(self, device, endpoint, transfer_size=0x10000, transfer_count=16, timeout=0):
+        if not endpoint & usb1.ENDPOINT_IN:
+            raise ValueError("Endpoint {:#04x} is not an IN endpoint".format(endpoint))
+        super().__init__(device, endpoint, transfer_size, transfer_count, timeout)
+        self.overruns = 0
+        self._held    = None
+
+    def _starved(self):
+        self.overruns += 1
+
+    def start(self):
+        """Submit all transfers. Called automatically when entering the context manager."""
+        self._running = True
+        for transfer in self._transfers:
+            if not transfer.isSubmitted():
+                self._submit(transfer)
+
+    def read(self):
+        """
+        Wait until the next transfer completes, and return its data as a :class:`memoryview`,
+        which is only valid until the next call to :meth:`read` or :meth:`stop`.
+        The data is returned in the order it was received.
+
+        Raises :exc:`usb1.USBError` if a transfer fails. If the transfer received any data
+        before failing (e.g. if it timed out), that data is returned first, and the error
+        is raised by the next call. Either way, the transfer is resubmitted by the next call,
+        so reading can continue after the error.
+        """
+        if self._held is not None:
+            if self._running:
+                self._submit(self._held)
+            self._held = None
+
+        self._check_error()
+        self._wait()
+        transfer = self._completed.popleft()
+        length = transfer.getActualLength()
+        self._held = transfer
+        status = transfer.getStatus()
+        if status != usb1.TRANSFER_COMPLETED:
+            if length == 0:
+                raise _transfer_error(status)
+            self._error = _transfer_error(status)
+        self.bytes_transferred += length
+        # Depending on the version of usb1, the transfer uses our buffer or a copy of it.
+        return memoryview(transfer.getBuffer()).cast("B")[:length]
+
+    def __iter__(self):
+        while True:
+            yield self.read()
+
+    def run(self, callback):
+        """
+        Call ``callback`` with each :meth:`read` result until it returns ``False``.
+        """
+        while callback(self.read()) is not False:
+            pass
+
+    def stop(self):
+        self._held = None
+        super().stop()
+        self._completed.clear()
+
+
+class BulkWriter(_BulkStream):
+    """
+    A continuous writer to an OUT bulk endpoint, for streaming data consumed by the device.
+
+    Up to ``transfer_count`` transfers of ``transfer_size`` bytes each are kept pending on
+    the endpoint. The data is either copied into the transfer buffers by :meth:`write`,
+    or produced in place by a callback passed to :meth:`run`, which avoids copying.
+
+    The writer is used as a context manager::
+
+        with BulkWriter(device, 0x02) as writer:
+            writer.write(data)
+            writer.flush()
+
+    endpoint : int
+        Endpoint address.
+    transfer_size : int
+        Size of each transfer; should be a multiple of the maximum packet size.
+    bytes_transferred : int
+        Number of bytes accepted by the device so far.
+    transfers_completed : int
+        Number of transfers completed so far.
+    underruns : int
+        Number of times every transfer was completed before the application submitted
+        more data, such that no transfer was pending on the endpoint.
+    """
+    def __init__(self, device, endpoint, transfer_size=0x10000, transfer_count=16, timeout=0):
+        if endpoint & usb1.ENDPOINT_IN:
+            raise ValueError("Endpoint {:#04x} is not an OUT endpoint".format(endpoint))
+        super().__init__(device, endpoint, transfer_size, transfer_count, timeout)
+        self.underruns = 0
+        self._filling  = None
+        self._filled   = 0
+
+    def _starved(self):
+        self.underruns += 1
+
+    def _callback(self, transfer):
+        super()._callback(transfer)
+        status = transfer.getStatus()
+        if status != usb1.TRANSFER_CANCELLED:
+            # A failed transfer may have sent some of its data before failing.
+            self.bytes_transferred += transfer.getActualLength()
+            if status != usb1.TRANSFER_COMPLETED and self._error is None:
+                self._error = _transfer_error(status)
+
+    def start(self):
+        """Prepare the writer. Called automatically when entering the context manager."""
+        self._running = True
+        self._completed.extend(transfer for transfer in self._transfers
+                               if not transfer.isSubmitted())
+
+    def _acquire(self):
+        self._wait()
+        return self._completed.popleft()
+
+    def _release(self, transfer, length):
+        index = transfer.getUserData()
+        if length == self.transfer_size:
+            transfer.setBuffer(self._buffers[index])
+        else:
+            transfer.setBuffer(self._buffers[index][:length])
+        self._submit(transfer)
+
+    def write(self, data):
+        """
+        Copy ``data`` into the transfer buffers, and submit every buffer that becomes full.
+        Waits for a transfer to complete if all of them are pending. Raises
+        :exc:`usb1.USBError` if a transfer fails; the data it did not send is not resent,
+        and :attr:`bytes_transferred` only counts the data the device accepted.
+        """
+        data = memoryview(data).cast("B")
+        while len(data) > 0:
+            if self._filling is None:
+                self._filling, self._filled = self._acquire(), 0
+            buffer = self._buffers[self._filling.getUserData()]
+            length = min(len(data), self.transfer_size - self._filled)
+            buffer[self._filled:self._filled + length] = data[:length]
+            self._filled += length
+            data = data[length:]
+            if self._filled == self.transfer_size:
+                self._release(self._filling, self._filled)
+                self._filling = None
+
+    def flush(self):
+        """Submit the partially filled buffer, if any, and wait until all transfers complete."""
+        if self._filling is not None:
+            self._release(self._filling, self._filled)
+            self._filling = None
+        # Running out of data at the end of the stream is not an underrun.
+        self._running = False
+        try:
+            self._drain()
+        finally:
+            self._running = True
+
+    def run(self, callback):
+        """
+        Call ``callback`` with a :class:`memoryview` of a free transfer buffer, and submit
+        the number of bytes it returns, until it returns ``0`` or ``None``. Then wait until
+        all transfers complete.
+        """
+        if self._filling is not None:
+            self.flush()
+        while True:
+            transfer = self._acquire()
+            length = callback(memoryview(self._buffers[transfer.getUserData()]))
+            if not length:
+                self._completed.appendleft(transfer)
+                break
+            self._release(transfer, length)
+        self.flush()
+
+    def stop(self):
+        self._filling = None
+        super().stop()
+        self._completed.clear()
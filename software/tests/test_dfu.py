@@ -0,0 +1,91 @@
+import os
+import unittest
+import usb1
+
+from fx2.dfu import (DFUDevice, DFUError, encode_dfu_suffix, decode_dfu_suffix,
+                     REQ_DNLOAD, REQ_GETSTATUS, STATUS_OK, STATE_dfuDNBUSY, STATE_dfuDNLOAD_IDLE,
+                     STATE_dfuERROR)
+from fx2.sim import SimulatedDFUDevice, STATUS_errADDRESS
+
+
+class DFUTestCase(unittest.TestCase):
+    def setUp(self):
+        self.usb = SimulatedDFUDevice(size=4096, transfer_size=512, write_time=0)
+        self.dfu = DFUDevice(self.usb, transfer_size=512)
+
+    def test_round_trip(self):
+        image = os.urandom(3000)
+        self.dfu.download(image)
+        self.assertTrue(self.usb.manifested)
+        self.assertEqual(self.usb.memory[:len(image)], image)
+        self.assertEqual(self.dfu.upload(), self.usb.memory)
+
+    def test_upload_short_block(self):
+        self.usb.memory = bytearray(os.urandom(1000))
+        self.assertEqual(self.dfu.upload(), self.usb.memory)
+
+    def test_download_error(self):
+        with self.assertRaisesRegex(DFUError, "errADDRESS"):
+            self.dfu.download(bytes(5000))
+        self.assertFalse(self.usb.manifested)
+        # The error is cleared, so the next download succeeds.
+        self.dfu.download(bytes(100))
+        self.assertTrue(self.usb.manifested)
+
+    def test_busy(self):
+        self.dfu._control_write(REQ_DNLOAD, 0, bytes(512))
+        self.assertEqual(self.dfu.get_status(), (STATUS_OK, STATE_dfuDNBUSY))
+        self.assertEqual(self.dfu.get_status(), (STATUS_OK, STATE_dfuDNLOAD_IDLE))
+
+    def test_dnload_buffer(self):
+        self.usb.dnload_buffer = True
+        image = os.urandom(3000)
+        self.dfu.download(image)
+        self.assertTrue(self.usb.manifested)
+        self.assertEqual(self.usb.memory[:len(image)], image)
+
+    def test_error_status_kept(self):
+        self.usb.dnload_buffer = True
+        self.usb.memory = bytearray(100)
+        self.dfu._control_write(REQ_DNLOAD, 0, bytes(512))
+        # The host is not told about the error yet, and sends the next block.
+        self.assertEqual(self.dfu.get_status(), (STATUS_OK, STATE_dfuDNLOAD_IDLE))
+        with self.assertRaises(usb1.USBErrorPipe):
+            self.dfu._control_write(REQ_DNLOAD, 1, bytes(512))
+        self.assertEqual(self.dfu.get_status(), (STATUS_errADDRESS, STATE_dfuERROR))
+
+    def test_download_deferred_error(self):
+        self.usb.dnload_buffer = True
+        # The error writing the first block is reported by stalling the second one.
+        with self.assertRaisesRegex(DFUError, "errADDRESS"):
+            self.dfu.download(bytes(5000))
+        self.assertFalse(self.usb.manifested)
+        self.assertEqual(self.usb.requests[-3:-1],
+                         [(REQ_DNLOAD, 9, 392), (REQ_GETSTATUS, 0, 6)])
+        self.dfu.download(bytes(100))
+        self.assertTrue(self.usb.manifested)
+
+    def test_download_deferred_error_last_block(self):
+        self.usb.dnload_buffer = True
+        # The error writing the last block is reported by stalling the zero length block.
+        with self.assertRaisesRegex(DFUError, "errADDRESS"):
+            self.dfu.download(bytes(4096 + 100))
+        self.assertFalse(self.usb.manifested)
+        self.assertEqual(self.usb.requests[-3:-1],
+                         [(REQ_DNLOAD, 9, 0), (REQ_GETSTATUS, 0, 6)])
+
+    def test_suffix(self):
+        image  = os.urandom(100)
+        suffixed = encode_dfu_suffix(image, 0x04b4, 0x8613, 0x0001)
+        self.assertEqual(decode_dfu_suffix(suffixed), (image, 0x04b4, 0x8613, 0x0001))
+
+        corrupted = bytearray(suffixed)
+        corrupted[0] ^= 1
+        with self.assertRaisesRegex(ValueError, "CRC mismatch"):
+            decode_dfu_suffix(corrupted)
+        with self.assertRaisesRegex(ValueError, "no DFU suffix"):
+            decode_dfu_suffix(image)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,71 @@
+import io
+import os
+import unittest
+
+from fx2.format import diff_pages, input_data, output_data
+
+
+class DiffPagesTestCase(unittest.TestCase):
+    def setUp(self):
+        self.old = bytes(range(256)) * 4
+
+    def change(self, *addrs):
+        new = bytearray(self.old)
+        for addr in addrs:
+            new[addr] ^= 0xff
+        return bytes(new)
+
+    def test_unchanged(self):
+        self.assertEqual(diff_pages(self.old, self.old, 16), [])
+
+    def test_page_alignment(self):
+        new = self.change(0x25)
+        self.assertEqual(diff_pages(self.old, new, 16), [(0x20, new[0x20:0x30])])
+
+    def test_separate_pages(self):
+        new = self.change(0x05, 0x35)
+        self.assertEqual(diff_pages(self.old, new, 16),
+                         [(0x00, new[0x00:0x10]), (0x30, new[0x30:0x40])])
+
+    def test_adjacent_pages(self):
+        new = self.change(0x0f, 0x10)
+        self.assertEqual(diff_pages(self.old, new, 16), [(0x00, new[0x00:0x20])])
+
+    def test_max_gap(self):
+        new = self.change(0x05, 0x35)
+        self.assertEqual(diff_pages(self.old, new, 16, max_gap=1),
+                         [(0x00, new[0x00:0x10]), (0x30, new[0x30:0x40])])
+        self.assertEqual(diff_pages(self.old, new, 16, max_gap=2), [(0x00, new[0x00:0x40])])
+
+    def test_across_blocks(self):
+        # The images are compared in 256-byte blocks first.
+        new = self.change(0xff, 0x100, 0x3ff)
+        self.assertEqual(diff_pages(self.old, new, 8),
+                         [(0xf8, new[0xf8:0x108]), (0x3f8, new[0x3f8:0x400])])
+
+    def test_grown(self):
+        new = self.old + b"\x00" * 20
+        self.assertEqual(diff_pages(self.old, new, 16), [(0x400, new[0x400:])])
+
+    def test_shrunk(self):
+        new = self.change(0x3f0)[:0x3f5]
+        self.assertEqual(diff_pages(self.old, new, 16), [(0x3f0, new[0x3f0:])])
+
+
+class IntelHexTestCase(unittest.TestCase):
+    def round_trip(self, data):
+        output = io.BytesIO()
+        output_data(output, data, "ihex")
+        return input_data(io.BytesIO(output.getvalue()), "ihex")
+
+    def test_round_trip(self):
+        data = [(0x0000, os.urandom(1000)), (0x2000, os.urandom(5)), (0x1fff0, os.urandom(40))]
+        self.assertEqual(self.round_trip(data), data)
+
+    def test_end_of_file(self):
+        self.assertEqual(input_data(io.BytesIO(b":0100000055AA\n:00000001FF\ngarbage"), "ihex"),
+                         [(0x0000, b"\x55")])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,76 @@
+import os
+import unittest
+import usb1
+
+from fx2 import FX2Device, REG_CPUCS
+from fx2.sim import SimulatedFX2Device
+
+
+class FX2DeviceTestCase(unittest.TestCase):
+    def setUp(self):
+        self.usb = SimulatedFX2Device()
+        self.device = FX2Device(usb=self.usb)
+
+    def load_bootloader(self):
+        # Any firmware is assumed to implement the requests of the second stage bootloader.
+        self.device.load_ram([(0x0000, b"\x02\x00\x00")])
+
+    def test_load_ram(self):
+        firmware = [(0x0000, os.urandom(5000)), (0x3000, os.urandom(100))]
+        self.device.load_ram(firmware)
+        for (addr, chunk) in firmware:
+            self.assertEqual(self.usb.ram[addr:addr + len(chunk)], chunk)
+        # The CPU is brought out of reset.
+        self.assertEqual(self.usb.ram[REG_CPUCS], 0)
+
+    def test_read_ram(self):
+        self.usb.ram[0x1000:0x3000] = os.urandom(0x2000)
+        self.assertEqual(self.device.read_ram(0x1000, 0x2000), self.usb.ram[0x1000:0x3000])
+        # The ROM only reads words, so an unaligned read is served from the preceding word.
+        self.assertEqual(self.device.read_ram(0x1001, 0x1fff), self.usb.ram[0x1001:0x3000])
+
+    def check_boot_eeprom(self, addr_width):
+        self.usb.address_width = addr_width
+        data = os.urandom(1000)
+        self.load_bootloader()
+        self.device.write_boot_eeprom(0x0100, data, addr_width, chunk_size=0x40, page_size=6)
+        self.assertEqual(self.usb.eeprom[0x0100:0x0100 + len(data)], data)
+        self.assertEqual(self.device.read_boot_eeprom(0x0100, len(data), addr_width), data)
+        # Each of the 64-byte pages 0x0100-0x04ff is written in a single write cycle.
+        self.assertEqual(self.usb.write_cycles, 16)
+
+    def test_boot_eeprom(self):
+        self.check_boot_eeprom(addr_width=2)
+
+    def test_boot_eeprom_single_byte(self):
+        self.usb.eeprom = self.usb.eeprom[:256]
+        self.usb.address_width = 1
+        self.load_bootloader()
+        self.device.write_boot_eeprom(0x10, b"\x55" * 100, 1)
+        self.assertEqual(self.device.read_boot_eeprom(0x10, 100, 1), b"\x55" * 100)
+
+    def test_boot_eeprom_bulk_loader(self):
+        self.usb.bulk_loader = True
+        self.device.use_bulk_loader = True
+        self.check_boot_eeprom(addr_width=2)
+        # The bulk command channel has been discovered and used.
+        self.assertEqual(self.device._bulk_loader, (0x02, 0x86))
+
+    def test_boot_eeprom_bulk_loader_absent(self):
+        self.device.use_bulk_loader = True
+        self.check_boot_eeprom(addr_width=2)
+        self.assertFalse(self.device._bulk_loader)
+
+    def test_boot_eeprom_bulk_loader_disabled(self):
+        # The bulk command channel is only used if explicitly enabled.
+        self.usb.bulk_loader = True
+        self.check_boot_eeprom(addr_width=2)
+        self.assertIsNone(self.device._bulk_loader)
+
+    def test_boot_eeprom_requires_bootloader(self):
+        with self.assertRaises(usb1.USBErrorPipe):
+            self.device.read_boot_eeprom(0, 16, 2)
+
+
+if __name__ == "__main__":
+    unittest.main()
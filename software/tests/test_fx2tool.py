@@ -0,0 +1,112 @@
+import io
+import os
+import tempfile
+import unittest
+from unittest import mock
+
+from fx2 import FX2Config, FX2Device
+from fx2.format import output_data
+from fx2.fx2tool import get_argparser, program_device, update_device, main
+from fx2.sim import SimulatedFX2Device
+
+
+class FX2ToolTestCase(unittest.TestCase):
+    def setUp(self):
+        self.usb = SimulatedFX2Device()
+        self.device = FX2Device(usb=self.usb)
+        # Any firmware is assumed to implement the requests of the second stage bootloader.
+        self.device.load_ram([(0x0000, b"\x02\x00\x00")])
+        self.firmware = [(0x0000, os.urandom(3000)), (0x2000, os.urandom(200))]
+
+    def parse_args(self, *args):
+        return get_argparser().parse_args(args)
+
+    def decode_eeprom(self):
+        return FX2Config.decode(self.usb.eeprom)
+
+    def make_config(self, firmware, **kwargs):
+        config = FX2Config(**kwargs)
+        for (addr, chunk) in firmware:
+            config.append(addr, chunk)
+        return config
+
+    def test_program(self):
+        args = self.parse_args("program", "-V", "1234", "-P", "5678", "-p", "64")
+        program_device(self.device, args, self.firmware)
+        self.assertEqual(self.decode_eeprom(),
+                         self.make_config(self.firmware, vendor_id=0x1234, product_id=0x5678))
+
+    def test_program_optimize(self):
+        args = self.parse_args("program", "-O", "-p", "64")
+        with mock.patch("sys.stderr", io.StringIO()):
+            program_device(self.device, args, self.firmware)
+        self.usb.ram[:] = bytes(len(self.usb.ram))
+        self.assertIsNotNone(self.usb.boot())
+        for (addr, chunk) in self.firmware:
+            self.assertEqual(self.usb.ram[addr:addr + len(chunk)], chunk)
+
+    def test_update(self):
+        program_device(self.device, self.parse_args("program", "-p", "64"), self.firmware)
+        old_image = bytes(self.usb.eeprom)
+        self.usb.write_cycles = 0
+
+        firmware = [(0x0000, bytearray(self.firmware[0][1])), self.firmware[1]]
+        firmware[0][1][1500] ^= 0xff
+        update_device(self.device, self.parse_args("update", "-p", "64"), firmware)
+        self.assertEqual(self.decode_eeprom(), self.make_config(firmware))
+        # Only the page containing the changed byte is rewritten.
+        self.assertEqual(self.usb.write_cycles, 1)
+        changed = [addr for addr in range(len(old_image))
+                   if old_image[addr] != self.usb.eeprom[addr]]
+        self.assertEqual(len(changed), 1)
+
+    def test_update_ids(self):
+        program_device(self.device, self.parse_args("program", "-p", "64"), self.firmware)
+        self.usb.write_cycles = 0
+        update_device(self.device, self.parse_args("update", "-D", "abcd", "-p", "64"), None)
+        config = self.decode_eeprom()
+        self.assertEqual(config.device_id, 0xabcd)
+        self.assertEqual(config.firmware[-1], self.firmware[-1])
+        self.assertEqual(self.usb.write_cycles, 1)
+
+    def test_update_erased(self):
+        with self.assertRaisesRegex(ValueError, "Device erased"):
+            update_device(self.device, self.parse_args("update", "-p", "64"), None)
+
+
+class FX2ToolMainTestCase(unittest.TestCase):
+    def setUp(self):
+        self.tempdir = tempfile.TemporaryDirectory()
+        self.eeprom_file = os.path.join(self.tempdir.name, "eeprom.bin")
+        self.firmware_file = os.path.join(self.tempdir.name, "firmware.ihex")
+        self.firmware = [(0x0000, os.urandom(2000))]
+        with open(self.firmware_file, "wb") as f:
+            output_data(f, self.firmware, "ihex")
+
+    def tearDown(self):
+        self.tempdir.cleanup()
+
+    def run_fx2tool(self, *args):
+        stderr = io.StringIO()
+        with mock.patch("sys.argv", ["fx2tool", "--simulate", self.eeprom_file, "-B", *args]), \
+                mock.patch("sys.stderr", stderr):
+            main()
+        return stderr.getvalue()
+
+    def read_eeprom(self):
+        with open(self.eeprom_file, "rb") as f:
+            return f.read()
+
+    def test_program_update(self):
+        output = self.run_fx2tool("program", "-p", "64", "-f", self.firmware_file)
+        self.assertIn("Simulated boot time", output)
+        config = FX2Config.decode(self.read_eeprom())
+        self.assertEqual(b"".join(chunk for (addr, chunk) in config.firmware),
+                         self.firmware[0][1])
+
+        self.run_fx2tool("update", "-p", "64", "-n")
+        self.assertEqual(FX2Config.decode(self.read_eeprom()).firmware, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
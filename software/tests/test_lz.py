@@ -0,0 +1,66 @@
+import os
+import unittest
+
+from fx2 import FX2Config
+from fx2.lz import compress, decompress, encode_payload, decode_payload, compress_config
+from fx2.sim import SimulatedFX2Device
+
+
+class LZTestCase(unittest.TestCase):
+    def check_round_trip(self, data):
+        compressed = compress(data)
+        self.assertEqual(decompress(compressed, len(data)), (data, len(compressed)))
+        return compressed
+
+    def test_empty(self):
+        self.check_round_trip(b"")
+
+    def test_random(self):
+        self.check_round_trip(os.urandom(3000))
+
+    def test_repetitive(self):
+        data = b"\x00" * 1000 + b"abcabcabcabd" * 100 + os.urandom(100) * 3
+        self.assertLess(len(self.check_round_trip(data)), len(data) // 4)
+
+    def test_overlapping_match(self):
+        # A match may copy the bytes it has just produced.
+        self.check_round_trip(b"a" + b"b" * 100)
+
+    def test_invalid(self):
+        with self.assertRaisesRegex(ValueError, "Truncated"):
+            decompress(compress(b"abcdef"), 7)
+        with self.assertRaisesRegex(ValueError, "Invalid match"):
+            decompress(b"\x01\x00\x00", 3)
+
+    def test_payload(self):
+        chunks = [(0x0000, b"\x02\x01\x00"), (0x0100, os.urandom(500)), (0x2000, b"\x00" * 800)]
+        payload = encode_payload(chunks, entry=0x0100, max_gap=0)
+        self.assertEqual(decode_payload(b"\xff" + payload, 1), (chunks, 0x0100, len(payload)))
+
+    def test_payload_merge(self):
+        payload = encode_payload([(0x0000, b"\x01\x02"), (0x0004, b"\x03")], max_gap=2)
+        self.assertEqual(decode_payload(payload),
+                         ([(0x0000, b"\x01\x02\x00\x00\x03")], 0x0000, len(payload)))
+
+    def test_compress_config(self):
+        stage  = [(0x3c00, b"\x02\x3c\x03" + bytes(100))]
+        config = FX2Config()
+        config.append(0x0000, b"\x02\x01\x00")
+        config.append(0x0100, os.urandom(200) * 4)
+        stage_config, payload = compress_config(config, stage)
+
+        device = SimulatedFX2Device(stage_config.encode() + payload)
+        self.assertIsNotNone(device.boot())
+        for (addr, chunk) in config.firmware:
+            self.assertEqual(device.ram[addr:addr + len(chunk)], chunk)
+
+    def test_compress_config_overlap(self):
+        stage  = [(0x3c00, b"\x02\x3c\x03")]
+        config = FX2Config()
+        config.append(0x3b00, bytes(0x200))
+        with self.assertRaisesRegex(ValueError, "overlaps the decompressor"):
+            compress_config(config, stage)
+
+
+if __name__ == "__main__":
+    unittest.main()